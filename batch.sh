@@ -0,0 +1,6 @@
+# Builds and runs the batch command line driver on Linux, e.g.
+#   ./batch.sh --threads 8 photo ~/archived_photos
+#   ./batch.sh convert saved_nfas/ > converted.jsonl
+#   CXXFLAGS=-DMAINCODE_TRACING ./batch.sh --trace trace.json photo ~/archived_photos
+# Needs OpenCV 4 installed where pkg-config can find it (e.g. apt install libopencv-dev)
+(cd ios && g++ -std=c++11 -O2 -pthread $CXXFLAGS $(pkg-config --cflags opencv4) mainCode.cpp batch.cpp -o batch $(pkg-config --libs opencv4)) && ios/batch "$@"
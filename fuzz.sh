@@ -0,0 +1,6 @@
+# Builds and runs the differential fuzzing harness on Linux in deterministic seed mode, e.g.
+#   ./fuzz.sh --seeds 100000
+#   ./fuzz.sh --start 5000 --seeds 10
+#   ./fuzz.sh crash-1234   (replays a libFuzzer input)
+# See ios/fuzz.cpp for building it as a libFuzzer target instead
+(cd ios && g++ -std=c++11 -O2 -pthread $CXXFLAGS $(pkg-config --cflags opencv4) mainCode.cpp fuzz.cpp -o fuzz $(pkg-config --libs opencv4)) && ios/fuzz "$@"
@@ -9,9 +9,10 @@
 #define RCTCPPCode_h
 
 #import <React/RCTBridgeModule.h>
+#import <React/RCTEventEmitter.h>
 #import "mainCode.hpp"
 
-@interface RCTCPPCode : NSObject <RCTBridgeModule>
+@interface RCTCPPCode : RCTEventEmitter <RCTBridgeModule>
 
 - (mainCode::NFA)createNFAFromJSON:(NSDictionary *)nfaDict;
 
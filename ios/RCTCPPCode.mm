@@ -9,10 +9,49 @@
 
 #import "RCTCPPCode.h"
 
-@implementation RCTCPPCode
+@implementation RCTCPPCode {
+  std::unique_ptr<mainCode::EditableNFA> _editableNFA; // Structure currently open on the edit page
+  std::shared_ptr<mainCode::CancellationToken> _conversionCancellation; // Stops the conversion currently running
+  std::shared_ptr<mainCode::CancellationToken> _photoCancellation; // Stops the photo currently being processed
+  BOOL _hasListeners;
+}
 
 RCT_EXPORT_MODULE();
 
++ (BOOL)requiresMainQueueSetup {
+  return NO;
+}
+
+- (NSArray<NSString *> *)supportedEvents {
+  return @[@"photoToNFAProgress"]; // Body has stage and percentage
+}
+
+- (void)startObserving {
+  _hasListeners = YES;
+}
+
+- (void)stopObserving {
+  _hasListeners = NO;
+}
+
+- (mainCode::State)createStateFromJSON:(NSDictionary *)stateDict {
+  int _id = [stateDict[@"id"] intValue];
+  std::string name = [stateDict[@"name"] UTF8String];
+  bool isStart = [stateDict[@"isStart"] boolValue];
+  bool isFinal = [stateDict[@"isFinal"] boolValue];
+
+  return mainCode::State(_id, name, isStart, isFinal);
+}
+
+- (mainCode::Transition)createTransitionFromJSON:(NSDictionary *)transitionDict {
+  int _id = [transitionDict[@"id"] intValue];
+  int start = [transitionDict[@"start"] intValue];
+  int end = [transitionDict[@"end"] intValue];
+  std::string token = [transitionDict[@"token"] UTF8String];
+
+  return mainCode::Transition(_id, start, end, token);
+}
+
 - (mainCode::NFA)createNFAFromJSON:(NSDictionary *)nfaDict {
   bool isDfa = [nfaDict[@"isDfa"] boolValue];
   NSArray *stateDicts = nfaDict[@"states"];
@@ -21,25 +60,13 @@ RCT_EXPORT_MODULE();
   // Generate states
   std::vector<mainCode::State> states;
   for (NSDictionary *stateDict in stateDicts) {
-    int _id = [stateDict[@"id"] intValue];
-    std::string name = [stateDict[@"name"] UTF8String];
-    bool isStart = [stateDict[@"isStart"] boolValue];
-    bool isFinal = [stateDict[@"isFinal"] boolValue];
-
-    mainCode::State state(_id, name, isStart, isFinal);
-    states.push_back(state);
+    states.push_back([self createStateFromJSON:stateDict]);
   }
 
   // Generate transitions
   std::vector<mainCode::Transition> transitions;
   for (NSDictionary *transitionDict in transitionDicts) {
-    int _id = [transitionDict[@"id"] intValue];
-    int start = [transitionDict[@"start"] intValue];
-    int end = [transitionDict[@"end"] intValue];
-    std::string token = [transitionDict[@"token"] UTF8String];
-
-    mainCode::Transition transition(_id, start, end, token);
-    transitions.push_back(transition);
+    transitions.push_back([self createTransitionFromJSON:transitionDict]);
   }
 
   return mainCode::NFA(isDfa, states, transitions);
@@ -51,7 +78,7 @@ RCT_EXPORT_METHOD(simplifyDFA:(NSDictionary *)dfaDict
 {
   @try {
     mainCode::NFA dfa = [self createNFAFromJSON:dfaDict];
-    mainCode::NFA resultingDfa = mainCode::simplifyDFA(dfa);
+    mainCode::NFA resultingDfa = mainCode::cachedSimplifyDFA(dfa); // Only computed once per distinct structure
     std::string result = resultingDfa.convertToJSON(false);
     resolve(@(result.c_str()));
   } @catch (NSException *exception) {
@@ -65,7 +92,7 @@ RCT_EXPORT_METHOD(convertNFAtoDFA:(NSDictionary *)nfaDict
 {
   @try {
     mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
-    mainCode::NFA resultingDfa = mainCode::convertNFAtoDFA(nfa);
+    mainCode::NFA resultingDfa = mainCode::cachedConvertNFAtoDFA(nfa); // Only computed once per distinct structure
     std::string result = resultingDfa.convertToJSON(false);
     resolve(@(result.c_str()));
   } @catch (NSException *exception) {
@@ -73,53 +100,283 @@ RCT_EXPORT_METHOD(convertNFAtoDFA:(NSDictionary *)nfaDict
   }
 }
 
-RCT_EXPORT_METHOD(runNFAorDFA:(NSDictionary *)nfaDict
-                  withWord:(NSString *)word
+// Budget has optional maxStates, maxBytes and maxMilliseconds. Runs off the module queue so cancelConversion can stop it
+RCT_EXPORT_METHOD(convertNFAtoDFAWithBudget:(NSDictionary *)nfaDict
+                  budget:(NSDictionary *)budgetDict
                   resolver:(RCTPromiseResolveBlock)resolve
                   rejecter:(RCTPromiseRejectBlock)reject)
 {
   @try {
     mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
-    std::set<int> resultingStates;
-    if (nfa.IsDfa) {
-      resultingStates = mainCode::runDFA(nfa, [word UTF8String]);
-    } else {
-      resultingStates = mainCode::runNFA(nfa, [word UTF8String]);
+    mainCode::ConversionBudget budget([budgetDict[@"maxStates"] unsignedLongValue], [budgetDict[@"maxBytes"] unsignedLongValue], [budgetDict[@"maxMilliseconds"] longValue]);
+    if (_conversionCancellation) {
+      _conversionCancellation->cancel(); // Only one conversion at a time
+    }
+    std::shared_ptr<mainCode::CancellationToken> cancellation = std::make_shared<mainCode::CancellationToken>();
+    _conversionCancellation = cancellation;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+      // Nothing above this block catches C++ exceptions, so an uncaught one would end the app
+      try {
+        std::string result = mainCode::cachedBoundedConvertNFAtoDFA(nfa, budget, cancellation.get()).convertToJSON(false);
+        resolve(@(result.c_str()));
+      } catch (const std::exception& e) {
+        reject(@"ConversionFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+      }
+    });
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(cancelConversion:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  if (_conversionCancellation) {
+    _conversionCancellation->cancel();
+  }
+  resolve(nil);
+}
+
+RCT_EXPORT_METHOD(areEquivalent:(NSDictionary *)nfaDict1
+                  withStructure:(NSDictionary *)nfaDict2
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa1 = [self createNFAFromJSON:nfaDict1];
+      mainCode::NFA nfa2 = [self createNFAFromJSON:nfaDict2];
+      std::string result = mainCode::areEquivalent(nfa1, nfa2).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"EquivalenceFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(isIncluded:(NSDictionary *)nfaDict1
+                  inStructure:(NSDictionary *)nfaDict2
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa1 = [self createNFAFromJSON:nfaDict1];
+      mainCode::NFA nfa2 = [self createNFAFromJSON:nfaDict2];
+      std::string result = mainCode::isIncluded(nfa1, nfa2).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"InclusionFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(isUniversal:(NSDictionary *)nfaDict
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      std::string result = mainCode::isUniversal(nfa).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"UniversalityFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(combineStructures:(NSDictionary *)nfaDict1
+                  withStructure:(NSDictionary *)nfaDict2
+                  operation:(NSString *)operation
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa1 = [self createNFAFromJSON:nfaDict1];
+      mainCode::NFA nfa2 = [self createNFAFromJSON:nfaDict2];
+      mainCode::ProductOperation productOperation;
+      if ([operation isEqualToString:@"intersection"]) {
+        productOperation = mainCode::ProductOperation::Intersection;
+      } else if ([operation isEqualToString:@"union"]) {
+        productOperation = mainCode::ProductOperation::Union;
+      } else if ([operation isEqualToString:@"difference"]) {
+        productOperation = mainCode::ProductOperation::Difference;
+      } else { // Rejected rather than guessed, so a typo cannot silently give an intersection
+        reject(@"UnknownOperation", [NSString stringWithFormat:@"Error: Unknown operation '%@', expected intersection, union or difference", operation], nil);
+        return;
+      }
+      std::string result = mainCode::productOf(nfa1, nfa2, productOperation).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"CombineFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(complementStructure:(NSDictionary *)nfaDict
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      std::string result = mainCode::complementOf(nfa).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"ComplementFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(reduceStructure:(NSDictionary *)nfaDict
+                  backward:(BOOL)backward
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      std::string result = mainCode::reduceNFA(nfa, backward).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"ReduceFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
     }
-    bool result = false;
-    for (int resultingState : resultingStates) { // Check to see if there is a final state in resulting states
-      for (mainCode::State state : nfa.States) {
-        if (state.Id == resultingState && state.IsFinal) {
-          result = true;
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(getResultCacheStatistics:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  std::string result = mainCode::resultCache().statisticsToJSON();
+  resolve(@(result.c_str()));
+}
+
+RCT_EXPORT_METHOD(getRunStatistics:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  std::string result = mainCode::compiledAutomata().statisticsToJSON();
+  resolve(@(result.c_str()));
+}
+
+RCT_EXPORT_METHOD(setResultCacheLimit:(nonnull NSNumber *)maxBytes
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  mainCode::resultCache().setMaxBytes([maxBytes unsignedLongValue]); // Locked, since bridge calls can be using the cache
+  resolve(@(true));
+}
+
+// Lazy only affects NFAs, which then keep the DFA states their words reach for later runs
+RCT_EXPORT_METHOD(runNFAorDFA:(NSDictionary *)nfaDict
+                  withWord:(NSString *)word
+                  lazy:(BOOL)lazy
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      std::set<int> resultingStates;
+      if (nfa.IsDfa) {
+        resultingStates = mainCode::runDFA(nfa, [word UTF8String]);
+      } else {
+        resultingStates = mainCode::runNFA(nfa, [word UTF8String], lazy);
+      }
+      bool result = false;
+      for (int resultingState : resultingStates) { // Check to see if there is a final state in resulting states
+        for (mainCode::State state : nfa.States) {
+          if (state.Id == resultingState && state.IsFinal) {
+            result = true;
+          }
         }
       }
+      resolve(@(result));
+    } catch (const std::exception& e) {
+      reject(@"RunFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
     }
-    resolve(@(result));
   } @catch (NSException *exception) {
     reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
   }
 }
 
+// Runs off the module queue. Starting another photo cancels this one, which then resolves with "Cancelled"
 RCT_EXPORT_METHOD(photoToNFA:(NSString *)path
                   resolver:(RCTPromiseResolveBlock)resolve
                   rejecter:(RCTPromiseRejectBlock)reject)
+{
+  if (_photoCancellation) {
+    _photoCancellation->cancel();
+  }
+  std::shared_ptr<mainCode::CancellationToken> cancellation = std::make_shared<mainCode::CancellationToken>();
+  _photoCancellation = cancellation;
+  std::string photoPath = [path UTF8String];
+  __weak RCTCPPCode *weakSelf = self;
+  dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+    @try {
+      try { // OpenCV reports failed assertions and bad images with cv::Exception
+        std::string result = mainCode::photoToNFA(photoPath, false, cancellation.get(), [weakSelf, cancellation](std::string stage, int percentage) {
+          RCTCPPCode *strongSelf = weakSelf;
+          if (strongSelf && strongSelf->_hasListeners && !cancellation->isCancelled()) {
+            [strongSelf sendEventWithName:@"photoToNFAProgress" body:@{@"stage": @(stage.c_str()), @"percentage": @(percentage)}];
+          }
+        });
+        resolve(@(result.c_str()));
+      } catch (const std::exception& e) {
+        reject(@"PhotoToNFAFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+      }
+    } @catch (NSException *exception) {
+      reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+    }
+  });
+}
+
+// Chrome trace_event JSON of everything traced so far. Empty unless built with MAINCODE_TRACING
+RCT_EXPORT_METHOD(exportTrace:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
 {
   @try {
-    std::string result = mainCode::photoToNFA([path UTF8String], false);
-    resolve(@(result.c_str()));
+    std::string trace = mainCode::exportChromeTrace();
+    resolve(@(trace.c_str()));
   } @catch (NSException *exception) {
     reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
   }
 }
 
+RCT_EXPORT_METHOD(cancelPhotoToNFA:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  if (_photoCancellation) {
+    _photoCancellation->cancel();
+  }
+  resolve(nil);
+}
+
 RCT_EXPORT_METHOD(validateNFA:(NSDictionary *)nfaDict
                   resolver:(RCTPromiseResolveBlock)resolve
                   rejecter:(RCTPromiseRejectBlock)reject)
 {
   @try {
-    mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
-    int result = mainCode::validateNFA(nfa);
-    resolve(@(result));
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      int result = mainCode::validateNFA(nfa);
+      resolve(@(result));
+    } catch (const std::exception& e) {
+      reject(@"ValidationFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
   } @catch (NSException *exception) {
     reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
   }
@@ -130,34 +387,103 @@ RCT_EXPORT_METHOD(checkIfDFA:(NSDictionary *)nfaDict
                   rejecter:(RCTPromiseRejectBlock)reject)
 {
   @try {
-    mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
-    bool result = mainCode::checkIfDFA(nfa);
-    resolve(@(result));
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      bool result = mainCode::checkIfDFA(nfa);
+      resolve(@(result));
+    } catch (const std::exception& e) {
+      reject(@"CheckIfDFAFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
   } @catch (NSException *exception) {
     reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
   }
 }
 
-RCT_EXPORT_METHOD(runCharacter:(NSDictionary *)nfaDict
-                  withWord:(NSString *)word
+RCT_EXPORT_METHOD(analyzeNFA:(NSDictionary *)nfaDict
                   resolver:(RCTPromiseResolveBlock)resolve
                   rejecter:(RCTPromiseRejectBlock)reject)
 {
   @try {
-    mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
-    std::set<int> result;
-    if (nfa.IsDfa) {
-      result = mainCode::runDFA(nfa, [word UTF8String]);
-    } else {
-      result = mainCode::runNFA(nfa, [word UTF8String]);
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      std::string result = mainCode::analyzeNFA(nfa).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"AnalysisFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(startEditing:(NSDictionary *)nfaDict
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      _editableNFA.reset(new mainCode::EditableNFA(nfa));
+      std::string result = _editableNFA->summaryToJSON();
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"StartEditingFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
+    }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
+
+RCT_EXPORT_METHOD(applyNFAEdits:(NSArray *)edits
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      if (!_editableNFA) {
+        reject(@"NotEditing", @"Error: startEditing must be called first", nil);
+        return;
+      }
+      for (NSDictionary *edit in edits) {
+        NSString *type = edit[@"type"];
+        if ([type isEqualToString:@"addState"]) {
+          _editableNFA->addState([self createStateFromJSON:edit[@"state"]]);
+        } else if ([type isEqualToString:@"updateState"]) {
+          _editableNFA->updateState([self createStateFromJSON:edit[@"state"]]);
+        } else if ([type isEqualToString:@"removeState"]) {
+          _editableNFA->removeState([edit[@"id"] intValue]);
+        } else if ([type isEqualToString:@"addTransition"]) {
+          _editableNFA->addTransition([self createTransitionFromJSON:edit[@"transition"]]);
+        } else if ([type isEqualToString:@"updateTransition"]) {
+          _editableNFA->updateTransition([self createTransitionFromJSON:edit[@"transition"]]);
+        } else if ([type isEqualToString:@"removeTransition"]) {
+          _editableNFA->removeTransition([edit[@"id"] intValue]);
+        }
+      }
+      std::string result = _editableNFA->summaryToJSON();
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      _editableNFA.reset(); // Some of the edits may have been applied, so the copy can no longer be trusted
+      reject(@"ApplyEditsFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
     }
+  } @catch (NSException *exception) {
+    reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
+  }
+}
 
-    // Convert result into a resolvable array
-    NSMutableArray *resultArray = [NSMutableArray arrayWithCapacity:result.size()];
-    for (int i : result) {
-      [resultArray addObject:@(i)];
+RCT_EXPORT_METHOD(traceRun:(NSDictionary *)nfaDict
+                  withWord:(NSString *)word
+                  resolver:(RCTPromiseResolveBlock)resolve
+                  rejecter:(RCTPromiseRejectBlock)reject)
+{
+  @try {
+    try {
+      mainCode::NFA nfa = [self createNFAFromJSON:nfaDict];
+      std::string result = mainCode::traceRun(nfa, [word UTF8String]).convertToJSON(false);
+      resolve(@(result.c_str()));
+    } catch (const std::exception& e) {
+      reject(@"TraceRunFailed", [NSString stringWithFormat:@"Error: %@", @(e.what())], nil);
     }
-    resolve(resultArray);
   } @catch (NSException *exception) {
     reject(exception.name, [NSString stringWithFormat:@"Error: %@", exception.reason], nil);
   }
@@ -0,0 +1,215 @@
+#include "mainCode.hpp"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+using namespace mainCode;
+
+// Command line driver for processing many photos or NFA files at once.
+// Every input gives one JSON line on stdout, in the order the inputs were given:
+//   {"input": "...", "result": ..., "milliseconds": ...} or {"input": "...", "error": "...", "milliseconds": ...}
+
+const vector<string> photoExtensions = { ".jpg", ".jpeg", ".png" };
+const vector<string> nfaExtensions = { ".json" };
+const vector<string> operations = { "photo", "convert", "simplify", "reduce", "analyze", "complement", "universal" };
+
+void printUsage() {
+  cerr << "Usage: batch [--threads N] [--trace FILE] photo <images or directories>...\n"
+       << "       batch [--threads N] [--trace FILE] <convert|simplify|reduce|analyze|complement|universal> <NFA JSON files or directories>...\n"
+       << "N defaults to every core. FILE gets a Chrome trace of the run when built with -DMAINCODE_TRACING\n";
+}
+
+bool hasExtension(string path, const vector<string>& extensions) {
+  transform(path.begin(), path.end(), path.begin(), ::tolower);
+  for (const string& extension : extensions) {
+    if (path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Expands directories into the matching files inside them, sorted by name
+vector<string> collectInputs(const vector<string>& arguments, const vector<string>& extensions) {
+  vector<string> inputs;
+  for (const string& argument : arguments) {
+    struct stat info;
+    if (stat(argument.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+      inputs.push_back(argument);
+      continue;
+    }
+    DIR* directory = opendir(argument.c_str());
+    if (directory == nullptr) {
+      inputs.push_back(argument);
+      continue;
+    }
+    vector<string> files;
+    while (dirent* entry = readdir(directory)) {
+      string name = entry->d_name;
+      if (name[0] != '.' && hasExtension(name, extensions)) {
+        files.push_back(argument + (argument.back() == '/' ? "" : "/") + name);
+      }
+    }
+    closedir(directory);
+    sort(files.begin(), files.end());
+    inputs.insert(inputs.end(), files.begin(), files.end());
+  }
+  return inputs;
+}
+
+string readFile(string path) {
+  ifstream file(path);
+  if (!file) {
+    throw runtime_error("Could not open file");
+  }
+  stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Removes the layout whitespace from convertToJSON output so each result fits on one line
+string compactJSON(const string& json) {
+  string compact;
+  bool inString = false;
+  for (size_t i = 0; i < json.size(); i++) {
+    char character = json[i];
+    if (inString) {
+      if (character == '\\') {
+        compact += character;
+        character = json[++i];
+      } else if (character == '"') {
+        inString = false;
+      }
+    } else if (character == '"') {
+      inString = true;
+    } else if (isspace((unsigned char)character)) {
+      continue;
+    }
+    compact += character;
+  }
+  return compact;
+}
+
+// Returns the result as JSON, throwing on failure
+string processInput(string operation, string path, PhotoPipeline& pipeline) {
+  if (operation == "photo") {
+    string result = pipeline.run(path, false);
+    if (result.empty() || result[0] != '{') {
+      throw runtime_error(result);
+    }
+    return result;
+  }
+  NFA nfa = nfaFromJSON(readFile(path));
+  int validationCode = validateNFA(nfa);
+  if (validationCode != 0) {
+    throw runtime_error("Invalid NFA (code " + to_string(validationCode) + ")");
+  }
+  if (operation == "convert") {
+    return convertNFAtoDFA(nfa, 1).convertToJSON(true);
+  } else if (operation == "simplify") {
+    if (!checkIfDFA(nfa)) {
+      throw runtime_error("Not a DFA");
+    }
+    return simplifyDFA(nfa, 1).convertToJSON(true);
+  } else if (operation == "reduce") {
+    return reduceNFA(nfa, true).convertToJSON(true);
+  } else if (operation == "analyze") {
+    return analyzeNFA(nfa).convertToJSON(true);
+  } else if (operation == "complement") {
+    return complementOf(nfa).convertToJSON(true);
+  } else {
+    return isUniversal(nfa).convertToJSON(true);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int threads = thread::hardware_concurrency();
+  string tracePath;
+  vector<string> arguments;
+  for (int i = 1; i < argc; i++) {
+    string argument = argv[i];
+    if (argument == "--threads" && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (argument == "--trace" && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (argument == "--help" || argument == "-h") {
+      printUsage();
+      return 0;
+    } else {
+      arguments.push_back(argument);
+    }
+  }
+  if (arguments.empty() || find(operations.begin(), operations.end(), arguments[0]) == operations.end()) {
+    printUsage();
+    return 1;
+  }
+  string operation = arguments[0];
+  vector<string> inputs = collectInputs(vector<string>(arguments.begin() + 1, arguments.end()), operation == "photo" ? photoExtensions : nfaExtensions);
+  if (threads <= 0) {
+    threads = 1;
+  }
+  threads = min(threads, max((int)inputs.size(), 1));
+  if (threads > 1) {
+    // Items are already spread over the threads, so OpenCV's own pool would only compete with them
+    setNumThreads(1);
+  }
+
+  vector<string> lines(inputs.size());
+  vector<bool> finished(inputs.size(), false);
+  size_t nextToPrint = 0;
+  int failures = 0;
+  mutex outputMutex;
+  atomic<size_t> nextInput(0);
+  chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+  auto worker = [&]() {
+    PhotoPipeline pipeline; // Kept for every photo this thread processes, so its buffers are reused
+    for (size_t i = nextInput++; i < inputs.size(); i = nextInput++) {
+      chrono::steady_clock::time_point itemBegin = chrono::steady_clock::now();
+      string outcome;
+      bool failed = false;
+      try {
+        outcome = "\"result\": " + compactJSON(processInput(operation, inputs[i], pipeline));
+      } catch (const exception& e) {
+        outcome = "\"error\": \"" + escapeJSON(e.what()) + "\"";
+        failed = true;
+      }
+      double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - itemBegin).count();
+      string line = "{\"input\": \"" + escapeJSON(inputs[i]) + "\", " + outcome + ", \"milliseconds\": " + to_string(milliseconds) + "}";
+
+      // Lines are held back until every earlier input has been printed
+      lock_guard<mutex> lock(outputMutex);
+      lines[i] = line;
+      finished[i] = true;
+      failures += failed;
+      while (nextToPrint < inputs.size() && finished[nextToPrint]) {
+        cout << lines[nextToPrint] << "\n";
+        lines[nextToPrint].clear();
+        nextToPrint++;
+      }
+      cout.flush();
+    }
+  };
+  vector<thread> pool;
+  for (int i = 1; i < threads; i++) {
+    pool.push_back(thread(worker));
+  }
+  worker();
+  for (thread& t : pool) {
+    t.join();
+  }
+
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  double perSecond = seconds > 0 ? inputs.size() / seconds : 0;
+  cerr << inputs.size() << " inputs (" << failures << " failed) in " << seconds << "s on " << threads << " threads: "
+       << perSecond << " per second, " << perSecond / threads << " per second per thread\n";
+  if (!tracePath.empty()) {
+    ofstream(tracePath) << exportChromeTrace();
+  }
+  return failures == 0 ? 0 : 2;
+}
@@ -0,0 +1,541 @@
+#include "mainCode.hpp"
+#include <random>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+using namespace mainCode;
+
+// Differential fuzzing of the optimised automaton code against plain set and map based reference implementations.
+// Every case is a small random NFA and some words over its alphabet, which includes a character class. The case checks:
+//   - acceptance of each word by runNFA (both modes), LazyDFA, runDFA on the converted and simplified DFAs, reduceNFA and complementOf
+//   - language equivalence and inclusion between the NFA and what it was converted, reduced or simplified to
+//   - the minimal state count from every conversion and simplification path
+//   - traceRun on the NFA and converted DFA against runNFA and runDFA on every prefix
+//   - word counts, shortlex enumeration and shortest words of the converted DFA against every short word
+// A failing case is shrunk to a small counterexample, printed, and then the program aborts.
+//
+// Seed mode:   ./fuzz.sh [--seeds N] [--start S] [corpus files...]
+// libFuzzer:   clang++ -std=c++11 -O1 -g -fsanitize=fuzzer,address -DLIBFUZZER $(pkg-config --cflags opencv4) mainCode.cpp fuzz.cpp $(pkg-config --libs opencv4)
+
+const vector<string> fuzzAlphabet = { "0", "1", "a", "[ab]" };
+const vector<string> fuzzLetters = { "0", "1", "a", "b" }; // What words read for each token, b being the byte only the class reads
+
+class FuzzCase {
+  public:
+    vector<State> States;
+    vector<Transition> Transitions;
+    vector<vector<string>> Words; // Each word as its letters
+
+    string convertToJSON() {
+      string json = "{\"nfa\": " + NFA(false, States, Transitions).convertToJSON(false) + ", \"words\": [";
+      for (int i = 0; i < Words.size(); i++) {
+        json += (i == 0 ? "\"" : ", \"");
+        for (const string& symbol : Words[i]) {
+          json += symbol;
+        }
+        json += "\"";
+      }
+      return json + "]}";
+    }
+};
+
+// Reads bytes from the fuzzer input, giving 0 once they run out so every input decodes to some case
+class ByteReader {
+  public:
+    ByteReader(const uint8_t* data, size_t size) : Data(data), Size(size), Position(0) {}
+
+    int next(int bound) {
+      int value = Position < Size ? Data[Position++] : 0;
+      return bound > 0 ? value % bound : 0;
+    }
+
+  private:
+    const uint8_t* Data;
+    size_t Size;
+    size_t Position;
+};
+
+FuzzCase decodeCase(const uint8_t* data, size_t size) {
+  ByteReader reader(data, size);
+  FuzzCase fuzzCase;
+  int numStates = 1 + reader.next(6);
+  int numSymbols = 1 + reader.next(fuzzAlphabet.size());
+  int start = reader.next(numStates);
+  int finalBits = reader.next(256);
+  for (int i = 0; i < numStates; i++) {
+    fuzzCase.States.push_back(State(i, "q" + to_string(i), i == start, finalBits >> i & 1));
+  }
+  int numTransitions = reader.next(3 * numStates + 1);
+  set<tuple<int, int, string>> seen; // Duplicate transitions make the NFA invalid
+  for (int i = 0; i < numTransitions; i++) {
+    int from = reader.next(numStates);
+    int to = reader.next(numStates);
+    int symbol = reader.next(numSymbols + 1);
+    string token = symbol == numSymbols ? "ε" : fuzzAlphabet[symbol];
+    if (seen.insert(make_tuple(from, to, token)).second) {
+      fuzzCase.Transitions.push_back(Transition(fuzzCase.Transitions.size(), from, to, token));
+    }
+  }
+  int numWords = 1 + reader.next(6);
+  for (int i = 0; i < numWords; i++) {
+    vector<string> word;
+    int length = reader.next(8);
+    for (int j = 0; j < length; j++) {
+      word.push_back(fuzzLetters[reader.next(numSymbols)]);
+    }
+    fuzzCase.Words.push_back(word);
+  }
+  return fuzzCase;
+}
+
+// ===== Reference implementations, kept as simple as possible =====
+
+// Replaces each class transition with one transition per byte, so the references only ever see letters
+NFA expandClasses(const NFA& nfa) {
+  vector<Transition> transitions;
+  set<tuple<int, int, string>> seen;
+  for (const Transition& transition : nfa.Transitions) {
+    vector<string> tokens = { transition.Token };
+    CharacterClass characterClass;
+    if (parseCharacterClass(transition.Token, characterClass)) {
+      tokens.clear();
+      for (int byte = 0; byte < 256; byte++) {
+        if (characterClass.contains(byte)) {
+          tokens.push_back(string(1, (char)byte));
+        }
+      }
+    }
+    for (const string& token : tokens) {
+      if (seen.insert(make_tuple(transition.Start, transition.End, token)).second) {
+        transitions.push_back(Transition(transitions.size(), transition.Start, transition.End, token));
+      }
+    }
+  }
+  return NFA(nfa.IsDfa, nfa.States, transitions);
+}
+
+set<int> referenceClosure(const MathmaticalNFA& nfa, set<int> states) {
+  vector<int> stack(states.begin(), states.end());
+  while (!stack.empty()) {
+    int state = stack.back();
+    stack.pop_back();
+    auto row = nfa.TransitionTable.find(state);
+    if (row == nfa.TransitionTable.end() || row->second.count("ε") == 0) {
+      continue;
+    }
+    for (int next : row->second.at("ε")) {
+      if (states.insert(next).second) {
+        stack.push_back(next);
+      }
+    }
+  }
+  return states;
+}
+
+set<int> referenceStep(const MathmaticalNFA& nfa, const set<int>& states, const string& symbol) {
+  set<int> next;
+  for (int state : states) {
+    auto row = nfa.TransitionTable.find(state);
+    if (row != nfa.TransitionTable.end() && row->second.count(symbol) > 0) {
+      const set<int>& targets = row->second.at(symbol);
+      next.insert(targets.begin(), targets.end());
+    }
+  }
+  return referenceClosure(nfa, next);
+}
+
+bool referenceAccepts(const MathmaticalNFA& nfa, const vector<string>& word) {
+  set<int> states = referenceClosure(nfa, { nfa.StartState });
+  for (const string& symbol : word) {
+    states = referenceStep(nfa, states, symbol);
+  }
+  for (int state : states) {
+    if (nfa.FinalStates.count(state) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Subset construction over the NFA's letters, without minimising. The start subset is state 0
+NFA referenceDeterminize(const MathmaticalNFA& nfa) {
+  vector<string> alphabet;
+  for (const string& symbol : nfa.Alphabet) {
+    if (symbol != "ε") {
+      alphabet.push_back(symbol);
+    }
+  }
+  map<set<int>, int> ids;
+  vector<set<int>> subsets = { referenceClosure(nfa, { nfa.StartState }) };
+  ids[subsets[0]] = 0;
+  vector<State> states;
+  vector<Transition> transitions;
+  for (int id = 0; id < subsets.size(); id++) {
+    bool isFinal = false;
+    for (int state : subsets[id]) {
+      isFinal = isFinal || nfa.FinalStates.count(state) > 0;
+    }
+    states.push_back(State(id, "s" + to_string(id), id == 0, isFinal));
+    for (const string& symbol : alphabet) {
+      set<int> next = referenceStep(nfa, subsets[id], symbol);
+      if (ids.count(next) == 0) {
+        ids[next] = subsets.size();
+        subsets.push_back(next);
+      }
+      transitions.push_back(Transition(transitions.size(), id, ids[next], symbol));
+    }
+  }
+  return NFA(true, states, transitions);
+}
+
+// Number of states of the minimal complete DFA, by Moore's algorithm on the reachable DFA
+int referenceMinimalStates(const NFA& dfa) {
+  MathmaticalDFA table(dfa);
+  map<int, int> blocks;
+  for (int state : table.States) {
+    blocks[state] = table.FinalStates.count(state);
+  }
+  int numBlocks = 0;
+  while (true) {
+    map<vector<int>, int> signatures;
+    map<int, int> newBlocks;
+    for (int state : table.States) {
+      vector<int> signature = { blocks[state] };
+      for (const string& symbol : table.Alphabet) {
+        signature.push_back(blocks[table.TransitionTable[state][symbol]]);
+      }
+      if (signatures.count(signature) == 0) {
+        int newBlock = signatures.size();
+        signatures[signature] = newBlock;
+      }
+      newBlocks[state] = signatures[signature];
+    }
+    blocks = newBlocks;
+    if (signatures.size() == numBlocks) {
+      return numBlocks;
+    }
+    numBlocks = signatures.size();
+  }
+}
+
+// ===== Checks =====
+
+string joinWord(const vector<string>& word) {
+  string joined;
+  for (const string& symbol : word) {
+    joined += symbol;
+  }
+  return joined;
+}
+
+bool acceptsByStates(const NFA& nfa, const set<int>& states) {
+  for (const State& state : nfa.States) {
+    if (state.IsFinal && states.count(state.Id) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Compares every step of the trace with a separate run of that prefix
+string checkTrace(const NFA& nfa, const string& word, bool isDfa) {
+  NFA traced = nfa;
+  traced.IsDfa = isDfa;
+  RunTrace trace = traceRun(traced, word);
+  if (trace.numSteps() == 0 || trace.Ends.back() != word.size()) {
+    return "traceRun did not read all of \"" + word + "\"";
+  }
+  for (int step = 0; step < trace.numSteps(); step++) {
+    string prefix = word.substr(0, trace.Ends[step]);
+    set<int> expected = isDfa ? runDFA(nfa, prefix) : runNFA(nfa, prefix);
+    if (trace.activeStates(step) != expected || (bool)trace.Accepted[step] != acceptsByStates(nfa, expected)) {
+      return string("traceRun with ") + (isDfa ? "the DFA" : "the NFA") + " disagrees on \"" + prefix + "\"";
+    }
+  }
+  return "";
+}
+
+// Checks DFALanguage on the converted DFA against all words up to a few letters, in shortlex order
+string checkLanguage(const MathmaticalNFA& reference, const NFA& dfa) {
+  const int maxLength = 4;
+  DFALanguage language(dfa);
+  vector<string> alphabet;
+  for (const string& letter : reference.Alphabet) {
+    if (letter != "ε") {
+      alphabet.push_back(letter);
+    }
+  }
+  if (language.Letters != alphabet) {
+    return "DFALanguage letters differ from the NFA's letters";
+  }
+  vector<vector<string>> layer = { {} };
+  vector<string> acceptedWords;
+  vector<BigCount> counts = language.countWords(maxLength);
+  vector<uint64_t> modularCounts = language.countWords(maxLength, 7);
+  string firstAccepted, firstRejected;
+  bool hasAccepted = false, hasRejected = false;
+  for (int length = 0; length <= maxLength; length++) {
+    uint64_t count = 0;
+    for (const vector<string>& word : layer) {
+      bool accepted = referenceAccepts(reference, word);
+      count += accepted;
+      if (accepted) {
+        acceptedWords.push_back(joinWord(word));
+      }
+      if (accepted && !hasAccepted) {
+        hasAccepted = true;
+        firstAccepted = joinWord(word);
+      } else if (!accepted && !hasRejected) {
+        hasRejected = true;
+        firstRejected = joinWord(word);
+      }
+    }
+    if (!(counts[length] == BigCount(count)) || modularCounts[length] != count % 7 || language.countWordsOfLength(length, 7) != count % 7) {
+      return "countWords is wrong for length " + to_string(length);
+    }
+    vector<vector<string>> nextLayer;
+    for (const vector<string>& word : layer) {
+      for (const string& symbol : alphabet) {
+        nextLayer.push_back(word);
+        nextLayer.back().push_back(symbol);
+      }
+    }
+    layer.swap(nextLayer);
+  }
+  string word;
+  if (hasAccepted && (!language.shortestAccepted(word) || word != firstAccepted)) {
+    return "shortestAccepted did not give \"" + firstAccepted + "\"";
+  }
+  if (hasRejected && (!language.shortestRejected(word) || word != firstRejected)) {
+    return "shortestRejected did not give \"" + firstRejected + "\"";
+  }
+  AcceptedWordIterator iterator = language.acceptedWords();
+  for (const string& expected : acceptedWords) {
+    if (!iterator.next(word) || word != expected) {
+      return "acceptedWords skipped \"" + expected + "\"";
+    }
+  }
+  if (iterator.next(word) && word.size() <= maxLength) {
+    return "acceptedWords gave the rejected word \"" + word + "\"";
+  }
+  return "";
+}
+
+// Returns a description of the first disagreement, or "" if everything agrees
+string checkCase(const FuzzCase& fuzzCase) {
+  NFA nfa(false, fuzzCase.States, fuzzCase.Transitions);
+  if (validateNFA(nfa) != 0) {
+    return "";
+  }
+  MathmaticalNFA reference(expandClasses(nfa));
+
+  NFA referenceDfa = referenceDeterminize(reference);
+  int minimalStates = referenceMinimalStates(referenceDfa);
+  NFA dfa = convertNFAtoDFA(nfa);
+  vector<pair<string, NFA>> dfas = {
+    make_pair("convertNFAtoDFA", dfa),
+    make_pair("convertNFAtoDFA on 3 threads", convertNFAtoDFA(nfa, 3)),
+    make_pair("boundedConvertNFAtoDFA", boundedConvertNFAtoDFA(nfa, ConversionBudget(), nullptr, 2).Dfa),
+    make_pair("simplifyDFA", simplifyDFA(referenceDfa)),
+    make_pair("simplifyDFA on 3 threads", simplifyDFA(referenceDfa, 3)),
+  };
+  for (auto& named : dfas) {
+    if (named.second.States.size() != minimalStates) {
+      return named.first + " gave " + to_string(named.second.States.size()) + " states, the minimal DFA has " + to_string(minimalStates);
+    }
+    if (!checkIfDFA(named.second)) {
+      return named.first + " did not give a complete DFA";
+    }
+    if (!areEquivalent(nfa, named.second).Equivalent) {
+      return "areEquivalent says " + named.first + " changed the language";
+    }
+  }
+  if (!isIncluded(nfa, dfa).Included || !isIncluded(dfa, nfa).Included) {
+    return "isIncluded disagrees with areEquivalent on the converted DFA";
+  }
+  NFA reduced = reduceNFA(nfa, true);
+  if (!areEquivalent(nfa, reduced).Equivalent) {
+    return "reduceNFA changed the language";
+  }
+  NFA complement = complementOf(nfa);
+  string languageFailure = checkLanguage(reference, dfa);
+  if (!languageFailure.empty()) {
+    return languageFailure;
+  }
+
+  LazyDFA lazy(nfa, 1024); // Small cache so flushing is exercised
+  for (const vector<string>& symbols : fuzzCase.Words) {
+    string word = joinWord(symbols);
+    bool expected = referenceAccepts(reference, symbols);
+    vector<pair<string, bool>> answers = {
+      make_pair("runNFA", acceptsByStates(nfa, runNFA(nfa, word))),
+      make_pair("LazyDFA", lazy.accepts(word)),
+      make_pair("lazy runNFA", acceptsByStates(nfa, runNFA(nfa, word, true))),
+      make_pair("reduceNFA", acceptsByStates(reduced, runNFA(reduced, word))),
+    };
+    bool inAlphabet = true; // The complement is only over the NFA's own alphabet
+    for (const string& symbol : symbols) {
+      inAlphabet = inAlphabet && reference.Alphabet.count(symbol) > 0;
+    }
+    if (inAlphabet) {
+      answers.push_back(make_pair("complementOf", !acceptsByStates(complement, runNFA(complement, word))));
+    }
+    for (auto& named : dfas) {
+      answers.push_back(make_pair("runDFA on " + named.first, acceptsByStates(named.second, runDFA(named.second, word))));
+    }
+    for (auto& answer : answers) {
+      if (answer.second != expected) {
+        return answer.first + (expected ? " rejected \"" : " accepted \"") + word + "\"";
+      }
+    }
+    string traceFailure = checkTrace(nfa, word, false);
+    if (traceFailure.empty()) {
+      traceFailure = checkTrace(dfa, word, true);
+    }
+    if (!traceFailure.empty()) {
+      return traceFailure;
+    }
+  }
+  return "";
+}
+
+// ===== Shrinking =====
+
+// Greedily removes words, symbols, transitions, states and final markings while the case still fails
+FuzzCase shrinkCase(FuzzCase fuzzCase) {
+  auto fails = [](const FuzzCase& candidate) {
+    try {
+      return checkCase(candidate) != "";
+    } catch (...) {
+      return true;
+    }
+  };
+  bool shrunk = true;
+  while (shrunk) {
+    shrunk = false;
+    auto tryCandidate = [&](const FuzzCase& candidate) {
+      if (fails(candidate)) {
+        fuzzCase = candidate;
+        shrunk = true;
+        return true;
+      }
+      return false;
+    };
+    for (int i = 0; i < fuzzCase.Words.size(); i++) {
+      FuzzCase candidate = fuzzCase;
+      candidate.Words.erase(candidate.Words.begin() + i);
+      if (!candidate.Words.empty() && tryCandidate(candidate)) {
+        i--;
+      }
+    }
+    for (int i = 0; i < fuzzCase.Words.size(); i++) {
+      for (int j = 0; j < fuzzCase.Words[i].size(); j++) {
+        FuzzCase candidate = fuzzCase;
+        candidate.Words[i].erase(candidate.Words[i].begin() + j);
+        if (tryCandidate(candidate)) {
+          j--;
+        }
+      }
+    }
+    for (int i = 0; i < fuzzCase.Transitions.size(); i++) {
+      FuzzCase candidate = fuzzCase;
+      candidate.Transitions.erase(candidate.Transitions.begin() + i);
+      if (tryCandidate(candidate)) {
+        i--;
+      }
+    }
+    for (int i = 0; i < fuzzCase.States.size(); i++) {
+      if (fuzzCase.States[i].IsStart) {
+        continue;
+      }
+      FuzzCase candidate = fuzzCase;
+      int id = candidate.States[i].Id;
+      candidate.States.erase(candidate.States.begin() + i);
+      candidate.Transitions.erase(remove_if(candidate.Transitions.begin(), candidate.Transitions.end(), [id](const Transition& transition) {
+        return transition.Start == id || transition.End == id;
+      }), candidate.Transitions.end());
+      if (tryCandidate(candidate)) {
+        i--;
+      }
+    }
+    for (int i = 0; i < fuzzCase.States.size(); i++) {
+      if (fuzzCase.States[i].IsFinal) {
+        FuzzCase candidate = fuzzCase;
+        candidate.States[i].IsFinal = false;
+        tryCandidate(candidate);
+      }
+    }
+  }
+  return fuzzCase;
+}
+
+void reportFailure(FuzzCase fuzzCase, string failure) {
+  FuzzCase smallest = shrinkCase(fuzzCase);
+  string smallestFailure;
+  try {
+    smallestFailure = checkCase(smallest);
+  } catch (const exception& e) {
+    smallestFailure = string("Exception: ") + e.what();
+  }
+  cerr << "Mismatch: " << failure << "\n"
+       << "Shrunk to: " << smallestFailure << "\n"
+       << smallest.convertToJSON() << "\n";
+  abort();
+}
+
+void runCase(const uint8_t* data, size_t size) {
+  FuzzCase fuzzCase = decodeCase(data, size);
+  string failure;
+  try {
+    failure = checkCase(fuzzCase);
+  } catch (const exception& e) {
+    failure = string("Exception: ") + e.what();
+  }
+  if (failure != "") {
+    reportFailure(fuzzCase, failure);
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  runCase(data, size);
+  return 0;
+}
+
+#ifndef LIBFUZZER
+int main(int argc, char* argv[]) {
+  long seeds = 10000;
+  long start = 0;
+  vector<string> files;
+  for (int i = 1; i < argc; i++) {
+    string argument = argv[i];
+    if (argument == "--seeds" && i + 1 < argc) {
+      seeds = atol(argv[++i]);
+    } else if (argument == "--start" && i + 1 < argc) {
+      start = atol(argv[++i]);
+    } else {
+      files.push_back(argument);
+    }
+  }
+
+  // Corpus files are replayed as they are, otherwise each seed deterministically gives the bytes of one case
+  for (const string& path : files) {
+    ifstream file(path, ios::binary);
+    vector<uint8_t> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    runCase(bytes.data(), bytes.size());
+  }
+  if (files.empty()) {
+    for (long seed = start; seed < start + seeds; seed++) {
+      mt19937 generator(seed);
+      vector<uint8_t> bytes(64);
+      for (uint8_t& byte : bytes) {
+        byte = generator();
+      }
+      runCase(bytes.data(), bytes.size());
+    }
+  }
+  cerr << (files.empty() ? to_string(seeds) + " seeds" : to_string(files.size()) + " files") << " passed\n";
+  return 0;
+}
+#endif
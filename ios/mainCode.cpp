@@ -143,107 +143,3146 @@ namespace mainCode {
       TransitionTable = transitionTable;
     }
 
+  // JSONValue
+  JSONValue::JSONValue():
+    Type(JSONType::Null), BooleanValue(false), NumberValue(0) {}
+
+  bool JSONValue::has(const string& key) const {
+    return Type == JSONType::Object && Members.count(key) > 0;
+  }
+
+  const JSONValue& JSONValue::operator[](const string& key) const {
+    if (!has(key)) {
+      throw invalid_argument("Missing JSON member \"" + key + "\"");
+    }
+    return Members.find(key)->second;
+  }
+
+  // NFAAnalysis
+  NFAAnalysis::NFAAnalysis():
+    ValidationCode(0), NumStartStates(0), HasEpsilonTransitions(false), IsDfa(false), IsComplete(false) {}
+
+  string NFAAnalysis::convertToJSON(bool testing) {
+    string separator = testing ? ",\n\t" : ",";
+    string json = string("{") + (testing ? "\n\t" : "");
+    json += "\"validationCode\":" + to_string(ValidationCode) + separator;
+    json += "\"duplicateNames\":" + stringsToJSON(DuplicateNames) + separator;
+    json += "\"duplicateTransitions\":" + intsToJSON(DuplicateTransitions) + separator;
+    json += "\"numStartStates\":" + to_string(NumStartStates) + separator;
+    json += "\"hasEpsilonTransitions\":" + boolToString(HasEpsilonTransitions) + separator;
+    json += "\"isDfa\":" + boolToString(IsDfa) + separator;
+    json += "\"isComplete\":" + boolToString(IsComplete) + separator;
+    json += "\"reachableStates\":" + intsToJSON(ReachableStates) + separator;
+    json += "\"coReachableStates\":" + intsToJSON(CoReachableStates) + separator;
+    json += "\"alphabet\":" + stringsToJSON(Alphabet);
+    return json + (testing ? "\n}" : "}");
+  }
+
+  // RunTrace
+  int RunTrace::numSteps() const {
+    return Ends.size();
+  }
+
+  set<int> RunTrace::activeStates(int step) const {
+    if (step < 0 || step >= numSteps()) {
+      throw out_of_range("Run trace step not found");
+    }
+    set<int> states;
+    for (int i = 0; i <= step; i++) {
+      for (int id : Left[i]) {
+        states.erase(id);
+      }
+      states.insert(Entered[i].begin(), Entered[i].end());
+    }
+    return states;
+  }
+
+  string RunTrace::convertToJSON(bool testing) {
+    string separator = testing ? ",\n\t" : ",";
+    auto listsToJSON = [](const vector<vector<int>>& lists) {
+      string json = "[";
+      for (size_t i = 0; i < lists.size(); i++) {
+        json += (i == 0 ? "" : ",") + intsToJSON(lists[i]);
+      }
+      return json + "]";
+    };
+    string accepted = "[";
+    for (size_t i = 0; i < Accepted.size(); i++) {
+      accepted += (i == 0 ? "" : ",") + boolToString(Accepted[i]);
+    }
+    string json = string("{") + (testing ? "\n\t" : "");
+    json += "\"ends\":" + intsToJSON(Ends) + separator;
+    json += "\"entered\":" + listsToJSON(Entered) + separator;
+    json += "\"left\":" + listsToJSON(Left) + separator;
+    json += "\"accepted\":" + accepted + "]";
+    return json + (testing ? "\n}" : "}");
+  }
+
+  // EditableNFA
+  EditableNFA::EditableNFA(NFA nfa):
+    DuplicateNames(0), DuplicateTransitions(0), StartStates(0), EpsilonTransitions(0), MultipleTargets(0), AlphabetSize(0), ClassTokens(0) {
+      for (State state : nfa.States) {
+        addState(state);
+      }
+      for (Transition transition : nfa.Transitions) {
+        addTransition(transition);
+      }
+    }
+
+  void EditableNFA::changeDistinctSymbols(int id, int change) {
+    bool exists = States.count(id) > 0;
+    if (exists) {
+      SymbolHistogram[DistinctSymbols[id]]--;
+    }
+    DistinctSymbols[id] += change;
+    if (exists) {
+      SymbolHistogram[DistinctSymbols[id]]++;
+    }
+  }
+
+  void EditableNFA::addState(State state) {
+    if (States.count(state.Id) > 0) {
+      throw invalid_argument("State already exists");
+    }
+    States.insert(make_pair(state.Id, state));
+    if (++NameCounts[state.Name] > 1) {
+      DuplicateNames++;
+    }
+    if (state.IsStart) {
+      StartStates++;
+    }
+    SymbolHistogram[DistinctSymbols[state.Id]]++;
+  }
+
+  void EditableNFA::updateState(State state) {
+    auto iterator = States.find(state.Id);
+    if (iterator == States.end()) {
+      throw out_of_range("State not found");
+    }
+    State& oldState = iterator->second;
+    if (oldState.Name != state.Name) {
+      if (--NameCounts[oldState.Name] > 0) {
+        DuplicateNames--;
+      }
+      if (++NameCounts[state.Name] > 1) {
+        DuplicateNames++;
+      }
+    }
+    StartStates += (int)state.IsStart - (int)oldState.IsStart;
+    oldState = state;
+  }
+
+  void EditableNFA::removeState(int id) {
+    auto iterator = States.find(id);
+    if (iterator == States.end()) {
+      throw out_of_range("State not found");
+    }
+    unordered_set<int> incident = Incident[id]; // Copied, as removing transitions changes it
+    for (int transitionId : incident) {
+      removeTransition(transitionId);
+    }
+    if (--NameCounts[iterator->second.Name] > 0) {
+      DuplicateNames--;
+    }
+    if (iterator->second.IsStart) {
+      StartStates--;
+    }
+    SymbolHistogram[DistinctSymbols[id]]--;
+    States.erase(iterator);
+    Incident.erase(id);
+  }
+
+  void EditableNFA::addTransition(Transition transition) {
+    if (Transitions.count(transition.Id) > 0) {
+      throw invalid_argument("Transition already exists");
+    }
+    Transitions.insert(make_pair(transition.Id, transition));
+    Incident[transition.Start].insert(transition.Id);
+    Incident[transition.End].insert(transition.Id);
+    OutDegrees[transition.Start]++;
+
+    string transitionKey = to_string(transition.Start) + "," + to_string(transition.End) + "," + transition.Token;
+    if (++TransitionCounts[transitionKey] > 1) {
+      DuplicateTransitions++;
+      return; // Duplicates do not change the language
+    }
+    CharacterClass characterClass;
+    if (++SymbolCounts[transition.Token] == 1 && transition.Token != "ε") {
+      AlphabetSize++;
+      ClassTokens += parseCharacterClass(transition.Token, characterClass);
+    }
+    if (transition.Token == "ε") {
+      EpsilonTransitions++;
+      return;
+    }
+    int targets = ++TargetCounts[to_string(transition.Start) + "," + transition.Token];
+    if (targets == 1) {
+      changeDistinctSymbols(transition.Start, 1);
+    } else if (targets == 2) {
+      MultipleTargets++;
+    }
+  }
+
+  void EditableNFA::updateTransition(Transition transition) {
+    removeTransition(transition.Id);
+    addTransition(transition);
+  }
+
+  void EditableNFA::removeTransition(int id) {
+    auto iterator = Transitions.find(id);
+    if (iterator == Transitions.end()) {
+      throw out_of_range("Transition not found");
+    }
+    Transition transition = iterator->second;
+    Transitions.erase(iterator);
+    Incident[transition.Start].erase(id);
+    Incident[transition.End].erase(id);
+    OutDegrees[transition.Start]--;
+
+    string transitionKey = to_string(transition.Start) + "," + to_string(transition.End) + "," + transition.Token;
+    if (--TransitionCounts[transitionKey] > 0) {
+      DuplicateTransitions--;
+      return;
+    }
+    CharacterClass characterClass;
+    if (--SymbolCounts[transition.Token] == 0 && transition.Token != "ε") {
+      AlphabetSize--;
+      ClassTokens -= parseCharacterClass(transition.Token, characterClass);
+    }
+    if (transition.Token == "ε") {
+      EpsilonTransitions--;
+      return;
+    }
+    int targets = --TargetCounts[to_string(transition.Start) + "," + transition.Token];
+    if (targets == 0) {
+      changeDistinctSymbols(transition.Start, -1);
+    } else if (targets == 1) {
+      MultipleTargets--;
+    }
+  }
+
+  int EditableNFA::validationCode() const {
+    if (DuplicateNames > 0) {
+      return 1; // Duplicate state name
+    }
+    if (StartStates != 1) {
+      return 2; // Wrong number of start states
+    }
+    if (DuplicateTransitions > 0) {
+      return 3; // Duplicate transition
+    }
+    return 0; // NFA is valid
+  }
+
+  bool EditableNFA::isComplete() const {
+    if (ClassTokens > 0) {
+      return analyzeNFA(structure()).IsComplete;
+    }
+    auto iterator = SymbolHistogram.find(AlphabetSize);
+    int completeStates = iterator == SymbolHistogram.end() ? 0 : iterator->second;
+    return completeStates == States.size();
+  }
+
+  bool EditableNFA::isDfa() const {
+    if (ClassTokens > 0) {
+      return analyzeNFA(structure()).IsDfa;
+    }
+    return isComplete() && MultipleTargets == 0 && EpsilonTransitions == 0;
+  }
+
+  int EditableNFA::numStartStates() const {
+    return StartStates;
+  }
+
+  int EditableNFA::outDegree(int id) const {
+    auto iterator = OutDegrees.find(id);
+    return iterator == OutDegrees.end() ? 0 : iterator->second;
+  }
+
+  NFA EditableNFA::toNFA() const {
+    NFA nfa = structure();
+    nfa.IsDfa = isDfa();
+    return nfa;
+  }
+
+  NFA EditableNFA::structure() const {
+    vector<State> states;
+    for (const pair<const int, State>& state : States) {
+      states.push_back(state.second);
+    }
+    vector<Transition> transitions;
+    for (const pair<const int, Transition>& transition : Transitions) {
+      transitions.push_back(transition.second);
+    }
+    return NFA(false, states, transitions);
+  }
+
+  string EditableNFA::summaryToJSON() const {
+    return "{\"validationCode\":" + to_string(validationCode()) + ",\"isDfa\":" + boolToString(isDfa()) + ",\"isComplete\":" + boolToString(isComplete()) + ",\"numStartStates\":" + to_string(StartStates) + "}";
+  }
+
+  // CharacterClass
+  CharacterClass::CharacterClass():
+    Bytes({ 0, 0, 0, 0 }) {}
+
+  bool CharacterClass::contains(unsigned char byte) const {
+    return (Bytes[byte >> 6] >> (byte & 63) & 1) != 0;
+  }
+
+  void CharacterClass::add(unsigned char byte) {
+    Bytes[byte >> 6] |= (uint64_t)1 << (byte & 63);
+  }
+
+  int CharacterClass::size() const {
+    int size = 0;
+    for (uint64_t word : Bytes) {
+      size += __builtin_popcountll(word);
+    }
+    return size;
+  }
+
+  string CharacterClass::toToken() const {
+    int numBytes = size();
+    if (numBytes == 1) {
+      for (int byte = 0; byte < 256; byte++) {
+        if (contains(byte)) {
+          return string(1, (char)byte);
+        }
+      }
+    }
+    auto writeByte = [](int byte) {
+      if (byte == ']' || byte == '\\' || byte == '-' || byte == '^') {
+        return string("\\") + (char)byte;
+      } else if (byte > ' ' && byte < 127) {
+        return string(1, (char)byte);
+      }
+      const char* digits = "0123456789abcdef";
+      return string("\\x") + digits[byte >> 4] + digits[byte & 15];
+    };
+    // Writes whichever of the class and its complement is smaller, as runs of three or more bytes become ranges
+    bool negated = numBytes > 128;
+    string token = negated ? "[^" : "[";
+    for (int byte = 0; byte < 256;) {
+      if (contains(byte) == negated) {
+        byte++;
+        continue;
+      }
+      int last = byte;
+      while (last + 1 < 256 && contains(last + 1) != negated) {
+        last++;
+      }
+      token += writeByte(byte);
+      if (last - byte >= 2) {
+        token += "-" + writeByte(last);
+      } else if (last > byte) {
+        token += writeByte(last);
+      }
+      byte = last + 1;
+    }
+    return token + "]";
+  }
+
+  // Tokenizer
+  Tokenizer::Tokenizer(vector<string> tokens):
+    Tokens(tokens), Examples(tokens), ByteSymbols(256, -1), RootChildren(256, -1), NodeSymbols(1, -1), NodeChildren(1) {
+      // Build a trie containing every token except classes, which only ever read one byte
+      vector<char> isClass(Tokens.size(), 0);
+      for (int symbol = 0; symbol < Tokens.size(); symbol++) {
+        CharacterClass characterClass;
+        if (parseCharacterClass(Tokens[symbol], characterClass)) {
+          isClass[symbol] = 1;
+          for (int byte = 0; byte < 256; byte++) {
+            if (characterClass.contains(byte) && ByteSymbols[byte] == -1) { // Single byte tokens take priority
+              ByteSymbols[byte] = symbol;
+            }
+          }
+          continue;
+        }
+        if (Tokens[symbol].size() == 1) {
+          ByteSymbols[(unsigned char)Tokens[symbol][0]] = symbol;
+        }
+        int node = 0;
+        for (unsigned char byte : Tokens[symbol]) {
+          int next = child(node, byte);
+          if (next == -1) {
+            next = NodeSymbols.size();
+            NodeSymbols.push_back(-1);
+            NodeChildren.push_back({});
+            NodeChildren[node].push_back(make_pair(byte, next));
+            if (node == 0) {
+              RootChildren[byte] = next;
+            }
+          }
+          node = next;
+        }
+        if (node != 0) { // Empty tokens can never be matched
+          NodeSymbols[node] = symbol;
+        }
+      }
+      for (int byte = 255; byte >= 0; byte--) {
+        if (ByteSymbols[byte] != -1 && isClass[ByteSymbols[byte]]) {
+          Examples[ByteSymbols[byte]] = string(1, (char)byte);
+        }
+      }
+    }
+
+  Tokenizer::Tokenizer():
+    Tokenizer(vector<string>()) {}
+
+  int Tokenizer::child(int node, unsigned char byte) const {
+    if (node == 0) {
+      return RootChildren[byte];
+    }
+    for (const pair<unsigned char, int>& edge : NodeChildren[node]) {
+      if (edge.first == byte) {
+        return edge.second;
+      }
+    }
+    return -1;
+  }
+
+  int Tokenizer::symbolId(const string& token) const {
+    CharacterClass characterClass;
+    if (parseCharacterClass(token, characterClass)) {
+      vector<int> ids;
+      symbolIds(token, ids);
+      return ids.size() == 1 && characterClass.size() > 0 ? ids[0] : -1;
+    }
+    if (token.size() == 1) {
+      return ByteSymbols[(unsigned char)token[0]];
+    }
+    int node = 0;
+    for (unsigned char byte : token) {
+      node = child(node, byte);
+      if (node == -1) {
+        return -1;
+      }
+    }
+    return NodeSymbols[node];
+  }
+
+  void Tokenizer::symbolIds(const string& token, vector<int>& ids) const {
+    ids.clear();
+    CharacterClass characterClass;
+    if (!parseCharacterClass(token, characterClass)) {
+      int symbol = symbolId(token);
+      if (symbol != -1) {
+        ids.push_back(symbol);
+      }
+      return;
+    }
+    for (int byte = 0; byte < 256; byte++) {
+      if (characterClass.contains(byte)) {
+        ids.push_back(ByteSymbols[byte]);
+      }
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    if (!ids.empty() && ids[0] == -1) {
+      ids.erase(ids.begin()); // Bytes no symbol reads
+    }
+  }
+
+  const string& Tokenizer::example(int symbol) const {
+    return Examples[symbol];
+  }
+
+  void Tokenizer::letters(int symbol, vector<string>& texts) const {
+    texts.clear();
+    CharacterClass characterClass;
+    if (!parseCharacterClass(Tokens[symbol], characterClass)) {
+      if (!Tokens[symbol].empty()) {
+        texts.push_back(Tokens[symbol]);
+      }
+      return;
+    }
+    for (int byte = 0; byte < 256; byte++) {
+      if (ByteSymbols[byte] == symbol) {
+        texts.push_back(string(1, (char)byte));
+      }
+    }
+  }
+
+  bool Tokenizer::tokenize(const string& word, vector<int>& symbols) const {
+    symbols.clear();
+    size_t position = 0;
+    while (position < word.size()) {
+      // Walk the trie as far as the word allows, remembering the longest token seen
+      int matchedSymbol = -1;
+      size_t matchedEnd = position;
+      int node = 0;
+      for (size_t i = position; i < word.size(); i++) {
+        node = child(node, word[i]);
+        if (node == -1) {
+          break;
+        }
+        if (NodeSymbols[node] != -1) {
+          matchedSymbol = NodeSymbols[node];
+          matchedEnd = i + 1;
+        }
+      }
+      if (matchedSymbol == -1) {
+        // Only a class can read this byte
+        matchedSymbol = ByteSymbols[(unsigned char)word[position]];
+        matchedEnd = position + 1;
+      }
+      if (matchedSymbol == -1) {
+        return false; // Word contains something that is not in the alphabet
+      }
+      symbols.push_back(matchedSymbol);
+      position = matchedEnd;
+    }
+    return true;
+  }
+
+  // DFAKernel
+  template <typename StateType, int NumSymbols>
+  DFAKernel<StateType, NumSymbols>::DFAKernel(const vector<int>& table, int numStates, int numSymbols):
+    Columns(NumSymbols > 0 ? NumSymbols : numSymbols), Dead(numStates) {
+      if (NumSymbols > 0 && numSymbols != NumSymbols) {
+        throw invalid_argument("Kernel alphabet size does not match");
+      }
+      if ((long long)numStates > (long long)numeric_limits<StateType>::max()) {
+        throw invalid_argument("Too many states for kernel state type");
+      }
+      // The dead state is the last row and only leads back to itself
+      Table.assign((size_t)(numStates + 1) * Columns, Dead);
+      for (size_t i = 0; i < table.size(); i++) {
+        if (table[i] != -1) {
+          Table[i] = table[i];
+        }
+      }
+    }
+
+  template <typename StateType, int NumSymbols>
+  int DFAKernel<StateType, NumSymbols>::run(const vector<int>& symbols, int start) const {
+    // Columns is a constant here whenever NumSymbols is given, so the row offset needs no multiplication
+    const int columns = NumSymbols > 0 ? NumSymbols : Columns;
+    const StateType* table = Table.data();
+    StateType state = start;
+    for (int symbol : symbols) {
+      state = table[(size_t)state * columns + symbol];
+    }
+    return state == Dead ? -1 : state;
+  }
+
+  template <typename StateType, int NumSymbols>
+  size_t DFAKernel<StateType, NumSymbols>::tableBytes() const {
+    return Table.size() * sizeof(StateType);
+  }
+
+  template <typename StateType, int NumSymbols>
+  string DFAKernel<StateType, NumSymbols>::name() const {
+    return to_string(sizeof(StateType) * 8) + "-bit states, " + (NumSymbols > 0 ? to_string(NumSymbols) : "any number of") + " symbols";
+  }
+
+  template <typename StateType>
+  shared_ptr<const DFAKernelBase> makeDFAKernel(const vector<int>& table, int numStates, int numSymbols) {
+    switch (numSymbols) {
+      case 1: return make_shared<DFAKernel<StateType, 1>>(table, numStates, numSymbols);
+      case 2: return make_shared<DFAKernel<StateType, 2>>(table, numStates, numSymbols);
+      case 3: return make_shared<DFAKernel<StateType, 3>>(table, numStates, numSymbols);
+      case 4: return make_shared<DFAKernel<StateType, 4>>(table, numStates, numSymbols);
+      default: return make_shared<DFAKernel<StateType, 0>>(table, numStates, numSymbols);
+    }
+  }
+
+  // Picks the narrowest state type that also has room for the dead state
+  shared_ptr<const DFAKernelBase> makeDFAKernel(const vector<int>& table, int numStates, int numSymbols) {
+    if (numStates < 256) {
+      return makeDFAKernel<uint8_t>(table, numStates, numSymbols);
+    } else if (numStates < 65536) {
+      return makeDFAKernel<uint16_t>(table, numStates, numSymbols);
+    }
+    return makeDFAKernel<int32_t>(table, numStates, numSymbols);
+  }
+
+  // CompiledDFA
+  CompiledDFA::CompiledDFA(NFA dfa):
+    Symbols(getSymbols(dfa.Transitions)), Start(0) {
+      unordered_map<int, int> indices = getStateIndices(dfa.States);
+      for (State state : dfa.States) {
+        StateIds.push_back(state.Id);
+        IsFinal.push_back(state.IsFinal);
+      }
+      Start = indices[getStartState(dfa.States)];
+
+      Table.assign(StateIds.size() * numSymbols(), -1);
+      vector<int> symbols;
+      for (Transition transition : dfa.Transitions) {
+        if (indices.count(transition.Start) == 0 || indices.count(transition.End) == 0) {
+          throw out_of_range("Transition state not found");
+        }
+        Symbols.symbolIds(transition.Token, symbols); // None for epsilon or empty tokens, which can never be read
+        for (int symbol : symbols) {
+          Table[indices[transition.Start] * numSymbols() + symbol] = indices[transition.End];
+        }
+      }
+      Kernel = makeDFAKernel(Table, StateIds.size(), numSymbols());
+    }
+
+  int CompiledDFA::numSymbols() const {
+    return Symbols.Tokens.size();
+  }
+
+  set<int> CompiledDFA::run(const string& word) const {
+    vector<int> symbols;
+    if (!Symbols.tokenize(word, symbols)) {
+      return set<int> {};
+    }
+    int currentState = Kernel->run(symbols, Start);
+    if (currentState == -1) {
+      return set<int> {};
+    }
+    return set<int> { StateIds[currentState] };
+  }
+
+  void CompiledDFA::reorder(StateOrder order, const vector<string>& sampleWords) {
+    TRACE_SPAN("reorderDFA");
+    int numStates = StateIds.size();
+    int columns = numSymbols();
+    vector<int> oldIndices; // Old index of each new index
+    oldIndices.reserve(numStates);
+    vector<char> isPlaced(numStates, 0);
+    auto place = [&](int state) {
+      if (!isPlaced[state]) {
+        isPlaced[state] = 1;
+        oldIndices.push_back(state);
+      }
+    };
+
+    if (order == StateOrder::Profile) {
+      vector<long long> visits(numStates, 0);
+      vector<int> symbols;
+      for (const string& word : sampleWords) {
+        if (!Symbols.tokenize(word, symbols)) {
+          continue;
+        }
+        int state = Start;
+        visits[state]++;
+        for (int symbol : symbols) {
+          state = Table[state * columns + symbol];
+          if (state == -1) {
+            break;
+          }
+          visits[state]++;
+        }
+      }
+      vector<int> visited;
+      for (int state = 0; state < numStates; state++) {
+        if (visits[state] > 0) {
+          visited.push_back(state);
+        }
+      }
+      stable_sort(visited.begin(), visited.end(), [&](int a, int b) {
+        return visits[a] > visits[b];
+      });
+      for (int state : visited) {
+        place(state);
+      }
+    }
+
+    // Traversal from the start state, passing through states that are already placed
+    vector<char> isSeen(numStates, 0);
+    if (order == StateOrder::DepthFirst) {
+      vector<int> remaining = { Start };
+      while (!remaining.empty()) {
+        int state = remaining.back();
+        remaining.pop_back();
+        if (isSeen[state]) {
+          continue;
+        }
+        isSeen[state] = 1;
+        place(state);
+        for (int symbol = columns - 1; symbol >= 0; symbol--) { // Reversed so the first symbol is followed first
+          int next = Table[state * columns + symbol];
+          if (next != -1 && !isSeen[next]) {
+            remaining.push_back(next);
+          }
+        }
+      }
+    } else {
+      vector<int> queue = { Start };
+      isSeen[Start] = 1;
+      for (size_t i = 0; i < queue.size(); i++) {
+        int state = queue[i];
+        place(state);
+        for (int symbol = 0; symbol < columns; symbol++) {
+          int next = Table[state * columns + symbol];
+          if (next != -1 && !isSeen[next]) {
+            isSeen[next] = 1;
+            queue.push_back(next);
+          }
+        }
+      }
+    }
+    // Unreachable states keep their relative order at the end
+    for (int state = 0; state < numStates; state++) {
+      place(state);
+    }
+
+    vector<int> newIndices(numStates);
+    for (int i = 0; i < numStates; i++) {
+      newIndices[oldIndices[i]] = i;
+    }
+    vector<int> stateIds(numStates);
+    vector<char> isFinal(numStates);
+    vector<int> table(Table.size());
+    for (int i = 0; i < numStates; i++) {
+      int old = oldIndices[i];
+      stateIds[i] = StateIds[old];
+      isFinal[i] = IsFinal[old];
+      for (int symbol = 0; symbol < columns; symbol++) {
+        int next = Table[old * columns + symbol];
+        table[i * columns + symbol] = next == -1 ? -1 : newIndices[next];
+      }
+    }
+    StateIds.swap(stateIds);
+    IsFinal.swap(isFinal);
+    Table.swap(table);
+    Start = newIndices[Start];
+    Kernel = makeDFAKernel(Table, numStates, columns);
+  }
+
+  // BigCount
+  BigCount::BigCount(uint64_t value) {
+    while (value > 0) {
+      Limbs.push_back((uint32_t)value);
+      value >>= 32;
+    }
+  }
+
+  BigCount& BigCount::operator+=(const BigCount& other) {
+    if (Limbs.size() < other.Limbs.size()) {
+      Limbs.resize(other.Limbs.size(), 0);
+    }
+    uint64_t carry = 0;
+    for (size_t i = 0; i < Limbs.size() && (carry > 0 || i < other.Limbs.size()); i++) {
+      uint64_t sum = (uint64_t)Limbs[i] + (i < other.Limbs.size() ? other.Limbs[i] : 0) + carry;
+      Limbs[i] = (uint32_t)sum;
+      carry = sum >> 32;
+    }
+    if (carry > 0) {
+      Limbs.push_back((uint32_t)carry);
+    }
+    return *this;
+  }
+
+  BigCount& BigCount::operator-=(const BigCount& other) {
+    if (*this < other) {
+      throw out_of_range("BigCount would be negative");
+    }
+    int64_t borrow = 0;
+    for (size_t i = 0; i < Limbs.size() && (borrow > 0 || i < other.Limbs.size()); i++) {
+      int64_t difference = (int64_t)Limbs[i] - (i < other.Limbs.size() ? other.Limbs[i] : 0) - borrow;
+      borrow = difference < 0 ? 1 : 0;
+      Limbs[i] = (uint32_t)(difference + (borrow << 32));
+    }
+    while (!Limbs.empty() && Limbs.back() == 0) {
+      Limbs.pop_back();
+    }
+    return *this;
+  }
+
+  BigCount BigCount::operator*(uint32_t factor) const {
+    BigCount product;
+    uint64_t carry = 0;
+    for (uint32_t limb : Limbs) {
+      uint64_t current = (uint64_t)limb * factor + carry;
+      product.Limbs.push_back((uint32_t)current);
+      carry = current >> 32;
+    }
+    if (carry > 0) {
+      product.Limbs.push_back((uint32_t)carry);
+    }
+    while (!product.Limbs.empty() && product.Limbs.back() == 0) {
+      product.Limbs.pop_back();
+    }
+    return product;
+  }
+
+  bool BigCount::operator<(const BigCount& other) const {
+    if (Limbs.size() != other.Limbs.size()) {
+      return Limbs.size() < other.Limbs.size();
+    }
+    for (size_t i = Limbs.size(); i-- > 0;) {
+      if (Limbs[i] != other.Limbs[i]) {
+        return Limbs[i] < other.Limbs[i];
+      }
+    }
+    return false;
+  }
+
+  bool BigCount::operator==(const BigCount& other) const {
+    return Limbs == other.Limbs;
+  }
+
+  bool BigCount::isZero() const {
+    return Limbs.empty();
+  }
+
+  string BigCount::toString() const {
+    // Divides by 10^9 repeatedly, collecting nine digits at a time
+    vector<uint32_t> remaining = Limbs;
+    vector<uint32_t> chunks;
+    while (!remaining.empty()) {
+      uint64_t remainder = 0;
+      for (size_t i = remaining.size(); i-- > 0;) {
+        uint64_t current = (remainder << 32) | remaining[i];
+        remaining[i] = (uint32_t)(current / 1000000000);
+        remainder = current % 1000000000;
+      }
+      chunks.push_back((uint32_t)remainder);
+      while (!remaining.empty() && remaining.back() == 0) {
+        remaining.pop_back();
+      }
+    }
+    if (chunks.empty()) {
+      return "0";
+    }
+    string text = to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+      string chunk = to_string(chunks[i]);
+      text += string(9 - chunk.size(), '0') + chunk;
+    }
+    return text;
+  }
+
+  // Uniformly random count from 0 up to but not including limit, which must not be zero
+  BigCount randomBelow(const BigCount& limit, mt19937_64& generator) {
+    uint32_t topMask = limit.Limbs.back();
+    for (int shift = 1; shift < 32; shift <<= 1) {
+      topMask |= topMask >> shift;
+    }
+    while (true) { // Each try succeeds with probability over a half
+      BigCount candidate;
+      candidate.Limbs.resize(limit.Limbs.size());
+      for (uint32_t& limb : candidate.Limbs) {
+        limb = (uint32_t)generator();
+      }
+      candidate.Limbs.back() &= topMask;
+      while (!candidate.Limbs.empty() && candidate.Limbs.back() == 0) {
+        candidate.Limbs.pop_back();
+      }
+      if (candidate < limit) {
+        return candidate;
+      }
+    }
+  }
+
+  uint64_t addModulo(uint64_t a, uint64_t b, uint64_t modulus) {
+    return a >= modulus - b ? a - (modulus - b) : a + b;
+  }
+
+  uint64_t multiplyModulo(uint64_t a, uint64_t b, uint64_t modulus) {
+    return (uint64_t)((unsigned __int128)a * b % modulus);
+  }
+
+  // DFALanguage
+  DFALanguage::DFALanguage(NFA dfa):
+    Dfa(dfa), SymbolWeights(Dfa.numSymbols(), 0) {
+      vector<pair<string, int>> letters;
+      vector<string> texts;
+      for (int symbol = 0; symbol < Dfa.numSymbols(); symbol++) {
+        Dfa.Symbols.letters(symbol, texts);
+        SymbolWeights[symbol] = texts.size();
+        for (const string& text : texts) {
+          letters.push_back(make_pair(text, symbol));
+        }
+      }
+      sort(letters.begin(), letters.end());
+      for (const pair<string, int>& letter : letters) {
+        Letters.push_back(letter.first);
+        LetterSymbols.push_back(letter.second);
+      }
+    }
+
+  vector<BigCount> DFALanguage::countWords(int maxLength) const {
+    TRACE_SPAN("countWords");
+    // Number of words of the current length that lead from the start to each state
+    int numStates = Dfa.StateIds.size();
+    int numSymbols = Dfa.numSymbols();
+    vector<BigCount> ways(numStates);
+    vector<BigCount> nextWays(numStates);
+    ways[Dfa.Start] = BigCount(1);
+    vector<BigCount> counts;
+    for (int length = 0; length <= maxLength; length++) {
+      BigCount accepted;
+      for (int state = 0; state < numStates; state++) {
+        if (Dfa.IsFinal[state]) {
+          accepted += ways[state];
+        }
+      }
+      counts.push_back(accepted);
+      if (length == maxLength) {
+        break;
+      }
+      fill(nextWays.begin(), nextWays.end(), BigCount());
+      for (int state = 0; state < numStates; state++) {
+        if (ways[state].isZero()) {
+          continue;
+        }
+        for (int symbol = 0; symbol < numSymbols; symbol++) {
+          int next = Dfa.Table[state * numSymbols + symbol];
+          if (next != -1) {
+            nextWays[next] += ways[state] * SymbolWeights[symbol];
+          }
+        }
+      }
+      ways.swap(nextWays);
+    }
+    return counts;
+  }
+
+  vector<uint64_t> DFALanguage::countWords(int maxLength, uint64_t modulus) const {
+    TRACE_SPAN("countWords");
+    if (modulus == 0) {
+      throw invalid_argument("Modulus must be positive");
+    }
+    int numStates = Dfa.StateIds.size();
+    int numSymbols = Dfa.numSymbols();
+    vector<uint64_t> ways(numStates, 0);
+    vector<uint64_t> nextWays(numStates);
+    ways[Dfa.Start] = 1 % modulus;
+    vector<uint64_t> counts;
+    for (int length = 0; length <= maxLength; length++) {
+      uint64_t accepted = 0;
+      for (int state = 0; state < numStates; state++) {
+        if (Dfa.IsFinal[state]) {
+          accepted = addModulo(accepted, ways[state], modulus);
+        }
+      }
+      counts.push_back(accepted);
+      fill(nextWays.begin(), nextWays.end(), 0);
+      for (int state = 0; state < numStates; state++) {
+        for (int symbol = 0; symbol < numSymbols && ways[state] != 0; symbol++) {
+          int next = Dfa.Table[state * numSymbols + symbol];
+          if (next != -1) {
+            nextWays[next] = addModulo(nextWays[next], multiplyModulo(ways[state], SymbolWeights[symbol], modulus), modulus);
+          }
+        }
+      }
+      ways.swap(nextWays);
+    }
+    return counts;
+  }
+
+  uint64_t DFALanguage::countWordsOfLength(uint64_t length, uint64_t modulus) const {
+    TRACE_SPAN("countWordsOfLength");
+    if (modulus == 0) {
+      throw invalid_argument("Modulus must be positive");
+    }
+    // Row vector of ways to reach each state, multiplied by the matrix of letters between each pair of states
+    // raised to the length. Costs the cube of the state count per bit of the length
+    size_t numStates = Dfa.StateIds.size();
+    int numSymbols = Dfa.numSymbols();
+    vector<uint64_t> matrix(numStates * numStates, 0);
+    for (size_t state = 0; state < numStates; state++) {
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        int next = Dfa.Table[state * numSymbols + symbol];
+        if (next != -1) {
+          matrix[state * numStates + next] = addModulo(matrix[state * numStates + next], SymbolWeights[symbol] % modulus, modulus);
+        }
+      }
+    }
+    vector<uint64_t> ways(numStates, 0);
+    ways[Dfa.Start] = 1 % modulus;
+    vector<uint64_t> product;
+    while (length > 0) {
+      if (length & 1) {
+        product.assign(numStates, 0);
+        for (size_t i = 0; i < numStates; i++) {
+          for (size_t j = 0; j < numStates && ways[i] != 0; j++) {
+            product[j] = addModulo(product[j], multiplyModulo(ways[i], matrix[i * numStates + j], modulus), modulus);
+          }
+        }
+        ways.swap(product);
+      }
+      length >>= 1;
+      if (length > 0) {
+        product.assign(numStates * numStates, 0);
+        for (size_t i = 0; i < numStates; i++) {
+          for (size_t k = 0; k < numStates; k++) {
+            uint64_t left = matrix[i * numStates + k];
+            for (size_t j = 0; j < numStates && left != 0; j++) {
+              product[i * numStates + j] = addModulo(product[i * numStates + j], multiplyModulo(left, matrix[k * numStates + j], modulus), modulus);
+            }
+          }
+        }
+        matrix.swap(product);
+      }
+    }
+    uint64_t accepted = 0;
+    for (size_t state = 0; state < numStates; state++) {
+      if (Dfa.IsFinal[state]) {
+        accepted = addModulo(accepted, ways[state], modulus);
+      }
+    }
+    return accepted;
+  }
+
+  bool DFALanguage::isFinite() const {
+    // Infinite exactly when a cycle passes through states that are both reachable and able to reach a final state
+    int numStates = Dfa.StateIds.size();
+    int numSymbols = Dfa.numSymbols();
+    vector<char> isReachable(numStates, 0);
+    vector<int> remaining = { Dfa.Start };
+    isReachable[Dfa.Start] = 1;
+    vector<vector<int>> predecessors(numStates);
+    while (!remaining.empty()) {
+      int state = remaining.back();
+      remaining.pop_back();
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        int next = Dfa.Table[state * numSymbols + symbol];
+        if (next == -1) {
+          continue;
+        }
+        predecessors[next].push_back(state);
+        if (!isReachable[next]) {
+          isReachable[next] = 1;
+          remaining.push_back(next);
+        }
+      }
+    }
+    vector<char> isUseful(numStates, 0);
+    for (int state = 0; state < numStates; state++) {
+      if (isReachable[state] && Dfa.IsFinal[state]) {
+        isUseful[state] = 1;
+        remaining.push_back(state);
+      }
+    }
+    while (!remaining.empty()) {
+      int state = remaining.back();
+      remaining.pop_back();
+      for (int previous : predecessors[state]) {
+        if (!isUseful[previous]) {
+          isUseful[previous] = 1;
+          remaining.push_back(previous);
+        }
+      }
+    }
+
+    // Removes useful states without useful predecessors until none are left, which fails only on a cycle
+    vector<int> inDegrees(numStates, 0);
+    int numUseful = 0;
+    for (int state = 0; state < numStates; state++) {
+      if (!isUseful[state]) {
+        continue;
+      }
+      numUseful++;
+      for (int previous : predecessors[state]) {
+        inDegrees[state] += isUseful[previous];
+      }
+      if (inDegrees[state] == 0) {
+        remaining.push_back(state);
+      }
+    }
+    int removed = 0;
+    while (!remaining.empty()) {
+      int state = remaining.back();
+      remaining.pop_back();
+      removed++;
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        int next = Dfa.Table[state * numSymbols + symbol];
+        if (next != -1 && isUseful[next] && --inDegrees[next] == 0) {
+          remaining.push_back(next);
+        }
+      }
+    }
+    return removed == numUseful;
+  }
+
+  AcceptedWordIterator DFALanguage::acceptedWords() const {
+    return AcceptedWordIterator(*this);
+  }
+
+  vector<string> DFALanguage::sampleAccepted(int length, int count, uint64_t seed) const {
+    TRACE_SPAN("sampleAccepted");
+    if (length < 0) {
+      throw invalid_argument("Length must not be negative");
+    }
+    // Exact number of accepted completions of each length from each state, so every word is equally likely
+    int numStates = Dfa.StateIds.size();
+    int numSymbols = Dfa.numSymbols();
+    vector<vector<BigCount>> completions(length + 1, vector<BigCount>(numStates));
+    for (int state = 0; state < numStates; state++) {
+      completions[0][state] = BigCount(Dfa.IsFinal[state] ? 1 : 0);
+    }
+    for (int remaining = 1; remaining <= length; remaining++) {
+      for (int state = 0; state < numStates; state++) {
+        for (int symbol = 0; symbol < numSymbols; symbol++) {
+          int next = Dfa.Table[state * numSymbols + symbol];
+          if (next != -1) {
+            completions[remaining][state] += completions[remaining - 1][next] * SymbolWeights[symbol];
+          }
+        }
+      }
+    }
+    vector<string> words;
+    if (completions[length][Dfa.Start].isZero()) {
+      return words;
+    }
+    mt19937_64 generator(seed);
+    vector<int> letters;
+    for (int i = 0; i < count; i++) {
+      // Picks the word at a random position in the alphabetical list of accepted words of the length
+      BigCount position = randomBelow(completions[length][Dfa.Start], generator);
+      letters.clear();
+      int state = Dfa.Start;
+      for (int remaining = length; remaining > 0; remaining--) {
+        for (int letter = 0; letter < (int)Letters.size(); letter++) {
+          int next = Dfa.Table[state * numSymbols + LetterSymbols[letter]];
+          if (next == -1) {
+            continue;
+          }
+          const BigCount& options = completions[remaining - 1][next];
+          if (position < options) {
+            letters.push_back(letter);
+            state = next;
+            break;
+          }
+          position -= options;
+        }
+      }
+      words.push_back(joinLetters(letters));
+    }
+    return words;
+  }
+
+  bool DFALanguage::shortestAccepted(string& word) const {
+    return shortestWord(true, word);
+  }
+
+  bool DFALanguage::shortestRejected(string& word) const {
+    return shortestWord(false, word);
+  }
+
+  string DFALanguage::joinLetters(const vector<int>& letters) const {
+    string word;
+    for (int letter : letters) {
+      word += Letters[letter];
+    }
+    return word;
+  }
+
+  bool DFALanguage::shortestWord(bool accepted, string& word) const {
+    // Breadth first search taking letters in order, so each state is first found by its shortlex smallest word.
+    // Undefined transitions lead to an extra dead state, which rejects
+    int numStates = Dfa.StateIds.size();
+    int numSymbols = Dfa.numSymbols();
+    int dead = numStates;
+    vector<int> parents(numStates + 1, -2);
+    vector<int> parentLetters(numStates + 1, -1);
+    vector<int> queue = { Dfa.Start };
+    parents[Dfa.Start] = -1;
+    for (size_t i = 0; i < queue.size(); i++) {
+      int state = queue[i];
+      bool isAccepting = state != dead && Dfa.IsFinal[state];
+      if (isAccepting == accepted) {
+        vector<int> letters;
+        for (int current = state; parents[current] != -1; current = parents[current]) {
+          letters.push_back(parentLetters[current]);
+        }
+        reverse(letters.begin(), letters.end());
+        word = joinLetters(letters);
+        return true;
+      }
+      if (state == dead) {
+        continue;
+      }
+      for (int letter = 0; letter < (int)Letters.size(); letter++) {
+        int next = Dfa.Table[state * numSymbols + LetterSymbols[letter]];
+        next = next == -1 ? dead : next;
+        if (parents[next] == -2) {
+          parents[next] = state;
+          parentLetters[next] = letter;
+          queue.push_back(next);
+        }
+      }
+    }
+    return false;
+  }
+
+  // AcceptedWordIterator
+  AcceptedWordIterator::AcceptedWordIterator(const DFALanguage& language):
+    Language(language), Length(0), InLength(false) {
+      // A finite language has no accepted word longer than the number of states
+      MaxLength = language.isFinite() ? language.Dfa.StateIds.size() : -1;
+    }
+
+  bool AcceptedWordIterator::extend(int firstLetter) {
+    const CompiledDFA& dfa = Language.Dfa;
+    int remaining = Length - Letters.size() - 1;
+    for (int letter = firstLetter; letter < (int)Language.Letters.size(); letter++) {
+      int next = dfa.Table[Path.back() * dfa.numSymbols() + Language.LetterSymbols[letter]];
+      if (next != -1 && CanAccept[remaining][next]) {
+        Path.push_back(next);
+        Letters.push_back(letter);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool AcceptedWordIterator::completeWord() {
+    while ((int)Letters.size() < Length) {
+      if (!extend(0)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool AcceptedWordIterator::next(string& word) {
+    const CompiledDFA& dfa = Language.Dfa;
+    while (true) {
+      if (!InLength) {
+        if (MaxLength != -1 && Length > MaxLength) {
+          return false;
+        }
+        // Words of the next length, found depth first and skipping states that cannot finish one
+        while ((int)CanAccept.size() <= Length) {
+          int numStates = dfa.StateIds.size();
+          vector<char> canAccept(numStates, 0);
+          for (int state = 0; state < numStates; state++) {
+            if (CanAccept.empty()) {
+              canAccept[state] = dfa.IsFinal[state];
+              continue;
+            }
+            for (int symbol = 0; symbol < dfa.numSymbols() && !canAccept[state]; symbol++) {
+              int next = dfa.Table[state * dfa.numSymbols() + symbol];
+              canAccept[state] = next != -1 && Language.SymbolWeights[symbol] > 0 && CanAccept.back()[next];
+            }
+          }
+          CanAccept.push_back(canAccept);
+        }
+        if (!CanAccept[Length][dfa.Start]) {
+          Length++;
+          continue;
+        }
+        Path = { dfa.Start };
+        Letters.clear();
+        InLength = completeWord();
+      } else {
+        // Backtracks to the last letter that can be replaced by a larger one
+        bool found = false;
+        while (!Letters.empty() && !found) {
+          int letter = Letters.back();
+          Letters.pop_back();
+          Path.pop_back();
+          found = extend(letter + 1) && completeWord();
+        }
+        InLength = found;
+      }
+      if (InLength) {
+        word = Language.joinLetters(Letters);
+        if (Length == 0) {
+          InLength = false;
+          Length++;
+        }
+        return true;
+      }
+      Length++;
+    }
+  }
+
+  // CompiledNFA
+  CompiledNFA::CompiledNFA(NFA nfa):
+    CompiledNFA(nfa, getSymbols(nfa.Transitions)) {}
+
+  CompiledNFA::CompiledNFA(NFA nfa, vector<string> symbols):
+    Symbols(symbols) {
+      unordered_map<int, int> indices = getStateIndices(nfa.States);
+      for (State state : nfa.States) {
+        StateIds.push_back(state.Id);
+        IsFinal.push_back(state.IsFinal);
+      }
+      int numStates = StateIds.size();
+
+      // Single transitions, grouped by state and symbol
+      vector<vector<int>> epsilonEdges(numStates);
+      vector<vector<int>> edges(numStates * numSymbols());
+      vector<int> transitionSymbols;
+      for (Transition transition : nfa.Transitions) {
+        if (indices.count(transition.Start) == 0 || indices.count(transition.End) == 0) {
+          throw out_of_range("Transition state not found");
+        }
+        int start = indices[transition.Start];
+        int end = indices[transition.End];
+        if (transition.Token == "ε") {
+          epsilonEdges[start].push_back(end);
+          continue;
+        }
+        Symbols.symbolIds(transition.Token, transitionSymbols); // None for empty tokens, which can never be read
+        for (int symbol : transitionSymbols) {
+          edges[start * numSymbols() + symbol].push_back(end);
+        }
+      }
+
+      // Epsilon closure of every state, found with a depth first search
+      vector<vector<int>> closures(numStates);
+      vector<int> seen(numStates, -1);
+      for (int state = 0; state < numStates; state++) {
+        vector<int> remaining = { state };
+        seen[state] = state;
+        while (!remaining.empty()) {
+          int current = remaining.back();
+          remaining.pop_back();
+          closures[state].push_back(current);
+          for (int next : epsilonEdges[current]) {
+            if (seen[next] != state) {
+              seen[next] = state;
+              remaining.push_back(next);
+            }
+          }
+        }
+        sort(closures[state].begin(), closures[state].end());
+      }
+      Start = indices[getStartState(nfa.States)];
+      StartStates = closures[Start];
+      for (int state = 0; state < numStates; state++) {
+        bool closureIsFinal = false;
+        for (int closureState : closures[state]) {
+          closureIsFinal = closureIsFinal || IsFinal[closureState];
+        }
+        ClosureIsFinal.push_back(closureIsFinal);
+      }
+
+      // Successors of each state, including the epsilon closures before and after the symbol
+      seen.assign(numStates, -1);
+      int mark = 0;
+      Offsets.push_back(0);
+      for (int state = 0; state < numStates; state++) {
+        for (int symbol = 0; symbol < numSymbols(); symbol++) {
+          size_t begin = Targets.size();
+          for (int closureState : closures[state]) {
+            for (int end : edges[closureState * numSymbols() + symbol]) {
+              for (int endClosureState : closures[end]) {
+                if (seen[endClosureState] != mark) {
+                  seen[endClosureState] = mark;
+                  Targets.push_back(endClosureState);
+                }
+              }
+            }
+          }
+          sort(Targets.begin() + begin, Targets.end());
+          Offsets.push_back(Targets.size());
+          mark++;
+        }
+      }
+    }
+
+  int CompiledNFA::numSymbols() const {
+    return Symbols.Tokens.size();
+  }
+
+  set<int> CompiledNFA::run(const string& word) const {
+    vector<int> symbols;
+    if (!Symbols.tokenize(word, symbols)) {
+      return set<int> {};
+    }
+    vector<int> currentStates = StartStates;
+    vector<int> newStates;
+    vector<char> added(StateIds.size(), 0);
+    for (int symbol : symbols) {
+      newStates.clear();
+      for (int currentState : currentStates) {
+        int cell = currentState * numSymbols() + symbol;
+        for (int i = Offsets[cell]; i < Offsets[cell + 1]; i++) {
+          if (!added[Targets[i]]) {
+            added[Targets[i]] = 1;
+            newStates.push_back(Targets[i]);
+          }
+        }
+      }
+      for (int newState : newStates) {
+        added[newState] = 0;
+      }
+      currentStates.swap(newStates);
+    }
+    set<int> resultingStates;
+    for (int currentState : currentStates) {
+      resultingStates.insert(StateIds[currentState]);
+    }
+    return resultingStates;
+  }
+
+  // BitsetHash
+  size_t BitsetHash::operator()(const vector<uint64_t>& bitset) const {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a over the words
+    for (uint64_t word : bitset) {
+      hash ^= word;
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  // LazyDFA
+  LazyDFA::LazyDFA(NFA nfa, size_t maxBytes):
+    Nfa(nfa), MaxBytes(maxBytes), Hits(0), Misses(0), Flushes(0), Start(-1) {
+      BitsetWords = (Nfa.StateIds.size() + 63) / 64;
+    }
+
+
+  int LazyDFA::numCachedStates() const {
+    return SetIsFinal.size();
+  }
+
+  size_t LazyDFA::cacheBytes() const {
+    // Subset, transition row, final flag and roughly one hash map node per state
+    size_t bytesPerState = 2 * BitsetWords * sizeof(uint64_t) + Nfa.numSymbols() * sizeof(int) + 1 + 4 * sizeof(void*);
+    return numCachedStates() * bytesPerState;
+  }
+
+  void LazyDFA::clearCache() {
+    Sets.clear();
+    SetIsFinal.clear();
+    Transitions.clear();
+    Ids.clear();
+    Start = -1;
+  }
+
+  int LazyDFA::addState(const vector<uint64_t>& subset) {
+    auto iterator = Ids.find(subset);
+    if (iterator != Ids.end()) {
+      return iterator->second;
+    }
+    if (cacheBytes() > MaxBytes) {
+      clearCache();
+      Flushes++;
+    }
+
+    int id = numCachedStates();
+    bool isFinal = false;
+    for (int block = 0; block < BitsetWords; block++) {
+      for (uint64_t bits = subset[block]; bits != 0; bits &= bits - 1) {
+        isFinal = isFinal || Nfa.IsFinal[block * 64 + __builtin_ctzll(bits)];
+      }
+    }
+    Sets.insert(Sets.end(), subset.begin(), subset.end());
+    SetIsFinal.push_back(isFinal);
+    Transitions.resize(Transitions.size() + Nfa.numSymbols(), -1);
+    Ids[subset] = id;
+    return id;
+  }
+
+  int LazyDFA::startState() {
+    if (Start == -1) {
+      vector<uint64_t> startSet(BitsetWords, 0);
+      for (int state : Nfa.StartStates) {
+        startSet[state / 64] |= 1ULL << (state % 64);
+      }
+      Start = addState(startSet);
+    }
+    return Start;
+  }
+
+  int LazyDFA::nextState(int state, int symbol) {
+    int numSymbols = Nfa.numSymbols();
+    int next = Transitions[state * numSymbols + symbol];
+    if (next != -1) {
+      Hits++;
+      return next;
+    }
+
+    // Not seen before, so take the union of the NFA successors
+    Misses++;
+    vector<uint64_t> subset(BitsetWords, 0);
+    for (int block = 0; block < BitsetWords; block++) {
+      for (uint64_t bits = Sets[state * BitsetWords + block]; bits != 0; bits &= bits - 1) {
+        int cell = (block * 64 + __builtin_ctzll(bits)) * numSymbols + symbol;
+        for (int i = Nfa.Offsets[cell]; i < Nfa.Offsets[cell + 1]; i++) {
+          subset[Nfa.Targets[i] / 64] |= 1ULL << (Nfa.Targets[i] % 64);
+        }
+      }
+    }
+    long flushes = Flushes;
+    next = addState(subset);
+    if (flushes == Flushes) { // State is only still valid if the cache was not flushed
+      Transitions[state * numSymbols + symbol] = next;
+    }
+    return next;
+  }
+
+  bool LazyDFA::isFinalState(int state) const {
+    return SetIsFinal[state];
+  }
+
+  int LazyDFA::runFromStart(const vector<int>& symbols) {
+    int current = startState();
+    for (int symbol : symbols) {
+      current = nextState(current, symbol);
+    }
+    return current;
+  }
+
+  set<int> LazyDFA::run(const string& word) {
+    vector<int> symbols;
+    if (!Nfa.Symbols.tokenize(word, symbols)) {
+      return set<int> {};
+    }
+    int current = runFromStart(symbols);
+    set<int> resultingStates;
+    for (int block = 0; block < BitsetWords; block++) {
+      for (uint64_t bits = Sets[current * BitsetWords + block]; bits != 0; bits &= bits - 1) {
+        resultingStates.insert(Nfa.StateIds[block * 64 + __builtin_ctzll(bits)]);
+      }
+    }
+    return resultingStates;
+  }
+
+  bool LazyDFA::accepts(const string& word) {
+    vector<int> symbols;
+    if (!Nfa.Symbols.tokenize(word, symbols)) {
+      return false;
+    }
+    return SetIsFinal[runFromStart(symbols)];
+  }
+
+  // ResultCache
+  ResultCache::ResultCache(size_t maxBytes):
+    MaxBytes(maxBytes), Hits(0), Misses(0), Evictions(0), TotalBytes(0) {}
+
+  string ResultCache::keyFor(NFA nfa, string operation) {
+    return operation + ":" + canonicalForm(nfa);
+  }
+
+  bool ResultCache::lookup(const string& key, NFA& result) {
+    lock_guard<mutex> guard(Lock);
+    auto iterator = Index.find(key);
+    if (iterator == Index.end()) {
+      Misses++;
+      return false;
+    }
+    Hits++;
+    Entries.splice(Entries.begin(), Entries, iterator->second); // Move to front
+    result = iterator->second->Result;
+    return true;
+  }
+
+  void ResultCache::store(const string& key, NFA result) {
+    size_t resultBytes = key.size() + sizeof(Entry);
+    for (State state : result.States) {
+      resultBytes += sizeof(State) + state.Name.size();
+    }
+    for (Transition transition : result.Transitions) {
+      resultBytes += sizeof(Transition) + transition.Token.size();
+    }
+
+    lock_guard<mutex> guard(Lock);
+    if (resultBytes > MaxBytes || Index.count(key) > 0) {
+      return; // Too big to ever cache, or already added by another thread
+    }
+    Entries.push_front(Entry { key, result, resultBytes });
+    Index[key] = Entries.begin();
+    TotalBytes += resultBytes;
+    evict();
+  }
+
+  void ResultCache::evict() {
+    while (TotalBytes > MaxBytes) { // Least recently used first
+      TotalBytes -= Entries.back().Bytes;
+      Index.erase(Entries.back().Key);
+      Entries.pop_back();
+      Evictions++;
+    }
+  }
+
+  void ResultCache::setMaxBytes(size_t maxBytes) {
+    lock_guard<mutex> guard(Lock);
+    MaxBytes = maxBytes;
+    evict();
+  }
+
+  NFA ResultCache::getOrCompute(NFA nfa, string operation, NFA (*compute)(NFA)) {
+    string key = keyFor(nfa, operation);
+    NFA result(false, {}, {});
+    if (!lookup(key, result)) {
+      result = compute(nfa); // Not locked, so other operations can use the cache meanwhile
+      store(key, result);
+    }
+    return result;
+  }
+
+  size_t ResultCache::bytes() const {
+    lock_guard<mutex> guard(Lock);
+    return TotalBytes;
+  }
+
+  void ResultCache::clear() {
+    lock_guard<mutex> guard(Lock);
+    Entries.clear();
+    Index.clear();
+    TotalBytes = 0;
+  }
+
+  string ResultCache::statisticsToJSON() {
+    lock_guard<mutex> guard(Lock);
+    return "{\"hits\":" + to_string(Hits) + ",\"misses\":" + to_string(Misses) + ",\"evictions\":" + to_string(Evictions) + ",\"entries\":" + to_string(Entries.size()) + ",\"bytes\":" + to_string(TotalBytes) + ",\"maxBytes\":" + to_string(MaxBytes) + "}";
+  }
+
+  // CompiledAutomatonCache
+  CompiledAutomatonCache::CompiledAutomatonCache(size_t maxEntries, size_t lazyMaxBytes):
+    MaxEntries(maxEntries), Hits(0), Misses(0), LazyMaxBytes(lazyMaxBytes), LazyHits(0), LazyMisses(0), LazyFlushes(0) {}
+
+  list<CompiledAutomatonCache::Entry>::iterator CompiledAutomatonCache::find(const NFA& nfa, uint64_t hash) {
+    for (auto entry = Entries.begin(); entry != Entries.end(); entry++) {
+      if (entry->Hash == hash && sameStructure(entry->Structure, nfa)) {
+        Entries.splice(Entries.begin(), Entries, entry);
+        return Entries.begin();
+      }
+    }
+    return Entries.end();
+  }
+
+  list<CompiledAutomatonCache::Entry>::iterator CompiledAutomatonCache::insert(const NFA& nfa, uint64_t hash) {
+    auto entry = find(nfa, hash); // Another thread may have added it while this one was compiling
+    if (entry == Entries.end()) {
+      Entries.push_front(Entry{hash, nfa, nullptr, nullptr});
+      entry = Entries.begin();
+      while (Entries.size() > max<size_t>(MaxEntries, 1)) {
+        Entries.pop_back();
+      }
+    }
+    return entry;
+  }
+
+  shared_ptr<const CompiledDFA> CompiledAutomatonCache::dfa(const NFA& nfa) {
+    uint64_t hash = structureHash(nfa);
+    {
+      lock_guard<mutex> guard(Lock);
+      auto entry = find(nfa, hash);
+      if (entry != Entries.end() && entry->Dfa) {
+        Hits++;
+        return entry->Dfa;
+      }
+      Misses++;
+    }
+    shared_ptr<const CompiledDFA> compiled = make_shared<CompiledDFA>(nfa);
+    lock_guard<mutex> guard(Lock);
+    auto entry = insert(nfa, hash);
+    if (!entry->Dfa) {
+      entry->Dfa = compiled;
+    }
+    return entry->Dfa;
+  }
+
+  shared_ptr<const CompiledNFA> CompiledAutomatonCache::nfa(const NFA& nfa) {
+    uint64_t hash = structureHash(nfa);
+    {
+      lock_guard<mutex> guard(Lock);
+      auto entry = find(nfa, hash);
+      if (entry != Entries.end() && entry->Nfa) {
+        Hits++;
+        return entry->Nfa;
+      }
+      Misses++;
+    }
+    shared_ptr<const CompiledNFA> compiled = make_shared<CompiledNFA>(nfa);
+    lock_guard<mutex> guard(Lock);
+    auto entry = insert(nfa, hash);
+    if (!entry->Nfa) {
+      entry->Nfa = compiled;
+    }
+    return entry->Nfa;
+  }
+
+  set<int> CompiledAutomatonCache::runLazily(const NFA& nfa, const string& word) {
+    uint64_t hash = structureHash(nfa);
+    shared_ptr<LockedLazyDFA> lazy;
+    {
+      lock_guard<mutex> guard(Lock);
+      auto entry = find(nfa, hash);
+      if (entry != Entries.end() && entry->Lazy) {
+        Hits++;
+        lazy = entry->Lazy;
+      } else {
+        Misses++;
+      }
+    }
+    if (!lazy) {
+      shared_ptr<LockedLazyDFA> compiled = make_shared<LockedLazyDFA>(nfa, LazyMaxBytes);
+      lock_guard<mutex> guard(Lock);
+      auto entry = insert(nfa, hash);
+      if (!entry->Lazy) {
+        entry->Lazy = compiled;
+      }
+      lazy = entry->Lazy;
+    }
+
+    lock_guard<mutex> lazyGuard(lazy->Lock);
+    long hits = lazy->Dfa.Hits;
+    long misses = lazy->Dfa.Misses;
+    long flushes = lazy->Dfa.Flushes;
+    set<int> result = lazy->Dfa.run(word);
+    lock_guard<mutex> guard(Lock);
+    LazyHits += lazy->Dfa.Hits - hits;
+    LazyMisses += lazy->Dfa.Misses - misses;
+    LazyFlushes += lazy->Dfa.Flushes - flushes;
+    return result;
+  }
+
+  size_t CompiledAutomatonCache::size() {
+    lock_guard<mutex> guard(Lock);
+    return Entries.size();
+  }
+
+  void CompiledAutomatonCache::clear() {
+    lock_guard<mutex> guard(Lock);
+    Entries.clear();
+  }
+
+  string CompiledAutomatonCache::statisticsToJSON() {
+    lock_guard<mutex> guard(Lock);
+    return "{\"hits\":" + to_string(Hits) + ",\"misses\":" + to_string(Misses) + ",\"entries\":" + to_string(Entries.size()) + ",\"maxEntries\":" + to_string(MaxEntries) +
+           ",\"lazy\":{\"hits\":" + to_string(LazyHits) + ",\"misses\":" + to_string(LazyMisses) + ",\"flushes\":" + to_string(LazyFlushes) + "}}";
+  }
+
+  // EquivalenceResult
+  EquivalenceResult::EquivalenceResult(bool equivalent, vector<string> counterexample):
+    Equivalent(equivalent), Counterexample(counterexample) {}
+
+  string EquivalenceResult::convertToJSON(bool testing) {
+    if (testing) { // Adds spaces to make it more readable
+      return "{ \"equivalent\":" + boolToString(Equivalent) + ", \"counterexample\":" + stringsToJSON(Counterexample) + " }";
+    } else {
+      return "{\"equivalent\":" + boolToString(Equivalent) + ",\"counterexample\":" + stringsToJSON(Counterexample) + "}";
+    }
+  }
+
+  // InclusionResult
+  InclusionResult::InclusionResult(bool included, vector<string> counterexample):
+    Included(included), Counterexample(counterexample) {}
+
+  string InclusionResult::convertToJSON(bool testing) {
+    if (testing) { // Adds spaces to make it more readable
+      return "{ \"included\":" + boolToString(Included) + ", \"counterexample\":" + stringsToJSON(Counterexample) + " }";
+    } else {
+      return "{\"included\":" + boolToString(Included) + ",\"counterexample\":" + stringsToJSON(Counterexample) + "}";
+    }
+  }
+
+  // CancellationToken
+  CancellationToken::CancellationToken():
+    Cancelled(false) {}
+
+  void CancellationToken::cancel() {
+    Cancelled = true;
+  }
+
+  bool CancellationToken::isCancelled() const {
+    return Cancelled;
+  }
+
+  // ConversionBudget
+  ConversionBudget::ConversionBudget(size_t maxStates, size_t maxBytes, long maxMilliseconds):
+    MaxStates(maxStates), MaxBytes(maxBytes), MaxMilliseconds(maxMilliseconds) {}
+
+  string ConversionBudget::exceededLimit(size_t states, size_t bytes, long milliseconds, const CancellationToken* cancellation) const {
+    if (cancellation != nullptr && cancellation->isCancelled()) {
+      return "cancelled";
+    } else if (MaxStates > 0 && states > MaxStates) {
+      return "states";
+    } else if (MaxBytes > 0 && bytes > MaxBytes) {
+      return "bytes";
+    } else if (MaxMilliseconds > 0 && milliseconds > MaxMilliseconds) {
+      return "time";
+    }
+    return "";
+  }
+
+  // ConversionResult
+  ConversionResult::ConversionResult(bool completed, string exceededLimit, NFA dfa, int statesDiscovered, int frontierSize, size_t bytes, long milliseconds):
+    Completed(completed), ExceededLimit(exceededLimit), Dfa(dfa), StatesDiscovered(statesDiscovered), FrontierSize(frontierSize), Bytes(bytes), Milliseconds(milliseconds) {}
+
+  string ConversionResult::convertToJSON(bool testing) {
+    string statistics = "\"statesDiscovered\":" + to_string(StatesDiscovered) + ",\"frontierSize\":" + to_string(FrontierSize) + ",\"bytes\":" + to_string(Bytes);
+    if (!testing) { // Timings differ between runs
+      statistics += ",\"milliseconds\":" + to_string(Milliseconds);
+    }
+    string dfaJSON = Completed ? Dfa.convertToJSON(false) : "null";
+    return "{\"completed\":" + boolToString(Completed) + ",\"exceededLimit\":\"" + ExceededLimit + "\",\"dfa\":" + dfaJSON + "," + statistics + "}";
+  }
+
   Circle::Circle(Point center, float radius):
     Center(center), Radius(radius) {}
 
-  StateCircle::StateCircle(State correspondingState, Circle correspondingCircle):
-    CorrespondingState(correspondingState), CorrespondingCircle(correspondingCircle) {}
+  StateCircle::StateCircle(State correspondingState, Circle correspondingCircle):
+    CorrespondingState(correspondingState), CorrespondingCircle(correspondingCircle) {}
+
+  StateCircle::StateCircle():
+    CorrespondingState(State(0, "", false, false)), CorrespondingCircle(Circle(Point(), 0)) {}
+
+  Arrow::Arrow(Point tip, Point tail):
+    Tip(tip), Tail(tail) {}
+
+  ContourShape::ContourShape():
+    Type(ContourType::Other), Radius(0) {}
+
+  // TraceBuffer
+  TraceBuffer::TraceBuffer(int threadId):
+    ThreadId(threadId), Slots(new Slot[Capacity]()), Head(0) {}
+
+  void TraceBuffer::record(const TraceEvent& event) {
+    // A sequence lock per slot, so a snapshot can tell when it read a slot that was being rewritten
+    uint64_t head = Head.load(memory_order_relaxed);
+    Slot& slot = Slots[head % Capacity];
+    slot.Sequence.store(2 * head + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.Name.store(event.Name, memory_order_relaxed);
+    slot.Phase.store(event.Phase, memory_order_relaxed);
+    slot.Timestamp.store(event.Timestamp, memory_order_relaxed);
+    slot.Duration.store(event.Duration, memory_order_relaxed);
+    slot.Value.store(event.Value, memory_order_relaxed);
+    slot.Sequence.store(2 * head + 2, memory_order_release);
+    Head.store(head + 1, memory_order_release);
+  }
+
+  vector<TraceEvent> TraceBuffer::snapshot() const {
+    uint64_t end = Head.load(memory_order_acquire);
+    uint64_t begin = end > Capacity ? end - Capacity : 0;
+    vector<TraceEvent> events;
+    for (uint64_t i = begin; i < end; i++) {
+      const Slot& slot = Slots[i % Capacity];
+      uint64_t sequence = slot.Sequence.load(memory_order_acquire);
+      if (sequence != 2 * i + 2) { // Already reused by the owning thread
+        continue;
+      }
+      TraceEvent event;
+      event.Name = slot.Name.load(memory_order_relaxed);
+      event.Phase = slot.Phase.load(memory_order_relaxed);
+      event.Timestamp = slot.Timestamp.load(memory_order_relaxed);
+      event.Duration = slot.Duration.load(memory_order_relaxed);
+      event.Value = slot.Value.load(memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+      if (slot.Sequence.load(memory_order_relaxed) == sequence) { // Not rewritten while being read
+        events.push_back(event);
+      }
+    }
+    return events;
+  }
+
+  // TraceSpan
+  TraceSpan::TraceSpan(const char* name):
+    Name(name), Start(traceMicroseconds()) {}
+
+  TraceSpan::~TraceSpan() {
+    TraceEvent event;
+    event.Name = Name;
+    event.Phase = 'X';
+    event.Timestamp = Start;
+    event.Duration = traceMicroseconds() - Start;
+    event.Value = 0;
+    traceBuffer().record(event);
+  }
+
+  // PhotoPipeline
+  PhotoPipeline::PhotoPipeline() {}
+
+  string PhotoPipeline::lastLog() const {
+    return Log.str();
+  }
+
+  ContourBuffers PhotoPipeline::borrowContourBuffers() {
+    lock_guard<mutex> lock(ContourBuffersMutex);
+    if (SpareContourBuffers.empty()) {
+      return ContourBuffers();
+    }
+    ContourBuffers buffers = SpareContourBuffers.back(); // Mats share their data, so this does not copy the images
+    SpareContourBuffers.pop_back();
+    return buffers;
+  }
+
+  void PhotoPipeline::returnContourBuffers(ContourBuffers& buffers) {
+    lock_guard<mutex> lock(ContourBuffersMutex);
+    SpareContourBuffers.push_back(ContourBuffers());
+    swap(SpareContourBuffers.back(), buffers);
+  }
+
+  // PhotoPipelinePool
+  PhotoPipelinePool::PhotoPipelinePool(size_t maxIdle):
+    MaxIdle(maxIdle) {}
+
+  unique_ptr<PhotoPipeline> PhotoPipelinePool::acquire() {
+    lock_guard<mutex> lock(Mutex);
+    if (Idle.empty()) {
+      return unique_ptr<PhotoPipeline>(new PhotoPipeline());
+    }
+    unique_ptr<PhotoPipeline> pipeline = move(Idle.back());
+    Idle.pop_back();
+    return pipeline;
+  }
+
+  void PhotoPipelinePool::release(unique_ptr<PhotoPipeline> pipeline) {
+    lock_guard<mutex> lock(Mutex);
+    if (Idle.size() < MaxIdle) {
+      Idle.push_back(move(pipeline));
+    }
+  }
+
+  size_t PhotoPipelinePool::numIdle() {
+    lock_guard<mutex> lock(Mutex);
+    return Idle.size();
+  }
+
+  // ==================================
+  // ===== ** Helper Functions ** =====
+  // ==================================
+
+  void printVector(string name, vector<int> list) {
+    cout << name << ": {";
+    for (int i : list) {
+      cout << to_string(i) << " ";
+    }
+    cout << "}\n";
+  }
+
+  void printSet(string name, set<int> set) {
+    cout << name << ": {";
+    for (int i : set) {
+      cout << to_string(i) << " ";
+    }
+    cout << "}\n";
+  }
+
+  string boolToString(bool x) {
+    return x ? "true" : "false";
+  }
+
+  string intsToJSON(vector<int> list) {
+    string json = "[";
+    for (int i = 0; i < list.size(); i++) {
+      json += (i == 0 ? "" : ",") + to_string(list[i]);
+    }
+    return json + "]";
+  }
+
+  string intsToJSON(set<int> list) {
+    return intsToJSON(vector<int>(list.begin(), list.end()));
+  }
+
+  string stringsToJSON(vector<string> list) {
+    string json = "[";
+    for (int i = 0; i < list.size(); i++) {
+      json += (i == 0 ? "\"" : ",\"") + list[i] + "\"";
+    }
+    return json + "]";
+  }
+
+  string escapeJSON(string text) {
+    string escaped;
+    for (char character : text) {
+      switch (character) {
+        case '"': escaped += "\\\""; break;
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        case '\t': escaped += "\\t"; break;
+        default:
+          if ((unsigned char)character < 0x20) {
+            char code[7];
+            snprintf(code, sizeof(code), "\\u%04x", character);
+            escaped += code;
+          } else {
+            escaped += character;
+          }
+      }
+    }
+    return escaped;
+  }
+
+  JSONValue parseJSON(const string& text) {
+    size_t position = 0;
+    JSONValue value = parseJSONValue(text, position);
+    while (position < text.size() && isspace((unsigned char)text[position])) {
+      position++;
+    }
+    if (position != text.size()) {
+      throw invalid_argument("Unexpected text after JSON value at " + to_string(position));
+    }
+    return value;
+  }
+
+  JSONValue parseJSONValue(const string& text, size_t& position) {
+    auto skipSpace = [&]() {
+      while (position < text.size() && isspace((unsigned char)text[position])) {
+        position++;
+      }
+    };
+    auto fail = [&](string message) {
+      return invalid_argument(message + " at " + to_string(position));
+    };
+    auto expect = [&](char character) {
+      skipSpace();
+      if (position >= text.size() || text[position] != character) {
+        throw fail(string("Expected '") + character + "'");
+      }
+      position++;
+    };
+    auto parseString = [&]() {
+      expect('"');
+      string result;
+      while (true) {
+        if (position >= text.size()) {
+          throw fail("Unterminated string");
+        }
+        char character = text[position++];
+        if (character == '"') {
+          return result;
+        }
+        if (character != '\\') {
+          result += character;
+          continue;
+        }
+        if (position >= text.size()) {
+          throw fail("Unterminated string");
+        }
+        char escape = text[position++];
+        switch (escape) {
+          case '"': case '\\': case '/': result += escape; break;
+          case 'b': result += '\b'; break;
+          case 'f': result += '\f'; break;
+          case 'n': result += '\n'; break;
+          case 'r': result += '\r'; break;
+          case 't': result += '\t'; break;
+          case 'u': {
+            auto readCode = [&]() {
+              if (position + 4 > text.size()) {
+                throw fail("Bad unicode escape");
+              }
+              unsigned long code = stoul(text.substr(position, 4), nullptr, 16);
+              position += 4;
+              return code;
+            };
+            unsigned long code = readCode();
+            if (code >= 0xD800 && code < 0xDC00 && text.compare(position, 2, "\\u") == 0) { // Surrogate pair
+              position += 2;
+              code = 0x10000 + ((code - 0xD800) << 10) + (readCode() - 0xDC00);
+            }
+            // Encode as UTF-8
+            if (code < 0x80) {
+              result += (char)code;
+            } else if (code < 0x800) {
+              result += (char)(0xC0 | code >> 6);
+              result += (char)(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+              result += (char)(0xE0 | code >> 12);
+              result += (char)(0x80 | (code >> 6 & 0x3F));
+              result += (char)(0x80 | (code & 0x3F));
+            } else {
+              result += (char)(0xF0 | code >> 18);
+              result += (char)(0x80 | (code >> 12 & 0x3F));
+              result += (char)(0x80 | (code >> 6 & 0x3F));
+              result += (char)(0x80 | (code & 0x3F));
+            }
+            break;
+          }
+          default:
+            throw fail("Bad escape");
+        }
+      }
+    };
+
+    JSONValue value;
+    skipSpace();
+    if (position >= text.size()) {
+      throw fail("Expected JSON value");
+    }
+    char first = text[position];
+    if (first == '{') {
+      value.Type = JSONType::Object;
+      position++;
+      skipSpace();
+      if (position < text.size() && text[position] == '}') {
+        position++;
+        return value;
+      }
+      while (true) {
+        string key = parseString();
+        expect(':');
+        value.Members[key] = parseJSONValue(text, position);
+        skipSpace();
+        if (position < text.size() && text[position] == ',') {
+          position++;
+        } else {
+          expect('}');
+          return value;
+        }
+      }
+    } else if (first == '[') {
+      value.Type = JSONType::Array;
+      position++;
+      skipSpace();
+      if (position < text.size() && text[position] == ']') {
+        position++;
+        return value;
+      }
+      while (true) {
+        value.Elements.push_back(parseJSONValue(text, position));
+        skipSpace();
+        if (position < text.size() && text[position] == ',') {
+          position++;
+        } else {
+          expect(']');
+          return value;
+        }
+      }
+    } else if (first == '"') {
+      value.Type = JSONType::String;
+      value.StringValue = parseString();
+    } else if (text.compare(position, 4, "true") == 0) {
+      value.Type = JSONType::Boolean;
+      value.BooleanValue = true;
+      position += 4;
+    } else if (text.compare(position, 5, "false") == 0) {
+      value.Type = JSONType::Boolean;
+      position += 5;
+    } else if (text.compare(position, 4, "null") == 0) {
+      position += 4;
+    } else {
+      const char* start = text.c_str() + position;
+      char* end;
+      value.Type = JSONType::Number;
+      value.NumberValue = strtod(start, &end);
+      if (end == start) {
+        throw fail("Unexpected character");
+      }
+      position += end - start;
+    }
+    return value;
+  }
 
-  StateCircle::StateCircle():
-    CorrespondingState(State(0, "", false, false)), CorrespondingCircle(Circle(Point(), 0)) {}
+  // Every thread's trace buffer. Buffers are shared with their thread, so events survive the thread ending, and go on
+  // the free list when it ends, so short lived threads do not each keep one
+  struct TraceRegistry {
+    mutex Mutex;
+    vector<shared_ptr<TraceBuffer>> Buffers;
+    vector<shared_ptr<TraceBuffer>> Free;
+    atomic<int64_t> ClearedAt{ -1 };
+  };
+
+  // Holds a thread's buffer, handing it back to the registry when the thread exits
+  struct ThreadTraceBuffer {
+    shared_ptr<TraceBuffer> Buffer;
+
+    ~ThreadTraceBuffer();
+  };
+
+  TraceRegistry& traceRegistry() {
+    static TraceRegistry registry;
+    return registry;
+  }
+
+  int64_t traceMicroseconds() {
+    static const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - epoch).count();
+  }
+
+  ThreadTraceBuffer::~ThreadTraceBuffer() {
+    if (Buffer) {
+      TraceRegistry& registry = traceRegistry();
+      lock_guard<mutex> lock(registry.Mutex);
+      registry.Free.push_back(Buffer);
+    }
+  }
+
+  TraceBuffer& traceBuffer() {
+    thread_local ThreadTraceBuffer holder;
+    if (!holder.Buffer) { // Only the first event on each thread takes the lock
+      TraceRegistry& registry = traceRegistry();
+      lock_guard<mutex> lock(registry.Mutex);
+      if (!registry.Free.empty()) { // Keeps the events of the thread that ended, which are older than any new ones
+        holder.Buffer = registry.Free.back();
+        registry.Free.pop_back();
+      } else {
+        holder.Buffer = make_shared<TraceBuffer>(registry.Buffers.size() + 1);
+        registry.Buffers.push_back(holder.Buffer);
+      }
+    }
+    return *holder.Buffer;
+  }
+
+  int numTraceBuffers() {
+    TraceRegistry& registry = traceRegistry();
+    lock_guard<mutex> lock(registry.Mutex);
+    return registry.Buffers.size();
+  }
+
+  void traceCounter(const char* name, double value) {
+    TraceEvent event;
+    event.Name = name;
+    event.Phase = 'C';
+    event.Timestamp = traceMicroseconds();
+    event.Duration = 0;
+    event.Value = value;
+    traceBuffer().record(event);
+  }
+
+  void clearTrace() {
+    traceRegistry().ClearedAt = traceMicroseconds();
+  }
+
+  string exportChromeTrace() {
+    TraceRegistry& registry = traceRegistry();
+    vector<shared_ptr<TraceBuffer>> buffers;
+    {
+      lock_guard<mutex> lock(registry.Mutex);
+      buffers = registry.Buffers;
+    }
+    int64_t clearedAt = registry.ClearedAt;
+    string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const shared_ptr<TraceBuffer>& buffer : buffers) {
+      for (const TraceEvent& event : buffer->snapshot()) {
+        if (event.Timestamp <= clearedAt) {
+          continue;
+        }
+        json += first ? "" : ",";
+        first = false;
+        json += "{\"name\":\"" + escapeJSON(event.Name) + "\",\"ph\":\"" + event.Phase + "\",\"ts\":" + to_string(event.Timestamp) + ",\"pid\":1,\"tid\":" + to_string(buffer->ThreadId);
+        if (event.Phase == 'X') {
+          json += ",\"dur\":" + to_string(event.Duration) + "}";
+        } else {
+          json += ",\"args\":{\"value\":" + to_string(event.Value) + "}}";
+        }
+      }
+    }
+    return json + "]}";
+  }
+
+  const JSONValue& jsonMember(const JSONValue& object, const string& key, JSONType type) {
+    static const char* typeNames[] = { "null", "a boolean", "a number", "a string", "an array", "an object" };
+    if (object.Type != JSONType::Object) {
+      throw invalid_argument("Expected an object with member \"" + key + "\"");
+    }
+    const JSONValue& member = object[key];
+    if (member.Type != type) {
+      throw invalid_argument("JSON member \"" + key + "\" should be " + typeNames[(int)type] + ", not " + typeNames[(int)member.Type]);
+    }
+    return member;
+  }
+
+  int jsonInt(const JSONValue& object, const string& key) {
+    double number = jsonMember(object, key, JSONType::Number).NumberValue;
+    if (number != floor(number) || number < numeric_limits<int>::min() || number > numeric_limits<int>::max()) {
+      throw invalid_argument("JSON member \"" + key + "\" should be a whole number");
+    }
+    return number;
+  }
+
+  uint64_t mixHash(uint64_t hash, uint64_t value) {
+    // Based on splitmix64, so that similar inputs give very different hashes
+    uint64_t x = hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  void parallelFor(int count, int threads, const function<void(int, int)>& body) {
+    // Splits 0 to count into one contiguous range per thread, running the first range on this thread
+    if (threads == 0) {
+      threads = max(1u, thread::hardware_concurrency());
+    }
+    threads = max(1, min(threads, count));
+    vector<thread> workers;
+    for (int worker = 1; worker < threads; worker++) {
+      workers.push_back(thread(body, (long)count * worker / threads, (long)count * (worker + 1) / threads));
+    }
+    body(0, count / threads);
+    for (thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  template <typename T>
+  set<T> setIntersection(set<T> set1, set<T> set2) {
+    set<T> result;
+    for (T item : set1) {
+      if (set2.find(item) != set2.end()) {
+        result.insert(item);
+      }
+    }
+    return result;
+  }
+
+  template <typename T>
+  set<T> setUnion(set<T> set1, set<T> set2) {
+    set1.insert(set2.begin(), set2.end());
+    return set1;
+  }
+
+  template <typename T>
+  set<T> setDifference(set<T> set1, set<T> set2) {
+    set<T> result;
+    for (T item : set1) {
+      if (set2.find(item) == set2.end()) {
+        result.insert(item);
+      }
+    }
+    return result;
+  }
 
-  Arrow::Arrow(Point tip, Point tail):
-    Tip(tip), Tail(tail) {}
-  
   // ==================================
-  // ===== ** Helper Functions ** =====
+  // === ** DFA / NFA Functions ** ====
   // ==================================
 
-  void printVector(string name, vector<int> list) {
-    cout << name << ": {";
-    for (int i : list) {
-      cout << to_string(i) << " ";
+  set<int> getStates(vector<State> states) {
+    set<int> result;
+    for (State state : states) {
+      result.insert(state.Id);
+    }
+    return result;
+  }
+
+  set<string> getAlphabet(vector<Transition> transitions) {
+    set<string> alphabet;
+    for (Transition transition : transitions) {
+      alphabet.insert(transition.Token);
+    }
+    return alphabet;
+  }
+
+  int getStartState(vector<State> states) {
+    for (State state : states) {
+      if (state.IsStart) {
+        return state.Id;
+      }
+    }
+    throw out_of_range("Start state not found");
+  }
+
+  set<int> getFinalStates(vector<State> states) {
+    set<int> finalStates;
+    for (State state : states) {
+      if (state.IsFinal) {
+        finalStates.insert(state.Id);
+      }
+    }
+    return finalStates;
+  }
+
+  vector<string> getSymbols(vector<Transition> transitions) {
+    return splitIntoSymbols(getAlphabet(transitions));
+  }
+
+  bool parseCharacterClass(const string& token, CharacterClass& result) {
+    if (token.size() < 3 || token[0] != '[' || token.back() != ']') {
+      return false;
+    }
+    result = CharacterClass();
+    size_t end = token.size() - 1;
+    size_t position = 1;
+    bool negated = token[position] == '^' && end - position > 1; // [^] is just the caret
+    if (negated) {
+      position++;
+    }
+    auto hexValue = [](char digit) {
+      if (digit >= '0' && digit <= '9') {
+        return digit - '0';
+      }
+      digit = tolower(digit);
+      return digit >= 'a' && digit <= 'f' ? digit - 'a' + 10 : -1;
+    };
+    auto readByte = [&](int& byte) {
+      if (position >= end) {
+        return false;
+      }
+      if (token[position] != '\\') {
+        byte = (unsigned char)token[position++];
+        return true;
+      }
+      if (position + 1 >= end) {
+        return false;
+      }
+      char escaped = token[position + 1];
+      if (escaped == 'x') {
+        if (position + 3 >= end || hexValue(token[position + 2]) == -1 || hexValue(token[position + 3]) == -1) {
+          return false;
+        }
+        byte = hexValue(token[position + 2]) * 16 + hexValue(token[position + 3]);
+        position += 4;
+        return true;
+      }
+      byte = escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped == 'r' ? '\r' : (unsigned char)escaped;
+      position += 2;
+      return true;
+    };
+    while (position < end) {
+      int first, last;
+      if (!readByte(first)) {
+        return false;
+      }
+      last = first;
+      if (token[position] == '-' && position + 1 < end) { // A dash just before the closing bracket is literal
+        position++;
+        if (!readByte(last) || last < first) {
+          return false;
+        }
+      }
+      for (int byte = first; byte <= last; byte++) {
+        result.add(byte);
+      }
+    }
+    if (negated) {
+      for (uint64_t& word : result.Bytes) {
+        word = ~word;
+      }
+    }
+    return true;
+  }
+
+  vector<string> splitIntoSymbols(set<string> tokens) {
+    // Classes and single byte tokens become the largest sets of bytes that each of them either contains or leaves out,
+    // so tables need one column per set rather than per byte and every byte is read by at most one symbol
+    tokens.erase("ε"); // Epsilon is never read from a word
+    vector<CharacterClass> classes;
+    set<string> symbols;
+    bool hasClasses = false;
+    for (const string& token : tokens) {
+      CharacterClass characterClass;
+      if (parseCharacterClass(token, characterClass)) {
+        hasClasses = true;
+        classes.push_back(characterClass);
+      } else if (token.size() == 1) {
+        characterClass.add(token[0]);
+        classes.push_back(characterClass);
+      } else {
+        symbols.insert(token); // Multi byte tokens are matched by the trie, and empty ones never
+      }
+    }
+    if (!hasClasses) {
+      return vector<string>(tokens.begin(), tokens.end());
+    }
+
+    // Refine a single block of bytes by every class in turn. Block 0 stays the bytes no class contains
+    vector<int> blocks(256, 0);
+    int numBlocks = 1;
+    for (const CharacterClass& characterClass : classes) {
+      vector<int> split(numBlocks * 2, -1);
+      int nextBlocks = 1;
+      split[0] = 0;
+      for (int byte = 0; byte < 256; byte++) {
+        int key = blocks[byte] * 2 + characterClass.contains(byte);
+        if (split[key] == -1) {
+          split[key] = nextBlocks++;
+        }
+        blocks[byte] = split[key];
+      }
+      numBlocks = nextBlocks;
+    }
+    vector<CharacterClass> minterms(numBlocks);
+    for (int byte = 0; byte < 256; byte++) {
+      minterms[blocks[byte]].add(byte);
+    }
+    for (int block = 1; block < numBlocks; block++) {
+      symbols.insert(minterms[block].toToken());
+    }
+    return vector<string>(symbols.begin(), symbols.end());
+  }
+
+  unordered_map<int, int> getStateIndices(vector<State> states) {
+    unordered_map<int, int> indices;
+    for (int i = 0; i < states.size(); i++) {
+      indices[states[i].Id] = i;
+    }
+    return indices;
+  }
+
+  string canonicalForm(NFA nfa) {
+    int numStates = nfa.States.size();
+    unordered_map<int, int> indices = getStateIndices(nfa.States);
+    bool wellFormed = indices.size() == numStates;
+    for (Transition transition : nfa.Transitions) {
+      wellFormed = wellFormed && indices.count(transition.Start) > 0 && indices.count(transition.End) > 0;
+    }
+    if (!wellFormed) {
+      return "raw:" + nfa.convertToJSON(false); // Only identical structures will match
+    }
+
+    // Colour states by refining on start, final and the colours of their neighbours until nothing changes.
+    // Colours only depend on the shape of the structure, not on ids, names or ordering
+    vector<uint64_t> tokenHashes;
+    for (Transition transition : nfa.Transitions) {
+      tokenHashes.push_back(hash<string>()(transition.Token));
+    }
+    vector<vector<uint64_t>> outgoing(numStates);
+    vector<vector<uint64_t>> incoming(numStates);
+    auto refine = [&](vector<uint64_t>& colours) {
+      int numColours = 0;
+      while (true) {
+        unordered_set<uint64_t> distinctColours(colours.begin(), colours.end());
+        if (distinctColours.size() == numColours) {
+          return numColours; // Stable
+        }
+        numColours = distinctColours.size();
+
+        for (int i = 0; i < numStates; i++) {
+          outgoing[i].clear();
+          incoming[i].clear();
+        }
+        for (int i = 0; i < nfa.Transitions.size(); i++) {
+          int start = indices[nfa.Transitions[i].Start];
+          int end = indices[nfa.Transitions[i].End];
+          outgoing[start].push_back(mixHash(tokenHashes[i], colours[end]));
+          incoming[end].push_back(mixHash(tokenHashes[i], colours[start]));
+        }
+        vector<uint64_t> newColours(numStates);
+        for (int i = 0; i < numStates; i++) {
+          sort(outgoing[i].begin(), outgoing[i].end());
+          sort(incoming[i].begin(), incoming[i].end());
+          uint64_t colour = colours[i];
+          for (uint64_t value : outgoing[i]) {
+            colour = mixHash(colour, value);
+          }
+          colour = mixHash(colour, incoming[i].size());
+          for (uint64_t value : incoming[i]) {
+            colour = mixHash(colour, value);
+          }
+          newColours[i] = colour;
+        }
+        colours = newColours;
+      }
+    };
+
+    // Writes the structure with states ordered by colour, once every state has its own colour
+    auto formOf = [&](const vector<uint64_t>& colours) {
+      vector<int> order(numStates);
+      for (int i = 0; i < numStates; i++) {
+        order[i] = i;
+      }
+      sort(order.begin(), order.end(), [&colours](int a, int b) { return colours[a] < colours[b]; });
+      vector<int> ranks(numStates);
+      for (int i = 0; i < numStates; i++) {
+        ranks[order[i]] = i;
+      }
+
+      string form = "canonical:" + to_string(numStates) + ";";
+      for (int i : order) {
+        form += nfa.States[i].IsStart ? "S" : "-";
+        form += nfa.States[i].IsFinal ? "F" : "-";
+      }
+      vector<string> transitions;
+      for (Transition transition : nfa.Transitions) {
+        transitions.push_back(to_string(ranks[indices[transition.Start]]) + "," + to_string(ranks[indices[transition.End]]) + "," + to_string(transition.Token.size()) + ":" + transition.Token);
+      }
+      sort(transitions.begin(), transitions.end());
+      for (string transition : transitions) {
+        form += ";" + transition;
+      }
+      return form;
+    };
+
+    // Refinement cannot split symmetric states, such as those on a cycle. Then give each state of the first tied colour
+    // its own colour in turn, refine again, and keep the smallest form, which does not depend on which state was picked.
+    // Very symmetric structures would need too many refinements, so after a fixed number the remaining ties are broken
+    // by position. That is still exact, but may miss some matches
+    const int maxRefinements = 64;
+    int numRefinements = 0;
+    string best;
+    function<void(vector<uint64_t>)> search = [&](vector<uint64_t> colours) {
+      int numColours = refine(colours);
+      numRefinements++;
+      unordered_map<uint64_t, int> sizes;
+      if (numColours < numStates && numRefinements >= maxRefinements) {
+        for (uint64_t& colour : colours) {
+          colour = mixHash(colour, sizes[colour]++);
+        }
+        numColours = refine(colours);
+        sizes.clear();
+      }
+      if (numColours == numStates) {
+        string form = formOf(colours);
+        if (best.empty() || form < best) {
+          best = form;
+        }
+        return;
+      }
+
+      for (uint64_t colour : colours) {
+        sizes[colour]++;
+      }
+      uint64_t tied = 0;
+      bool found = false;
+      for (auto& colourSize : sizes) {
+        if (colourSize.second > 1 && (!found || colourSize.first < tied)) {
+          tied = colourSize.first;
+          found = true;
+        }
+      }
+      bool searched = false;
+      for (int i = 0; i < numStates && (!searched || numRefinements < maxRefinements); i++) {
+        if (colours[i] == tied) {
+          vector<uint64_t> individualised = colours;
+          individualised[i] = mixHash(tied, numStates);
+          search(individualised);
+          searched = true;
+        }
+      }
+    };
+
+    vector<uint64_t> colours(numStates);
+    for (int i = 0; i < numStates; i++) {
+      colours[i] = mixHash(nfa.States[i].IsStart, nfa.States[i].IsFinal);
+    }
+    search(colours);
+    return best;
+  }
+
+  uint64_t canonicalHash(NFA nfa) {
+    string form = canonicalForm(nfa);
+    uint64_t hash = 0;
+    for (unsigned char character : form) {
+      hash = mixHash(hash, character);
+    }
+    return hash;
+  }
+
+  uint64_t structureHash(const NFA& nfa) {
+    // Runs once per run call, so it only multiplies and mixes properly at the end. Collisions are caught by sameStructure
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ULL;
+    uint64_t hash = nfa.States.size();
+    for (const State& state : nfa.States) {
+      hash = (hash ^ ((uint64_t)(uint32_t)state.Id << 2 | (uint64_t)state.IsStart << 1 | (uint64_t)state.IsFinal)) * multiplier;
+    }
+    for (const Transition& transition : nfa.Transitions) {
+      hash = (hash ^ ((uint64_t)(uint32_t)transition.Start << 32 | (uint32_t)transition.End)) * multiplier;
+      uint64_t token = transition.Token.size();
+      for (unsigned char character : transition.Token) {
+        token = token * 31 + character;
+      }
+      hash = (hash ^ token) * multiplier;
+    }
+    return mixHash(hash, nfa.Transitions.size());
+  }
+
+  bool sameStructure(const NFA& nfa1, const NFA& nfa2) {
+    if (nfa1.States.size() != nfa2.States.size() || nfa1.Transitions.size() != nfa2.Transitions.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < nfa1.States.size(); i++) {
+      const State& state1 = nfa1.States[i];
+      const State& state2 = nfa2.States[i];
+      if (state1.Id != state2.Id || state1.IsStart != state2.IsStart || state1.IsFinal != state2.IsFinal) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < nfa1.Transitions.size(); i++) {
+      const Transition& transition1 = nfa1.Transitions[i];
+      const Transition& transition2 = nfa2.Transitions[i];
+      if (transition1.Start != transition2.Start || transition1.End != transition2.End || transition1.Token != transition2.Token) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  ResultCache& resultCache() {
+    static ResultCache cache; // Shared by every bridge call
+    return cache;
+  }
+
+  CompiledAutomatonCache& compiledAutomata() {
+    static CompiledAutomatonCache cache; // Shared by runDFA, runNFA and traceRun
+    return cache;
+  }
+
+  PhotoPipelinePool& photoPipelines() {
+    static PhotoPipelinePool pool; // Shared by photoToNFA on the bridge and photoToNFAAsync
+    return pool;
+  }
+
+  vector<string> mergeAlphabets(const Tokenizer& symbols1, const Tokenizer& symbols2) {
+    // Classes are split again, so every combined symbol lies within a single symbol of each structure
+    set<string> alphabet(symbols1.Tokens.begin(), symbols1.Tokens.end());
+    alphabet.insert(symbols2.Tokens.begin(), symbols2.Tokens.end());
+    return splitIntoSymbols(alphabet);
+  }
+
+  NFA nfaFromJSON(const string& json) {
+    // Accepts a structure as saved by the app, or the output of NFA::convertToJSON
+    // Every member must have the expected type, so a wrong one is reported instead of read as zero or empty
+    JSONValue root = parseJSON(json);
+    const JSONValue& value = root.has("structure") ? jsonMember(root, "structure", JSONType::Object) : root;
+    vector<State> states;
+    for (const JSONValue& state : jsonMember(value, "states", JSONType::Array).Elements) {
+      states.push_back(State(jsonInt(state, "id"), jsonMember(state, "name", JSONType::String).StringValue,
+                             jsonMember(state, "isStart", JSONType::Boolean).BooleanValue, jsonMember(state, "isFinal", JSONType::Boolean).BooleanValue));
+    }
+    vector<Transition> transitions;
+    for (const JSONValue& transition : jsonMember(value, "transitions", JSONType::Array).Elements) {
+      transitions.push_back(Transition(jsonInt(transition, "id"), jsonInt(transition, "start"), jsonInt(transition, "end"),
+                                       jsonMember(transition, "token", JSONType::String).StringValue));
+    }
+    return NFA(value.has("isDfa") && jsonMember(value, "isDfa", JSONType::Boolean).BooleanValue, states, transitions);
+  }
+
+  NFA universalNFA(vector<string> alphabet) {
+    vector<Transition> transitions;
+    for (string token : alphabet) {
+      transitions.push_back(Transition(transitions.size(), 0, 0, token));
+    }
+    return NFA(true, { State(0, "q0", true, true) }, transitions);
+  }
+
+  vector<vector<uint64_t>> computeSimulation(const CompiledNFA& nfa) {
+    TRACE_SPAN("computeSimulation");
+    // Row q holds every state q' that simulates q, meaning q' can copy every move of q and is final whenever q is.
+    // Starts from every pair allowed by final states and removes pairs until nothing changes
+    int numStates = nfa.StateIds.size();
+    int numSymbols = nfa.numSymbols();
+    int words = (numStates + 63) / 64;
+    vector<vector<uint64_t>> simulation(numStates, vector<uint64_t>(words, 0));
+    for (int q = 0; q < numStates; q++) {
+      for (int other = 0; other < numStates; other++) {
+        if (!nfa.IsFinal[q] || nfa.IsFinal[other]) {
+          simulation[q][other / 64] |= 1ULL << (other % 64);
+        }
+      }
+    }
+
+    // Successors of each state and symbol as bitsets
+    vector<vector<uint64_t>> successors(numStates * numSymbols, vector<uint64_t>(words, 0));
+    for (int cell = 0; cell < numStates * numSymbols; cell++) {
+      for (int i = nfa.Offsets[cell]; i < nfa.Offsets[cell + 1]; i++) {
+        successors[cell][nfa.Targets[i] / 64] |= 1ULL << (nfa.Targets[i] % 64);
+      }
     }
-    cout << "}\n";
-  }
 
-  void printSet(string name, set<int> set) {
-    cout << name << ": {";
-    for (int i : set) {
-      cout << to_string(i) << " ";
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (int q = 0; q < numStates; q++) {
+        for (int other = 0; other < numStates; other++) {
+          if (!(simulation[q][other / 64] >> (other % 64) & 1)) {
+            continue;
+          }
+          bool simulates = true;
+          for (int symbol = 0; symbol < numSymbols && simulates; symbol++) {
+            int cell = q * numSymbols + symbol;
+            const vector<uint64_t>& otherSuccessors = successors[other * numSymbols + symbol];
+            for (int i = nfa.Offsets[cell]; i < nfa.Offsets[cell + 1] && simulates; i++) {
+              // Some successor of other must simulate this successor of q
+              bool found = false;
+              for (int word = 0; word < words && !found; word++) {
+                found = (otherSuccessors[word] & simulation[nfa.Targets[i]][word]) != 0;
+              }
+              simulates = found;
+            }
+          }
+          if (!simulates) {
+            simulation[q][other / 64] &= ~(1ULL << (other % 64));
+            changed = true;
+          }
+        }
+      }
     }
-    cout << "}\n";
+    return simulation;
   }
 
-  string boolToString(bool x) {
-    return x ? "true" : "false";
+  vector<int> coarsestBisimulation(int numStates, const vector<int>& sources, const vector<int>& symbols, const vector<int>& targets, const vector<int>& initialBlocks) {
+    vector<int> blockOf;
+    boundedCoarsestBisimulation(numStates, sources, symbols, targets, initialBlocks, nullptr, blockOf);
+    return blockOf;
   }
 
-  template <typename T>
-  set<T> setIntersection(set<T> set1, set<T> set2) {
-    set<T> result;
-    for (T item : set1) {
-      if (set2.find(item) != set2.end()) {
-        result.insert(item);
+  string boundedCoarsestBisimulation(int numStates, const vector<int>& sources, const vector<int>& symbols, const vector<int>& targets, const vector<int>& initialBlocks,
+                                     const BudgetCheck& check, vector<int>& blockOf) {
+    TRACE_SPAN("coarsestBisimulation");
+    // Paige-Tarjan partition refinement. Blocks are kept as ranges of one array of states, with the marked states
+    // of a block moved to the front of its range. Compound blocks are unions of blocks that the partition is already
+    // stable against, and each refinement step splits against the smaller half of one of them
+    vector<int> elements(numStates);
+    vector<int> location(numStates);
+    blockOf.assign(numStates, 0);
+    vector<int> first;
+    vector<int> end;
+    vector<int> marked; // End of the marked states at the front of each block
+
+    // Initial blocks, in order of their labels
+    map<int, vector<int>> labelled;
+    for (int state = 0; state < numStates; state++) {
+      labelled[initialBlocks[state]].push_back(state);
+    }
+    int position = 0;
+    for (auto& label : labelled) {
+      first.push_back(position);
+      marked.push_back(position);
+      for (int state : label.second) {
+        elements[position] = state;
+        location[state] = position;
+        blockOf[state] = first.size() - 1;
+        position++;
       }
+      end.push_back(position);
     }
-    return result;
-  }
 
-  template <typename T>
-  set<T> setUnion(set<T> set1, set<T> set2) {
-    set1.insert(set2.begin(), set2.end());
-    return set1;
-  }
+    // Every block starts in one compound block
+    vector<vector<int>> compoundBlocks(1);
+    vector<int> compoundOf;
+    vector<int> positionInCompound;
+    for (size_t block = 0; block < first.size(); block++) {
+      compoundOf.push_back(0);
+      positionInCompound.push_back(block);
+      compoundBlocks[0].push_back(block);
+    }
+    vector<int> worklist; // Compound blocks made of more than one block
+    vector<char> inWorklist(1, compoundBlocks[0].size() > 1);
+    if (inWorklist[0]) {
+      worklist.push_back(0);
+    }
 
-  template <typename T>
-  set<T> setDifference(set<T> set1, set<T> set2) {
-    set<T> result;
-    for (T item : set1) {
-      if (set2.find(item) == set2.end()) {
-        result.insert(item);
+    vector<int> touched;
+    auto mark = [&](int state) {
+      int block = blockOf[state];
+      int i = location[state];
+      if (i < marked[block]) {
+        return;
+      }
+      int j = marked[block]++;
+      swap(elements[i], elements[j]);
+      location[elements[i]] = i;
+      location[elements[j]] = j;
+      if (marked[block] == first[block] + 1) {
+        touched.push_back(block);
       }
+    };
+    // Moves the marked states of each touched block into a new block in the same compound block
+    auto split = [&]() {
+      for (int block : touched) {
+        if (marked[block] == end[block]) {
+          marked[block] = first[block];
+          continue;
+        }
+        int newBlock = first.size();
+        first.push_back(first[block]);
+        end.push_back(marked[block]);
+        marked.push_back(first[block]);
+        for (int i = first[newBlock]; i < end[newBlock]; i++) {
+          blockOf[elements[i]] = newBlock;
+        }
+        first[block] = marked[block];
+
+        int compound = compoundOf[block];
+        compoundOf.push_back(compound);
+        positionInCompound.push_back(compoundBlocks[compound].size());
+        compoundBlocks[compound].push_back(newBlock);
+        if (!inWorklist[compound]) {
+          inWorklist[compound] = 1;
+          worklist.push_back(compound);
+        }
+      }
+      touched.clear();
+    };
+
+    // Transitions into each state
+    vector<vector<int>> incoming(numStates);
+    for (size_t transition = 0; transition < targets.size(); transition++) {
+      incoming[targets[transition]].push_back(transition);
     }
-    return result;
-  }
 
-  // ==================================
-  // === ** DFA / NFA Functions ** ====
-  // ==================================
+    // Counters of transitions from a state on a symbol into a compound block, shared by those transitions.
+    // To begin with the only compound block is every state
+    vector<int> counts;
+    vector<int> countOf(targets.size());
+    map<pair<int, int>, int> initialCounts;
+    for (size_t transition = 0; transition < targets.size(); transition++) {
+      pair<int, int> key(sources[transition], symbols[transition]);
+      if (initialCounts.count(key) == 0) {
+        initialCounts[key] = counts.size();
+        counts.push_back(0);
+      }
+      countOf[transition] = initialCounts[key];
+      counts[countOf[transition]]++;
+    }
 
-  set<int> getStates(vector<State> states) {
-    set<int> result;
-    for (State state : states) {
-      result.insert(state.Id);
+    // Make the partition stable against every state, by splitting off states with no transitions on a symbol
+    map<int, vector<int>> bySymbol;
+    for (auto& key : initialCounts) {
+      bySymbol[key.first.second].push_back(key.first.first);
     }
-    return result;
+    for (auto& symbol : bySymbol) {
+      for (int state : symbol.second) {
+        mark(state);
+      }
+      split();
+    }
+
+    vector<int> newCountOf(numStates, -1);
+    vector<int> oldCountOf(numStates, -1);
+    vector<int> sourceStates;
+    for (long round = 0; !worklist.empty(); round++) {
+      if (check && round % 1024 == 0) {
+        // Per state and block arrays, plus the incoming lists and counters of every transition
+        string exceededLimit = check((7 * (size_t)numStates + 5 * first.size() + 3 * targets.size()) * sizeof(int) + numStates * sizeof(vector<int>));
+        if (exceededLimit != "") {
+          return exceededLimit;
+        }
+      }
+      int compound = worklist.back();
+      worklist.pop_back();
+      inWorklist[compound] = 0;
+      if (compoundBlocks[compound].size() < 2) {
+        continue;
+      }
+
+      // Take the smaller of two blocks out into a compound block of its own
+      int block0 = compoundBlocks[compound][0];
+      int block1 = compoundBlocks[compound][1];
+      int splitter = end[block0] - first[block0] <= end[block1] - first[block1] ? block0 : block1;
+      int last = compoundBlocks[compound].back();
+      compoundBlocks[compound][positionInCompound[splitter]] = last;
+      positionInCompound[last] = positionInCompound[splitter];
+      compoundBlocks[compound].pop_back();
+      if (compoundBlocks[compound].size() > 1) {
+        inWorklist[compound] = 1;
+        worklist.push_back(compound);
+      }
+      compoundOf[splitter] = compoundBlocks.size();
+      positionInCompound[splitter] = 0;
+      compoundBlocks.push_back({ splitter });
+      inWorklist.push_back(0);
+
+      // Transitions into the splitter, grouped by symbol
+      vector<int> into;
+      for (int i = first[splitter]; i < end[splitter]; i++) {
+        into.insert(into.end(), incoming[elements[i]].begin(), incoming[elements[i]].end());
+      }
+      stable_sort(into.begin(), into.end(), [&](int transition1, int transition2) {
+        return symbols[transition1] < symbols[transition2];
+      });
+
+      for (size_t begin = 0, groupEnd = 0; begin < into.size(); begin = groupEnd) {
+        groupEnd = begin;
+        while (groupEnd < into.size() && symbols[into[groupEnd]] == symbols[into[begin]]) {
+          groupEnd++;
+        }
+
+        // Count the transitions from each state into the splitter
+        for (size_t i = begin; i < groupEnd; i++) {
+          int source = sources[into[i]];
+          if (newCountOf[source] == -1) {
+            newCountOf[source] = counts.size();
+            oldCountOf[source] = countOf[into[i]];
+            counts.push_back(0);
+            sourceStates.push_back(source);
+          }
+          counts[newCountOf[source]]++;
+        }
+
+        // Split off states that can reach the splitter, then states that can only reach the splitter
+        // out of the compound block it was taken from
+        for (int source : sourceStates) {
+          mark(source);
+        }
+        split();
+        for (int source : sourceStates) {
+          if (counts[newCountOf[source]] == counts[oldCountOf[source]]) {
+            mark(source);
+          }
+        }
+        split();
+
+        for (size_t i = begin; i < groupEnd; i++) {
+          counts[countOf[into[i]]]--;
+          countOf[into[i]] = newCountOf[sources[into[i]]];
+        }
+        for (int source : sourceStates) {
+          newCountOf[source] = -1;
+        }
+        sourceStates.clear();
+      }
+    }
+
+    // Number blocks in order of their first state
+    vector<int> numbering(first.size(), -1);
+    int numBlocks = 0;
+    for (int state = 0; state < numStates; state++) {
+      if (numbering[blockOf[state]] == -1) {
+        numbering[blockOf[state]] = numBlocks++;
+      }
+      blockOf[state] = numbering[blockOf[state]];
+    }
+    return "";
   }
 
-  set<string> getAlphabet(vector<Transition> transitions) {
-    set<string> alphabet;
-    for (Transition transition : transitions) {
-      alphabet.insert(transition.Token);
+  size_t bytesPerSubset(const CompiledNFA& nfa) {
+    // Bitset in the subset list and the hash map, table row, member list, and transitions of the unminimised DFA
+    size_t words = (nfa.StateIds.size() + 63) / 64;
+    size_t transitionBytes = 0;
+    for (const string& token : nfa.Symbols.Tokens) {
+      transitionBytes += sizeof(Transition) + token.size();
     }
-    return alphabet;
+    return 2 * words * sizeof(uint64_t) + nfa.numSymbols() * sizeof(int) + sizeof(vector<int>) + nfa.StateIds.size() * sizeof(int) + transitionBytes +
+           64; // Hash map overhead
   }
 
-  int getStartState(vector<State> states) {
-    for (State state : states) {
-      if (state.IsStart) {
-        return state.Id;
+  string exploreSubsets(const CompiledNFA& nfa, ConversionBudget budget, const CancellationToken* cancellation, chrono::steady_clock::time_point begin,
+                        int threads, vector<vector<uint64_t>>& subsets, vector<int>& table, size_t& frontierSize) {
+    // Subset construction from the start subset. Fills subsets and table (row per subset, column per symbol), with the start subset as id 0.
+    // Returns the limit that stopped it, or an empty string, in which case every reachable subset is expanded
+    TRACE_SPAN("exploreSubsets");
+    int numSymbols = nfa.numSymbols();
+    int words = (nfa.StateIds.size() + 63) / 64;
+    size_t subsetBytes = bytesPerSubset(nfa);
+    auto elapsed = [&]() {
+      return (long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    };
+    // Union of the successors of every state in subset on symbol
+    auto successors = [&](const vector<uint64_t>& subset, int symbol, vector<uint64_t>& result) {
+      result.assign(words, 0);
+      for (int word = 0; word < words; word++) {
+        for (uint64_t bits = subset[word]; bits != 0; bits &= bits - 1) {
+          int cell = (word * 64 + __builtin_ctzll(bits)) * numSymbols + symbol;
+          for (int i = nfa.Offsets[cell]; i < nfa.Offsets[cell + 1]; i++) {
+            result[nfa.Targets[i] / 64] |= 1ULL << (nfa.Targets[i] % 64);
+          }
+        }
       }
+    };
+    vector<uint64_t> start(words, 0);
+    for (int state : nfa.StartStates) {
+      start[state / 64] |= 1ULL << (state % 64);
     }
-    throw out_of_range("Start state not found");
-  }
+    subsets.clear();
+    table.clear();
 
-  set<int> getFinalStates(vector<State> states) {
-    set<int> finalStates;
-    for (State state : states) {
-      if (state.IsFinal) {
-        finalStates.insert(state.Id);
+    if (threads == 0) {
+      threads = max(1u, thread::hardware_concurrency());
+    }
+    if (threads == 1) {
+      // Breadth first on this thread
+      unordered_map<vector<uint64_t>, int, BitsetHash> ids = { { start, 0 } };
+      subsets.push_back(start);
+      vector<uint64_t> subset;
+      for (size_t expanded = 0; expanded < subsets.size(); expanded++) {
+        string exceededLimit = budget.exceededLimit(subsets.size(), subsets.size() * subsetBytes, elapsed(), cancellation);
+        if (exceededLimit != "") {
+          frontierSize = subsets.size() - expanded;
+          return exceededLimit;
+        }
+        for (int symbol = 0; symbol < numSymbols; symbol++) {
+          successors(subsets[expanded], symbol, subset);
+          auto inserted = ids.insert(make_pair(subset, (int)subsets.size()));
+          if (inserted.second) {
+            subsets.push_back(subset);
+          }
+          table.push_back(inserted.first->second);
+        }
       }
+      frontierSize = 0;
+      return "";
     }
-    return finalStates;
+
+    // Ids are handed out by a hash map split into shards, each with its own lock
+    const int numShards = 64;
+    struct Shard {
+      mutex Lock;
+      unordered_map<vector<uint64_t>, int, BitsetHash> Ids;
+    };
+    vector<Shard> shards(numShards);
+    atomic<int> nextId(1);
+    shards[BitsetHash()(start) % numShards].Ids[start] = 0;
+
+    // Each worker takes subsets from the back of its own queue, and steals from the front of the others when it runs out
+    struct WorkQueue {
+      mutex Lock;
+      deque<pair<int, vector<uint64_t>>> Subsets;
+    };
+    vector<WorkQueue> queues(threads);
+    queues[0].Subsets.push_back(make_pair(0, start));
+    atomic<long> pending(1); // Subsets discovered but not yet expanded
+    atomic<bool> stopped(false);
+    mutex resultLock;
+    string exceededLimit = "";
+    vector<vector<pair<int, vector<int>>>> rows(threads); // Successor ids of each subset expanded by each worker
+
+    auto work = [&](int worker) {
+      pair<int, vector<uint64_t>> item;
+      vector<uint64_t> subset;
+      while (!stopped) {
+        bool found = false;
+        for (int i = 0; i < threads && !found; i++) {
+          WorkQueue& queue = queues[(worker + i) % threads];
+          lock_guard<mutex> guard(queue.Lock);
+          if (!queue.Subsets.empty()) {
+            if (i == 0) {
+              item = queue.Subsets.back();
+              queue.Subsets.pop_back();
+            } else {
+              item = queue.Subsets.front();
+              queue.Subsets.pop_front();
+            }
+            found = true;
+          }
+        }
+        if (!found) {
+          if (pending == 0) {
+            return;
+          }
+          this_thread::yield();
+          continue;
+        }
+
+        string limit = budget.exceededLimit(nextId, nextId * subsetBytes, elapsed(), cancellation);
+        if (limit != "") {
+          lock_guard<mutex> guard(resultLock);
+          if (!stopped) {
+            exceededLimit = limit;
+            stopped = true;
+          }
+          return;
+        }
+
+        vector<int> row(numSymbols);
+        for (int symbol = 0; symbol < numSymbols; symbol++) {
+          successors(item.second, symbol, subset);
+          Shard& shard = shards[BitsetHash()(subset) % numShards];
+          bool added = false;
+          {
+            lock_guard<mutex> guard(shard.Lock);
+            auto iterator = shard.Ids.find(subset);
+            if (iterator == shard.Ids.end()) {
+              iterator = shard.Ids.insert(make_pair(subset, nextId++)).first;
+              added = true;
+            }
+            row[symbol] = iterator->second;
+          }
+          if (added) {
+            pending++;
+            lock_guard<mutex> guard(queues[worker].Lock);
+            queues[worker].Subsets.push_back(make_pair(row[symbol], subset));
+          }
+        }
+        rows[worker].push_back(make_pair(item.first, row));
+        pending--;
+      }
+    };
+    vector<thread> workers;
+    for (int worker = 1; worker < threads; worker++) {
+      workers.push_back(thread(work, worker));
+    }
+    work(0);
+    for (thread& worker : workers) {
+      worker.join();
+    }
+
+    subsets.assign(nextId, vector<uint64_t>());
+    for (Shard& shard : shards) {
+      for (auto& entry : shard.Ids) {
+        subsets[entry.second] = entry.first;
+      }
+    }
+    frontierSize = pending;
+    if (exceededLimit != "") {
+      return exceededLimit;
+    }
+    table.assign(subsets.size() * numSymbols, -1);
+    for (auto& workerRows : rows) {
+      for (auto& row : workerRows) {
+        copy(row.second.begin(), row.second.end(), table.begin() + row.first * numSymbols);
+      }
+    }
+    return "";
   }
 
   // ==================================
@@ -251,12 +3290,13 @@ namespace mainCode {
   // ==================================
 
   // This function is originally designed at https://stackoverflow.com/questions/66718462/how-to-detect-different-types-of-arrows-in-image
-  void thinningIteration(Mat& img, int iter) {
+  void thinningIteration(Mat& img, int iter, Mat& marker) {
     CV_Assert(img.channels() == 1);
     CV_Assert(img.depth() != sizeof(uchar));
     CV_Assert(img.rows > 3 && img.cols > 3);
 
-    Mat marker = Mat::zeros(img.size(), CV_8UC1);
+    marker.create(img.size(), CV_8UC1);
+    marker.setTo(Scalar(0));
 
     int nRows = img.rows;
     int nCols = img.cols;
@@ -327,198 +3367,448 @@ namespace mainCode {
   }
 
   // This function is originally designed at https://stackoverflow.com/questions/66718462/how-to-detect-different-types-of-arrows-in-image
-  void thinning(const Mat& src, Mat& dst) {
-    dst = src.clone();
-    dst /= 255;         // convert to binary image
-
-    Mat prev = Mat::zeros(dst.size(), CV_8UC1);
-    Mat diff;
+  // Thins a 0/1 binary image in place. Returns false if cancelled part way through. onIteration is given an estimate of the fraction done after each iteration
+  bool thinning(Mat& dst, ThinningBuffers& buffers, const CancellationToken* cancellation = nullptr, const function<void(double)>& onIteration = nullptr) {
+    TRACE_SPAN("thinning");
+    Mat& prev = buffers.Previous;
+    Mat& diff = buffers.Difference;
+    prev.create(dst.size(), CV_8UC1);
+    prev.setTo(Scalar(0));
+    int firstChanges = 0;
+    int changes;
 
     do {
-      thinningIteration(dst, 0);
-      thinningIteration(dst, 1);
+      if (cancellation != nullptr && cancellation->isCancelled()) {
+        return false;
+      }
+      thinningIteration(dst, 0, buffers.Marker);
+      thinningIteration(dst, 1, buffers.Marker);
       absdiff(dst, prev, diff);
       dst.copyTo(prev);
-      cout << "Thinning iteration, countNonZero = " << countNonZero(diff) << "\n";
-    } while (countNonZero(diff) > 0);
+      changes = countNonZero(diff);
+      TRACE_COUNTER("thinningChanges", changes);
+      if (firstChanges == 0) {
+        firstChanges = max(changes, 1);
+      }
+      if (onIteration) {
+        onIteration(max(0.0, 1 - (double)changes / firstChanges)); // Fewer pixels change each iteration
+      }
+    } while (changes > 0);
+
+    return true;
+  }
+
+  // Converts a BGR photo to grayscale, blurs it with a 7x7 Gaussian (sigma 1) and thresholds it 20 below the Otsu value into a 0/1 image,
+  // with ink as 1. Gives the same images as cvtColor, GaussianBlur and threshold, but in one pass over the photo rather than five.
+  // Returns the threshold used
+  double preprocessPhoto(const Mat& src, Mat& gray, Mat& blurred, Mat& binary) {
+    TRACE_SPAN("preprocessPhoto");
+    CV_Assert(src.type() == CV_8UC3);
+    const int radius = 3;
+    const int width = src.cols;
+    const int height = src.rows;
+    gray.create(height, width, CV_8UC1);
+    blurred.create(height, width, CV_8UC1);
+    binary.create(height, width, CV_8UC1);
+
+    // Fixed point kernel with 8 fractional bits, rounded the same way as GaussianBlur's bit exact 8 bit path
+    uint16_t kernel[2 * radius + 1];
+    double weights[2 * radius + 1];
+    double weightSum = 0;
+    for (int i = -radius; i <= radius; i++) {
+      weights[i + radius] = exp(-i * i / 2.0);
+      weightSum += weights[i + radius];
+    }
+    int kernelSum = 0;
+    for (int i = 0; i <= 2 * radius; i++) {
+      kernel[i] = cvRound(weights[i] / weightSum * 256);
+      kernelSum += kernel[i];
+    }
+    kernel[radius] += 256 - kernelSum;
+
+    // Columns and rows past the edge are reflected without repeating the edge, as with BORDER_DEFAULT
+    vector<int> columns(width + 2 * radius);
+    for (int x = -radius; x < width + radius; x++) {
+      columns[x + radius] = borderInterpolate(x, width, BORDER_REFLECT_101);
+    }
+
+    // Each strip of rows keeps the last 7 horizontally blurred rows in a ring, so the photo is only read once and the ring stays in cache
+    const int stripHeight = 64;
+    const int numStrips = (height + stripHeight - 1) / stripHeight;
+    vector<array<int, 256>> histograms(numStrips);
+    parallel_for_(Range(0, numStrips), [&](const Range& range) {
+      // Local copies, as the compiler cannot tell that writing pixels leaves captured values alone, which stops it vectorizing
+      const int cols = width;
+      const uint32_t k0 = kernel[0], k1 = kernel[1], k2 = kernel[2], k3 = kernel[3];
+      vector<uchar> grayRow(cols + 2 * radius);
+      vector<uint16_t> ring((2 * radius + 1) * cols);
+      for (int strip = range.start; strip < range.end; strip++) {
+        int begin = strip * stripHeight;
+        int end = min(begin + stripHeight, height);
+        array<int, 256>& histogram = histograms[strip];
+        histogram.fill(0);
+        for (int y = begin - radius; y < end + radius; y++) {
+          // Grayscale, with the same 15 bit fixed point weights as cvtColor's 8 bit path
+          const uchar* bgr = src.ptr<uchar>(borderInterpolate(y, height, BORDER_REFLECT_101));
+          uchar* grayPixels = grayRow.data() + radius;
+          for (int x = 0; x < cols; x++) {
+            grayPixels[x] = (bgr[3 * x] * 3735 + bgr[3 * x + 1] * 19235 + bgr[3 * x + 2] * 9798 + (1 << 14)) >> 15;
+          }
+          if (y >= begin && y < end) {
+            memcpy(gray.ptr<uchar>(y), grayPixels, cols);
+          }
+          for (int x = 0; x < radius; x++) {
+            grayRow[x] = grayPixels[columns[x]];
+            grayRow[cols + radius + x] = grayPixels[columns[cols + radius + x]];
+          }
+
+          // Horizontal blur, pairing the taps either side of the centre since the kernel is symmetric
+          uint16_t* blurredRow = ring.data() + ((y - begin + radius) % (2 * radius + 1)) * cols;
+          const uchar* taps = grayRow.data();
+          for (int x = 0; x < cols; x++) {
+            blurredRow[x] = k0 * (taps[x] + taps[x + 6]) + k1 * (taps[x + 1] + taps[x + 5]) + k2 * (taps[x + 2] + taps[x + 4]) + k3 * taps[x + 3];
+          }
+
+          // Vertical blur, once the ring holds every row the output row needs
+          int outputY = y - radius;
+          if (outputY < begin) {
+            continue;
+          }
+          const uint16_t* rows[2 * radius + 1];
+          for (int i = 0; i <= 2 * radius; i++) {
+            rows[i] = ring.data() + ((outputY - begin + i) % (2 * radius + 1)) * cols;
+          }
+          uchar* output = blurred.ptr<uchar>(outputY);
+          for (int x = 0; x < cols; x++) {
+            uint32_t total = k0 * (rows[0][x] + rows[6][x]) + k1 * (rows[1][x] + rows[5][x]) + k2 * (rows[2][x] + rows[4][x]) + k3 * rows[3][x];
+            output[x] = (total + (1 << 15)) >> 16;
+          }
+          for (int x = 0; x < cols; x++) {
+            histogram[output[x]]++;
+          }
+        }
+      }
+    });
+
+    // Otsu's threshold from the histogram, as in threshold with THRESH_OTSU
+    array<int, 256> histogram = {};
+    for (const array<int, 256>& stripHistogram : histograms) {
+      for (int i = 0; i < 256; i++) {
+        histogram[i] += stripHistogram[i];
+      }
+    }
+    double scale = 1.0 / (width * height);
+    double mean = 0;
+    for (int i = 0; i < 256; i++) {
+      mean += i * (double)histogram[i];
+    }
+    mean *= scale;
+    double q1 = 0, mean1 = 0, maxSigma = 0;
+    int otsuValue = 0;
+    for (int i = 0; i < 256; i++) {
+      double p = histogram[i] * scale;
+      mean1 *= q1;
+      q1 += p;
+      double q2 = 1 - q1;
+      if (min(q1, q2) < FLT_EPSILON || max(q1, q2) > 1 - FLT_EPSILON) {
+        continue;
+      }
+      mean1 = (mean1 + i * p) / q1;
+      double mean2 = (mean - q1 * mean1) / q2;
+      double sigma = q1 * q2 * (mean1 - mean2) * (mean1 - mean2);
+      if (sigma > maxSigma) {
+        maxSigma = sigma;
+        otsuValue = i;
+      }
+    }
+    double thresholdValue = otsuValue - 20;
+
+    // Dark pixels are ink
+    int cutoff = cvFloor(thresholdValue);
+    parallel_for_(Range(0, height), [&](const Range& range) {
+      const int cols = width;
+      const int maxInk = cutoff;
+      for (int y = range.start; y < range.end; y++) {
+        const uchar* input = blurred.ptr<uchar>(y);
+        uchar* output = binary.ptr<uchar>(y);
+        for (int x = 0; x < cols; x++) {
+          output[x] = input[x] <= maxInk;
+        }
+      }
+    });
+    return thresholdValue;
+  }
+
+  ContourShape classifyContour(const vector<vector<Point>>& contours, int index, int minCircleArea, int minArrowArea, ContourBuffers& buffers) {
+    TRACE_SPAN("classifyContour");
+    ContourShape shape;
+    const vector<Point>& contour = contours[index];
+
+    // Compute convex hull
+    vector<Point>& hull = buffers.Hull;
+    convexHull(contour, hull);
+
+    // Compute circularity, used for shape classification
+    double area = contourArea(hull);
+    double perimeter = arcLength(hull, true);
+    double circularity = (4 * CV_PI * area) / (perimeter * perimeter);
+    if (circularity > 0.92 && area > minCircleArea) {
+      minEnclosingCircle(contour, shape.Center, shape.Radius); // Get min enclosing circle
+      shape.Type = ContourType::Circle;
+      return shape;
+    }
+
+    // Filter contours too small to be an arrow
+    Rect boundingBox = boundingRect(contour);
+    if (boundingBox.area() < minArrowArea) {
+      return shape;
+    }
+
+    // Work on only one contour at a time, drawn with an empty border of one pixel into part of this thread's buffers
+    int rows = boundingBox.height + 2;
+    int cols = boundingBox.width + 2;
+    if (buffers.Drawing.rows < rows || buffers.Drawing.cols < cols) {
+      buffers.Drawing.create(max(rows, buffers.Drawing.rows), max(cols, buffers.Drawing.cols), CV_8UC1);
+      buffers.EndPoints.create(buffers.Drawing.size(), CV_8UC1);
+    }
+    Mat newBinary = buffers.Drawing(Rect(0, 0, cols, rows));
+    Mat endPointImg = buffers.EndPoints(Rect(0, 0, cols, rows));
+    newBinary.setTo(Scalar(0));
+    Point offset(1 - boundingBox.x, 1 - boundingBox.y);
+    drawContours(newBinary, contours, index, Scalar(10), 1, LINE_8, noArray(), INT_MAX, offset);
+
+    // Extract end points
+    int kernelData[3][3] = {
+      {1, 1, 1},
+      {1, 10, 1},
+      {1, 1, 1}
+    };
+    Mat kernel(3, 3, CV_32SC1, kernelData);
+    filter2D(newBinary, endPointImg, -1, kernel, Point(-1, -1), 0, BORDER_CONSTANT | BORDER_ISOLATED);
+    vector<Point>& nonZeroPoints = buffers.EndPointList;
+    nonZeroPoints.clear();
+    for (int y = 0; y < rows; y++) {
+      const uchar* row = endPointImg.ptr<uchar>(y);
+      for (int x = 0; x < cols; x++) {
+        if (row[x] == 110) {
+          nonZeroPoints.push_back(Point(x - offset.x, y - offset.y));
+        }
+      }
+    }
+
+    // Find clusters
+    if (nonZeroPoints.size() != 3 && nonZeroPoints.size() != 4) { // Allow tip to have either 2 or 3 endpoints and tail have only 1
+      return shape;
+    }
+    Mat points(nonZeroPoints.size(), 2, CV_32SC1);
+    for (int i = 0; i < nonZeroPoints.size(); i++) {
+      points.at<int>(i, 0) = nonZeroPoints[i].x;
+      points.at<int>(i, 1) = nonZeroPoints[i].y;
+    }
+    Mat floatPoints;
+    points.convertTo(floatPoints, CV_32FC1);
+    TermCriteria criteria(TermCriteria::EPS + TermCriteria::MAX_ITER, 10, 1.0);
+    Mat labels, centers;
+    // kmeans draws its random centers from theRNG(), so seed it from the contour, not from whichever thread ran it,
+    // and give the thread back its own state afterwards
+    RNG threadRNG = theRNG();
+    theRNG() = RNG(index);
+    kmeans(floatPoints, 2, labels, criteria, 10, KMEANS_RANDOM_CENTERS, centers);
+    theRNG() = threadRNG;
+
+    // Identify tip and tail
+    int cluster0Count = 0;
+    int cluster1Count = 0;
+    for (int i = 0; i < labels.rows; i++) {
+      if (labels.at<int>(i, 0) == 0) {
+        cluster0Count++;
+      } else {
+        cluster1Count++;
+      }
+    }
+
+    if (cluster0Count != 1 && cluster1Count != 1) { // Tail must only have 1 endpoint
+      return shape;
+    }
 
-    dst *= 255;
+    // Convert cluster centers to points
+    if (cluster0Count > cluster1Count) { // Tip has more endpoints than tail
+      shape.Tip = Point(centers.at<float>(0, 0), centers.at<float>(0, 1));
+      shape.Tail = Point(centers.at<float>(1, 0), centers.at<float>(1, 1));
+    } else {
+      shape.Tail = Point(centers.at<float>(0, 0), centers.at<float>(0, 1));
+      shape.Tip = Point(centers.at<float>(1, 0), centers.at<float>(1, 1));
+    }
+    shape.Type = ContourType::Arrow;
+    return shape;
   }
 
   // ==================================
   // = ** Main Exported Functions ** ==
   // ==================================
 
-  string photoToNFA(string path, bool testing) {
-    cout << "\n";
-    Mat src = imread(path, IMREAD_COLOR);
-    if (!src.data) {
+  string PhotoPipeline::run(string path, bool testing, const CancellationToken* cancellation, ProgressCallback progress) {
+    TRACE_SPAN("photoToNFA");
+    auto report = [&](string stage, int percentage) {
+      if (progress) {
+        progress(stage, percentage);
+      }
+    };
+    auto cancelled = [&]() {
+      return cancellation != nullptr && cancellation->isCancelled();
+    };
+    auto showImages = [&]() {
+      if (testing) {
+        imshow("contours", ContourRes);
+        imshow("result", Res);
+        imshow("circles", CircleRes);
+        imshow("arrows", ArrowRes);
+        waitKey(0);
+      }
+    };
+
+    Log.str("");
+    Log.clear();
+    if (cancelled()) {
+      return "Cancelled";
+    }
+    report("loading", 0);
+
+    // Read into buffers kept from the last photo, rather than letting imread allocate new ones
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file) {
+      return "Could not open file";
+    }
+    streamoff fileSize = file.tellg();
+    if (fileSize <= 0) { // imdecode throws on an empty buffer, where imread gave an empty image
       return "Could not open file";
     }
-    if (src.cols == 3024 && src.rows == 4032) {
-      resize(src, src, Size(1260, 1680)); // Resize to speed up thinning
-    } 
-    cout << "Cols: " << src.cols << ", Rows: " << src.rows << "\n";
+    FileBytes.resize(fileSize);
+    file.seekg(0);
+    file.read((char*)FileBytes.data(), FileBytes.size());
+    if (!file) {
+      return "Could not open file";
+    }
+    imdecode(FileBytes, IMREAD_COLOR, &Decoded);
+    if (Decoded.empty()) {
+      return "Could not open file";
+    }
+    bool resized = Decoded.cols == 3024 && Decoded.rows == 4032;
+    if (resized) {
+      resize(Decoded, Resized, Size(1260, 1680)); // Resize to speed up thinning
+    }
+    const Mat& src = resized ? Resized : Decoded;
+    if (testing) {
+      Log << "Cols: " << src.cols << ", Rows: " << src.rows << "\n";
+    }
+    TRACE_COUNTER("cols", src.cols);
+    TRACE_COUNTER("rows", src.rows);
+    if (cancelled()) {
+      return "Cancelled";
+    }
+    report("thresholding", 5);
     int srcSize = src.cols * src.rows;
-    RNG rng;
-    Mat gray;
-    cvtColor(src, gray, COLOR_BGR2GRAY); // Grayscale
-    Mat blurred;
-    GaussianBlur(gray, blurred, Size(7, 7), 1); // Add blur to remove noise
-    Mat outputArray;
-    double thresholdValue = threshold(blurred, outputArray, 0, 255, THRESH_BINARY + THRESH_OTSU);
-    thresholdValue -= 20;
-    cout << "thresholdValue: " << to_string(thresholdValue) << "\n";
-    Mat bin;
-    threshold(blurred, bin, thresholdValue, 255, THRESH_BINARY_INV);
+    double thresholdValue = preprocessPhoto(src, Gray, Blurred, Binary); // Grayscale, blur to remove noise, then threshold to a 0/1 image
+    TRACE_COUNTER("thresholdValue", thresholdValue);
     if (testing) {
-      imshow("binunthinned", bin);
-      imshow("blurred", blurred);
+      Log << "thresholdValue: " << to_string(thresholdValue) << "\n";
+      imshow("binunthinned", Binary * 255);
+      imshow("blurred", Blurred);
       waitKey(0);
     }
-    thinning(bin, bin);
-    Mat res = src.clone(); // Final result
-    Mat circleRes = src.clone(); // Image with all circles detected
-    Mat arrowRes = src.clone(); // Image with all arrows detected
-    Mat contourRes = src.clone(); // Image with contours
-    vector<vector<Point>> contours;
-    findContours(bin.clone(), contours, RETR_LIST, CHAIN_APPROX_NONE); // Gets contours
-    for (int i = 0; i < contours.size(); i++) {
-      Scalar color = Scalar(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
-      drawContours(contourRes, contours, i, color, 5);
+    report("thinning", 10);
+    if (!thinning(Binary, Thinning, cancellation, [&](double fraction) { report("thinning", 10 + 50 * fraction); })) {
+      return "Cancelled";
+    }
+    report("contours", 60);
+    if (testing) { // Images showing what was detected are only drawn when they will be shown
+      src.copyTo(Res); // Final result
+      src.copyTo(CircleRes); // Image with all circles detected
+      src.copyTo(ArrowRes); // Image with all arrows detected
+      src.copyTo(ContourRes); // Image with contours
+    }
+    {
+      TRACE_SPAN("findContours");
+      findContours(Binary, Contours, RETR_LIST, CHAIN_APPROX_NONE); // Gets contours, leaving Binary as it is
+    }
+    TRACE_COUNTER("contours", Contours.size());
+    if (testing) {
+      for (int i = 0; i < Contours.size(); i++) {
+        Scalar color = Scalar(Rng.uniform(0, 255), Rng.uniform(0, 255), Rng.uniform(0, 255));
+        drawContours(ContourRes, Contours, i, color, 5);
+      }
     }
     int minArrowArea = ceil(srcSize / 400);
     int minCircleArea = ceil(srcSize / 910);
-    int duplicateContourThreshold = ceil(srcSize / 1200000);
-
-    // Detect Circles
-    vector<Circle> detectedCircles;
-    vector<vector<Point>> remainingContours;
-    for (int i = 0; i < contours.size(); i++) {
-      vector<Point> contour = contours[i];
-      // Compute convex hull
-      vector<Point> hull;
-      convexHull(contour, hull);
-
-      // Compute circularity, used for shape classification
-      double area = contourArea(hull);
-      double perimeter = arcLength(hull, true);
-      double circularity = (4 * CV_PI * area) / (perimeter * perimeter);
-      if (circularity > 0.92 && area > minCircleArea) {
-        Point2f center;
-        float radius;
-        minEnclosingCircle(contour, center, radius); // Get min enclosing circle
-
-        // Check for duplicate circle detection
-        bool duplicate = false;
-        for (Circle circle : detectedCircles) {
-          if (abs(center.x - circle.Center.x) <= 10 && abs(center.y - circle.Center.y) <= 10 && abs(radius - circle.Radius) <= 10) {
-            duplicate = true;
-          }
-        }
-
-        if (!duplicate) {
-          Scalar color = Scalar(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
-          circle(circleRes, center, radius, color, 3);
-          detectedCircles.push_back(Circle(center, radius));
-        }
-      } else {
-        remainingContours.push_back(contour); // Must check later if its an arrow
+
+    // Classify every contour in parallel, each thread borrowing buffers kept from earlier photos
+    report("classifying", 65);
+    Shapes.assign(Contours.size(), ContourShape());
+    parallel_for_(Range(0, Contours.size()), [&](const Range& range) {
+      ContourBuffers buffers = borrowContourBuffers();
+      for (int i = range.start; i < range.end && !cancelled(); i++) {
+        Shapes[i] = classifyContour(Contours, i, minCircleArea, minArrowArea, buffers);
       }
+      returnContourBuffers(buffers);
+    }, getNumThreads());
+    if (cancelled()) {
+      return "Cancelled";
     }
+    report("building", 90);
 
-    // Detect Arrows
-    vector<Arrow> detectedArrows;
-    for (vector<Point> contour : remainingContours) {
-      // Filter contours too small to be an arrow
-      Rect boundingBox = boundingRect(contour);
-      if (boundingBox.area() < minArrowArea) {
+    // Detect Circles, in contour order so the result does not depend on the threads
+    DetectedCircles.clear();
+    for (const ContourShape& shape : Shapes) {
+      if (shape.Type != ContourType::Circle) {
         continue;
       }
 
-      // Work on only one contour at a time
-      Mat newBinary(bin.size(), CV_8UC1, Scalar(0));
-      drawContours(newBinary, vector<vector<Point>>{ contour }, 0, Scalar(10));
-
-      // Extract end points
-      int kernelData[3][3] = {
-        {1, 1, 1},
-        {1, 10, 1},
-        {1, 1, 1}
-      };
-      Mat kernel(3, 3, CV_32SC1, kernelData);
-      Mat endPointImg;
-      filter2D(newBinary, endPointImg, -1, kernel);
-      for (int y = 0; y < endPointImg.rows; y++) {
-        for (int x = 0; x < endPointImg.cols; x++) {
-          if (endPointImg.at<uchar>(y, x) == 110) {
-            endPointImg.at<uchar>(y, x) = 255;
-          } else {
-            endPointImg.at<uchar>(y, x) = 0;
-          }
+      // Check for duplicate circle detection
+      bool duplicate = false;
+      for (Circle circle : DetectedCircles) {
+        if (abs(shape.Center.x - circle.Center.x) <= 10 && abs(shape.Center.y - circle.Center.y) <= 10 && abs(shape.Radius - circle.Radius) <= 10) {
+          duplicate = true;
         }
       }
 
-      // Find clusters
-      vector<Point> nonZeroPoints;
-      findNonZero(endPointImg, nonZeroPoints);
-      if (nonZeroPoints.size() != 3 && nonZeroPoints.size() != 4) { // Allow tip to have either 2 or 3 endpoints and tail have only 1
-        continue;
-      }
-      Mat points(nonZeroPoints.size(), 2, CV_32SC1);
-      for (int i = 0; i < nonZeroPoints.size(); i++) {
-        points.at<int>(i, 0) = nonZeroPoints[i].x;
-        points.at<int>(i, 1) = nonZeroPoints[i].y;
-      }
-      Mat floatPoints;
-      points.convertTo(floatPoints, CV_32FC1);
-      TermCriteria criteria(TermCriteria::EPS + TermCriteria::MAX_ITER, 10, 1.0);
-      Mat labels, centers;
-      kmeans(floatPoints, 2, labels, criteria, 10, KMEANS_RANDOM_CENTERS, centers);
-
-      // Identify tip and tail
-      int cluster0Count = 0;
-      int cluster1Count = 0;
-      for (int i = 0; i < labels.rows; i++) {
-        if (labels.at<int>(i, 0) == 0) {
-          cluster0Count++;
-        } else {
-          cluster1Count++;
+      if (!duplicate) {
+        if (testing) {
+          Scalar color = Scalar(Rng.uniform(0, 255), Rng.uniform(0, 255), Rng.uniform(0, 255));
+          circle(CircleRes, shape.Center, shape.Radius, color, 3);
         }
+        DetectedCircles.push_back(Circle(shape.Center, shape.Radius));
       }
+    }
 
-      if (cluster0Count != 1 && cluster1Count != 1) { // Tail must only have 1 endpoint
+    // Detect Arrows
+    DetectedArrows.clear();
+    for (const ContourShape& shape : Shapes) {
+      if (shape.Type != ContourType::Arrow) {
         continue;
       }
 
-      // Convert cluster centers to points
-      Point tip;
-      Point tail;
-      if (cluster0Count > cluster1Count) { // Tip has more endpoints than tail
-        tip = Point(centers.at<float>(0, 0), centers.at<float>(0, 1));
-        tail = Point(centers.at<float>(1, 0), centers.at<float>(1, 1));
-      } else {
-        tail = Point(centers.at<float>(0, 0), centers.at<float>(0, 1));
-        tip = Point(centers.at<float>(1, 0), centers.at<float>(1, 1));
-      }
-
       // Draw onto res
-      Scalar color = Scalar(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
-      circle(arrowRes, tip, 20, color, FILLED);
-      circle(arrowRes, tail, 20, color, FILLED);
+      if (testing) {
+        Scalar color = Scalar(Rng.uniform(0, 255), Rng.uniform(0, 255), Rng.uniform(0, 255));
+        circle(ArrowRes, shape.Tip, 20, color, FILLED);
+        circle(ArrowRes, shape.Tail, 20, color, FILLED);
+      }
 
-      detectedArrows.push_back(Arrow(tip, tail));
+      DetectedArrows.push_back(Arrow(shape.Tip, shape.Tail));
     }
 
+    TRACE_COUNTER("circles", DetectedCircles.size());
+    TRACE_COUNTER("arrows", DetectedArrows.size());
+
     // Generate NFA
-    vector<StateCircle> stateCircles;
-    vector<Circle> circlesToSkip;
+    StateCircles.clear();
+    CirclesToSkip.clear();
     int stateId = 0;
-    for (Circle circle : detectedCircles) {
+    for (Circle circle : DetectedCircles) {
 
       // Check if current circle is a final inner ring
       bool found = false;
-      for (Circle innerCircle : circlesToSkip) {
+      for (Circle innerCircle : CirclesToSkip) {
         if (innerCircle.Center.x == circle.Center.x &&
             innerCircle.Center.y == circle.Center.y &&
             innerCircle.Radius == circle.Radius) {
@@ -530,45 +3820,47 @@ namespace mainCode {
       if (!found) {
         // Check for final state circle
         bool isFinal = false;
-        for (Circle secondCircle : detectedCircles) {
+        for (Circle secondCircle : DetectedCircles) {
           bool secondWithinCircle = secondCircle.Radius < circle.Radius && secondCircle.Radius > circle.Radius / 2; // Inner radius must be within 50-100% of the outer radius
           bool circleWithinSecond = circle.Radius < secondCircle.Radius && circle.Radius > secondCircle.Radius / 2;
           bool circlesWithinEachOther = sqrt(std::pow(circle.Center.x - secondCircle.Center.x, 2) + std::pow(circle.Center.y - secondCircle.Center.y, 2)) < abs(circle.Radius - secondCircle.Radius);
           if ((circleWithinSecond || secondWithinCircle) && circlesWithinEachOther) {
             isFinal = true;
             if (circle.Radius > secondCircle.Radius) { // State cirle is the outer circle
-              stateCircles.push_back(StateCircle(State(stateId, "q" + to_string(stateId), false, true), circle));
-              circlesToSkip.push_back(secondCircle); // May check in seperate loop
+              StateCircles.push_back(StateCircle(State(stateId, "q" + to_string(stateId), false, true), circle));
+              CirclesToSkip.push_back(secondCircle); // May check in seperate loop
             } else {
-              stateCircles.push_back(StateCircle(State(stateId, "q" + to_string(stateId), false, true), secondCircle));
-              circlesToSkip.push_back(secondCircle); // May check in seperate loop
+              StateCircles.push_back(StateCircle(State(stateId, "q" + to_string(stateId), false, true), secondCircle));
+              CirclesToSkip.push_back(secondCircle); // May check in seperate loop
             }
           }
         }
         if (!isFinal) {
-          stateCircles.push_back(StateCircle(State(stateId, "q" + to_string(stateId), false, false), circle));
+          StateCircles.push_back(StateCircle(State(stateId, "q" + to_string(stateId), false, false), circle));
         }
         stateId++;
       }
     }
 
     // Draw circles onto res
-    for (StateCircle c : stateCircles) {
-      Scalar color = Scalar(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
-      circle(res, c.CorrespondingCircle.Center, c.CorrespondingCircle.Radius, color, 5);
+    if (testing) {
+      for (const StateCircle& c : StateCircles) {
+        Scalar color = Scalar(Rng.uniform(0, 255), Rng.uniform(0, 255), Rng.uniform(0, 255));
+        circle(Res, c.CorrespondingCircle.Center, c.CorrespondingCircle.Radius, color, 5);
+      }
     }
 
     // Find transitions
-    vector<Transition> transitions;
+    Transitions.clear();
     int startId = -1;
     int transitionId = 0;
-    for (Arrow arrow : detectedArrows) {
+    for (const Arrow& arrow : DetectedArrows) {
       // Calculate tip and tail distances from states
       float minTipDistance = INFINITY; // Default as max value
       float minTailDistance = INFINITY;
       StateCircle tipStateCircle;
       StateCircle tailStateCircle;
-      for (StateCircle stateCircle : stateCircles) {
+      for (const StateCircle& stateCircle : StateCircles) {
         float tipDistance = sqrt(std::pow(arrow.Tip.x - stateCircle.CorrespondingCircle.Center.x, 2) + std::pow(arrow.Tip.y - stateCircle.CorrespondingCircle.Center.y, 2));
         float tailDistance = sqrt(std::pow(arrow.Tail.x - stateCircle.CorrespondingCircle.Center.x, 2) + std::pow(arrow.Tail.y - stateCircle.CorrespondingCircle.Center.y, 2));
         if (tipDistance < minTipDistance) {
@@ -582,52 +3874,46 @@ namespace mainCode {
       }
       // Check if starting arrow
       if (minTipDistance < 2.5 * tipStateCircle.CorrespondingCircle.Radius) { // Arrow too far away
+        Scalar color = Scalar(0, 0, 255);
+        if (testing) {
+          circle(Res, arrow.Tip, 5, color, FILLED);
+          circle(Res, arrow.Tail, 5, color, FILLED);
+        }
         if (minTailDistance > 1.7 * tailStateCircle.CorrespondingCircle.Radius) {
           // Starting arrow
-          Scalar color = Scalar(0, 0, 255);
-          circle(res, arrow.Tip, 5, color, FILLED);
-          circle(res, arrow.Tail, 5, color, FILLED);
-          putText(res, "START", arrow.Tail, FONT_HERSHEY_SIMPLEX, 0.8, color, 2);
+          if (testing) {
+            putText(Res, "START", arrow.Tail, FONT_HERSHEY_SIMPLEX, 0.8, color, 2);
+          }
           if (startId == -1) {
             startId = tipStateCircle.CorrespondingState.Id;
           } else {
-            cout << "\nFailed: More than 1 start state\n";
             if (testing) {
-              imshow("contours", contourRes);
-              imshow("result", res);
-              imshow("circles", circleRes);
-              imshow("arrows", arrowRes);
-              waitKey(0);
+              Log << "\nFailed: More than 1 start state\n";
             }
+            showImages();
             return "More than 1 start state";
           }
         } else {
-          // Regular transition
-          transitions.push_back(Transition(transitionId, tailStateCircle.CorrespondingState.Id, tipStateCircle.CorrespondingState.Id, "0"));
-          Scalar color = Scalar(0, 0, 255);
-          circle(res, arrow.Tip, 5, color, FILLED);
-          circle(res, arrow.Tail, 5, color, FILLED);
+          // Regular transition. Labels are not read from the photo yet, so every one is "0". Recognising them needs a
+          // trained label model, which the app does not ship
+          Transitions.push_back(Transition(transitionId, tailStateCircle.CorrespondingState.Id, tipStateCircle.CorrespondingState.Id, "0"));
           transitionId++;
         }
       }
     }
     if (startId == -1) {
-      cout << "\nFailed: No start state\n";
       if (testing) {
-        imshow("contours", contourRes);
-        imshow("result", res);
-        imshow("circles", circleRes);
-        imshow("arrows", arrowRes);
-        waitKey(0);
+        Log << "\nFailed: No start state\n";
       }
+      showImages();
       return "No start state";
     }
-    vector<State> states;
-    for (StateCircle stateCircle : stateCircles) {
+    States.clear();
+    for (const StateCircle& stateCircle : StateCircles) {
       State state = stateCircle.CorrespondingState;
       // Check for states with no transitions (i.e. dead circles)
       bool noTransitions = true;
-      for (Transition transition : transitions) {
+      for (const Transition& transition : Transitions) {
         if (transition.Start == state.Id || transition.End == state.Id) {
           noTransitions = false;
         }
@@ -638,35 +3924,52 @@ namespace mainCode {
       if (noTransitions && !state.IsStart) {
         continue;
       }
-      states.push_back(state);
+      States.push_back(state);
 
       // Draw state
-      Scalar color = Scalar(255, 0, 0);
-      circle(res, stateCircle.CorrespondingCircle.Center, stateCircle.CorrespondingCircle.Radius, color, 5);
-      putText(res, state.Name, stateCircle.CorrespondingCircle.Center, FONT_HERSHEY_SIMPLEX, 0.8, color, 2);
-      if (state.IsFinal) {
-        circle(res, stateCircle.CorrespondingCircle.Center, 0.8 * stateCircle.CorrespondingCircle.Radius, color, 5);
+      if (testing) {
+        Scalar color = Scalar(255, 0, 0);
+        circle(Res, stateCircle.CorrespondingCircle.Center, stateCircle.CorrespondingCircle.Radius, color, 5);
+        putText(Res, state.Name, stateCircle.CorrespondingCircle.Center, FONT_HERSHEY_SIMPLEX, 0.8, color, 2);
+        if (state.IsFinal) {
+          circle(Res, stateCircle.CorrespondingCircle.Center, 0.8 * stateCircle.CorrespondingCircle.Radius, color, 5);
+        }
       }
     }
 
-    NFA nfa(false, states, transitions);
+    NFA nfa(false, States, Transitions);
 
     bool isDFA = checkIfDFA(nfa); // Calculate whether it is a DFA or NFA
     nfa.IsDfa = isDFA;
 
-    cout << nfa.convertToJSON(true);
     if (testing) {
-      imshow("contours", contourRes);
-      imshow("circles", circleRes);
-      imshow("arrows", arrowRes);
-      imshow("result", res);
-      waitKey(0);
+      Log << nfa.convertToJSON(true);
+    }
+    showImages();
+
+    report("done", 100);
+    return nfa.convertToJSON(false);
+  }
+
+  string photoToNFA(string path, bool testing, const CancellationToken* cancellation, ProgressCallback progress) {
+    unique_ptr<PhotoPipeline> pipeline = photoPipelines().acquire();
+    string result = pipeline->run(path, testing, cancellation, progress);
+    if (testing) {
+      cout << "\n" << pipeline->lastLog() << "\n";
     }
+    photoPipelines().release(move(pipeline));
+    return result;
+  }
 
-    return nfa.convertToJSON(false);
+  future<string> photoToNFAAsync(string path, shared_ptr<CancellationToken> cancellation, ProgressCallback progress) {
+    // The task keeps its own reference to the token, so the caller can drop theirs
+    return async(launch::async, [path, cancellation, progress]() {
+      return photoToNFA(path, false, cancellation.get(), progress);
+    });
   }
 
   NFA simplifyDFA(NFA oldDfa) {
+    TRACE_SPAN("simplifyDFA");
     MathmaticalDFA dfa(oldDfa);
 
     // Removing unreachable states
@@ -797,135 +4100,1032 @@ namespace mainCode {
     return NFA(true, states, transitions);
   }
 
+  NFA simplifyDFA(NFA oldDfa, int threads) {
+    NFA result(true, {}, {});
+    boundedSimplifyDFA(oldDfa, threads, nullptr, result);
+    return result;
+  }
+
+  string boundedSimplifyDFA(NFA oldDfa, int threads, const BudgetCheck& check, NFA& result) {
+    TRACE_SPAN("simplifyDFA");
+    // Moore's algorithm: each round gives every state the signature of its block and the blocks it moves to,
+    // and states with equal signatures share a block in the next round. Stops once the number of blocks stays the same.
+    // Signatures are computed in parallel and turned into block numbers through a hash map split into locked shards
+    CompiledDFA dfa(oldDfa);
+    int numSymbols = dfa.numSymbols();
+
+    // Reachable states, in order of their original ids
+    vector<char> isReachable(dfa.StateIds.size(), 0);
+    vector<int> remaining = { dfa.Start };
+    isReachable[dfa.Start] = 1;
+    while (!remaining.empty()) {
+      int state = remaining.back();
+      remaining.pop_back();
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        int next = dfa.Table[state * numSymbols + symbol];
+        if (next != -1 && !isReachable[next]) {
+          isReachable[next] = 1;
+          remaining.push_back(next);
+        }
+      }
+    }
+    vector<int> reachable;
+    for (int state = 0; state < dfa.StateIds.size(); state++) {
+      if (isReachable[state]) {
+        reachable.push_back(state);
+      }
+    }
+    sort(reachable.begin(), reachable.end(), [&](int state1, int state2) {
+      return dfa.StateIds[state1] < dfa.StateIds[state2];
+    });
+    int numStates = reachable.size();
+    vector<int> position(dfa.StateIds.size(), -1);
+    for (int i = 0; i < numStates; i++) {
+      position[reachable[i]] = i;
+    }
+    vector<int> successors(numStates * numSymbols); // Positions rather than state indices, -1 if undefined
+    for (int i = 0; i < numStates; i++) {
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        int next = dfa.Table[reachable[i] * numSymbols + symbol];
+        successors[i * numSymbols + symbol] = next == -1 ? -1 : position[next];
+      }
+    }
+
+    vector<int> blocks(numStates);
+    int numBlocks = 0;
+    bool hasFinal = false;
+    bool hasNonFinal = false;
+    for (int i = 0; i < numStates; i++) {
+      blocks[i] = dfa.IsFinal[reachable[i]];
+      hasFinal = hasFinal || blocks[i] == 1;
+      hasNonFinal = hasNonFinal || blocks[i] == 0;
+    }
+    numBlocks = hasFinal + hasNonFinal;
+
+    const int numShards = 64;
+    struct Shard {
+      mutex Lock;
+      unordered_multimap<uint64_t, int> Representatives; // First state found with each signature hash
+    };
+    int rowSize = numSymbols + 1;
+    vector<int> signatures(numStates * rowSize);
+    vector<uint64_t> hashes(numStates);
+    vector<int> newBlocks(numStates);
+    while (true) {
+      if (check) {
+        // Table, signature and block arrays, and the hash map of one round
+        string exceededLimit = check((size_t)numStates * ((2 * numSymbols + 4) * sizeof(int) + sizeof(uint64_t) + 32) + dfa.Table.size() * sizeof(int));
+        if (exceededLimit != "") {
+          return exceededLimit;
+        }
+      }
+      parallelFor(numStates, threads, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          int* row = &signatures[i * rowSize];
+          row[0] = blocks[i];
+          uint64_t hash = mixHash(0, blocks[i]);
+          for (int symbol = 0; symbol < numSymbols; symbol++) {
+            int next = successors[i * numSymbols + symbol];
+            row[symbol + 1] = next == -1 ? -1 : blocks[next];
+            hash = mixHash(hash, row[symbol + 1] + 1);
+          }
+          hashes[i] = hash;
+        }
+      });
+
+      vector<Shard> shards(numShards);
+      atomic<int> nextBlock(0);
+      parallelFor(numStates, threads, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          Shard& shard = shards[hashes[i] % numShards];
+          lock_guard<mutex> guard(shard.Lock);
+          auto range = shard.Representatives.equal_range(hashes[i]);
+          bool found = false;
+          for (auto iterator = range.first; iterator != range.second && !found; iterator++) {
+            int other = iterator->second;
+            if (equal(&signatures[i * rowSize], &signatures[i * rowSize] + rowSize, &signatures[other * rowSize])) {
+              newBlocks[i] = newBlocks[other];
+              found = true;
+            }
+          }
+          if (!found) {
+            newBlocks[i] = nextBlock++;
+            shard.Representatives.insert(make_pair(hashes[i], i));
+          }
+        }
+      });
+
+      blocks.swap(newBlocks);
+      if (nextBlock == numBlocks) {
+        break;
+      }
+      numBlocks = nextBlock;
+    }
+
+    // Block numbers depend on thread timing, so number them by their smallest original id as simplifyDFA does
+    vector<int> numbering(numBlocks, -1);
+    int id = 0;
+    for (int i = 0; i < numStates; i++) {
+      if (numbering[blocks[i]] == -1) {
+        numbering[blocks[i]] = id++;
+      }
+    }
+
+    vector<State> states;
+    for (int i = 0; i < numStates; i++) {
+      int block = numbering[blocks[i]];
+      if (block == states.size()) {
+        states.push_back(State(block, "q" + to_string(block), false, dfa.IsFinal[reachable[i]]));
+      }
+      if (reachable[i] == dfa.Start) {
+        states[block].IsStart = true;
+      }
+    }
+    vector<Transition> transitions;
+    vector<char> added(numBlocks * numSymbols, 0);
+    for (int i = 0; i < numStates; i++) {
+      int block = numbering[blocks[i]];
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        int next = successors[i * numSymbols + symbol];
+        if (next != -1 && !added[block * numSymbols + symbol]) {
+          added[block * numSymbols + symbol] = 1;
+          transitions.push_back(Transition(transitions.size(), block, numbering[blocks[next]], dfa.Symbols.Tokens[symbol]));
+        }
+      }
+    }
+    result = NFA(true, states, transitions);
+    return "";
+  }
+
+  NFA reduceNFA(NFA nfa, bool backward) {
+    NFA result(false, {}, {});
+    boundedReduceNFA(nfa, backward, nullptr, result);
+    return result;
+  }
+
+  string boundedReduceNFA(NFA nfa, bool backward, const BudgetCheck& check, NFA& result) {
+    TRACE_SPAN("reduceNFA");
+    // Epsilon-free form with a single start state, where a state is final if its epsilon closure contains a final state
+    CompiledNFA compiled(nfa);
+    size_t compiledBytes = (compiled.Offsets.size() + compiled.Targets.size() + 3 * compiled.StateIds.size()) * sizeof(int);
+    string exceededLimit = check ? check(compiledBytes) : "";
+    if (exceededLimit != "") {
+      return exceededLimit;
+    }
+    int numStates = compiled.StateIds.size();
+    int numSymbols = compiled.numSymbols();
+    vector<int> sources;
+    vector<int> symbols;
+    vector<int> targets;
+    for (int state = 0; state < numStates; state++) {
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        int cell = state * numSymbols + symbol;
+        for (int i = compiled.Offsets[cell]; i < compiled.Offsets[cell + 1]; i++) {
+          sources.push_back(state);
+          symbols.push_back(symbol);
+          targets.push_back(compiled.Targets[i]);
+        }
+      }
+    }
+    int start = compiled.Start;
+    vector<char> isFinal = compiled.ClosureIsFinal;
+
+    // Merges the states of each block, keeping one copy of each transition between blocks
+    auto quotient = [&](const vector<int>& blockOf) {
+      int numBlocks = 0;
+      for (int block : blockOf) {
+        numBlocks = max(numBlocks, block + 1);
+      }
+      vector<char> blockIsFinal(numBlocks, 0);
+      for (int state = 0; state < numStates; state++) {
+        blockIsFinal[blockOf[state]] = blockIsFinal[blockOf[state]] || isFinal[state];
+      }
+      set<tuple<int, int, int>> edges;
+      for (size_t i = 0; i < sources.size(); i++) {
+        edges.insert(make_tuple(blockOf[sources[i]], symbols[i], blockOf[targets[i]]));
+      }
+      sources.clear();
+      symbols.clear();
+      targets.clear();
+      for (auto edge : edges) {
+        sources.push_back(get<0>(edge));
+        symbols.push_back(get<1>(edge));
+        targets.push_back(get<2>(edge));
+      }
+      numStates = numBlocks;
+      start = blockOf[start];
+      isFinal = blockIsFinal;
+    };
+
+    // Refinement rounds also count the compiled NFA and the edge lists
+    BudgetCheck refinementCheck = nullptr;
+    if (check) {
+      refinementCheck = [&](size_t bytes) {
+        return check(compiledBytes + 3 * sources.size() * sizeof(int) + bytes);
+      };
+    }
+
+    // Forward bisimilar states have the same finality and can move on each symbol into the same blocks
+    vector<int> labels(isFinal.begin(), isFinal.end());
+    vector<int> blockOf;
+    exceededLimit = boundedCoarsestBisimulation(numStates, sources, symbols, targets, labels, refinementCheck, blockOf);
+    if (exceededLimit != "") {
+      return exceededLimit;
+    }
+    quotient(blockOf);
+
+    // Backward bisimilar states are both start or neither, and can be reached on each symbol from the same blocks
+    if (backward) {
+      labels.assign(numStates, 0);
+      labels[start] = 1;
+      exceededLimit = boundedCoarsestBisimulation(numStates, targets, symbols, sources, labels, refinementCheck, blockOf);
+      if (exceededLimit != "") {
+        return exceededLimit;
+      }
+      quotient(blockOf);
+    }
+
+    vector<State> states;
+    for (int state = 0; state < numStates; state++) {
+      states.push_back(State(state, "q" + to_string(state), state == start, isFinal[state]));
+    }
+    vector<Transition> transitions;
+    for (size_t i = 0; i < sources.size(); i++) {
+      transitions.push_back(Transition(i, sources[i], targets[i], compiled.Symbols.Tokens[symbols[i]]));
+    }
+    result = NFA(false, states, transitions);
+    result.IsDfa = checkIfDFA(result);
+    return "";
+  }
+
   NFA convertNFAtoDFA(NFA oldNfa) {
-    MathmaticalNFA nfa(oldNfa);
+    return boundedConvertNFAtoDFA(oldNfa, ConversionBudget()).Dfa;
+  }
+
+  NFA convertNFAtoDFA(NFA oldNfa, int threads) {
+    return boundedConvertNFAtoDFA(oldNfa, ConversionBudget(), nullptr, threads).Dfa;
+  }
+
+  ConversionResult boundedConvertNFAtoDFA(NFA oldNfa, ConversionBudget budget, const CancellationToken* cancellation, int threads) {
+    TRACE_SPAN("convertNFAtoDFA");
+    auto begin = chrono::steady_clock::now();
+    auto elapsed = [&]() {
+      return (long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    };
+    // Every stage checks the budget, counting the subsets found so far along with its own memory
+    vector<vector<uint64_t>> subsets;
+    size_t subsetBytes = 0;
+    size_t bytes = 0;
+    BudgetCheck check = [&](size_t stageBytes) {
+      bytes = subsets.size() * subsetBytes + stageBytes;
+      return budget.exceededLimit(subsets.size(), bytes, elapsed(), cancellation);
+    };
+    auto stopped = [&](string exceededLimit, size_t frontierSize) {
+      return ConversionResult(false, exceededLimit, NFA(true, {}, {}), subsets.size(), frontierSize, bytes, elapsed());
+    };
+
+    NFA reduced(false, {}, {});
+    string exceededLimit = boundedReduceNFA(oldNfa, false, check, reduced); // Merging bisimilar states first keeps the number of subsets down
+    if (exceededLimit != "") {
+      return stopped(exceededLimit, 0);
+    }
+    CompiledNFA nfa(reduced);
+    int numSymbols = nfa.numSymbols();
+    subsetBytes = bytesPerSubset(nfa);
+
+    vector<int> table;
+    size_t frontierSize;
+    exceededLimit = exploreSubsets(nfa, budget, cancellation, begin, threads, subsets, table, frontierSize);
+    TRACE_COUNTER("subsets", subsets.size());
+    if (exceededLimit != "") {
+      bytes = subsets.size() * subsetBytes;
+      return stopped(exceededLimit, frontierSize);
+    }
 
-    // Initiate stateSubsets
-    set<set<int>> stateSubsets = {{}}; // Contains each possible subset of states
-    for (int stateId : nfa.States) {
-      set<set<int>> newStateSubsets = stateSubsets;
-      for (set<int> currentSubset : stateSubsets) {
-        set<int> newSubset = currentSubset;
-        newSubset.insert(stateId);
-        newStateSubsets.insert(newSubset);
+    // Subsets are numbered in the order of the sets of reduced states they contain, as when every subset was enumerated.
+    // This keeps the ids simplifyDFA gives the same however many threads found the subsets
+    const int checkInterval = 4096;
+    vector<vector<int>> members(subsets.size());
+    for (int id = 0; id < subsets.size(); id++) {
+      if (id % checkInterval == 0 && (exceededLimit = check(0)) != "") {
+        return stopped(exceededLimit, 0);
+      }
+      for (int state = 0; state < nfa.StateIds.size(); state++) {
+        if (subsets[id][state / 64] >> (state % 64) & 1) {
+          members[id].push_back(state);
+        }
       }
-      stateSubsets = newStateSubsets;
+    }
+    vector<int> order(subsets.size());
+    for (int id = 0; id < order.size(); id++) {
+      order[id] = id;
+    }
+    sort(order.begin(), order.end(), [&](int id1, int id2) {
+      return members[id1] < members[id2];
+    });
+    vector<int> newIds(subsets.size());
+    for (int newId = 0; newId < order.size(); newId++) {
+      newIds[order[newId]] = newId;
     }
 
     vector<State> newStates;
     vector<Transition> newTransitions;
+    for (int newId = 0; newId < order.size(); newId++) {
+      if (newId % checkInterval == 0 && (exceededLimit = check(0)) != "") {
+        return stopped(exceededLimit, 0);
+      }
+      int id = order[newId];
+      bool isFinal = false;
+      for (int state : members[id]) {
+        isFinal = isFinal || nfa.IsFinal[state];
+      }
+      newStates.push_back(State(newId, "q" + to_string(newId), id == 0, isFinal));
+      for (int symbol = 0; symbol < numSymbols; symbol++) {
+        newTransitions.push_back(Transition(newTransitions.size(), newId, newIds[table[id * numSymbols + symbol]], nfa.Symbols.Tokens[symbol]));
+      }
+    }
+    NFA dfa(true, {}, {});
+    exceededLimit = boundedSimplifyDFA(NFA(true, newStates, newTransitions), threads, check, dfa); // Complete, so the same as the single threaded simplifyDFA
+    if (exceededLimit != "") {
+      return stopped(exceededLimit, 0);
+    }
+    return ConversionResult(true, "", dfa, subsets.size(), 0, subsets.size() * subsetBytes, elapsed());
+  }
+
+  NFA cachedSimplifyDFA(NFA oldDfa) {
+    return resultCache().getOrCompute(oldDfa, "simplifyDFA", simplifyDFA);
+  }
+
+  NFA cachedConvertNFAtoDFA(NFA oldNfa) {
+    return resultCache().getOrCompute(oldNfa, "convertNFAtoDFA", convertNFAtoDFA);
+  }
+
+  ConversionResult cachedBoundedConvertNFAtoDFA(NFA oldNfa, ConversionBudget budget, const CancellationToken* cancellation, int threads) {
+    // Shares entries with cachedConvertNFAtoDFA. Only completed conversions are stored
+    string key = resultCache().keyFor(oldNfa, "convertNFAtoDFA");
+    NFA dfa(true, {}, {});
+    if (resultCache().lookup(key, dfa)) {
+      return ConversionResult(true, "", dfa, 0, 0, 0, 0);
+    }
+    ConversionResult result = boundedConvertNFAtoDFA(oldNfa, budget, cancellation, threads);
+    if (result.Completed) {
+      resultCache().store(key, result.Dfa);
+    }
+    return result;
+  }
+
+  EquivalenceResult areEquivalent(NFA nfa1, NFA nfa2) {
+    TRACE_SPAN("areEquivalent");
+    // Determinize both lazily, without a memory budget so state numbers stay valid
+    LazyDFA dfa1(nfa1, SIZE_MAX);
+    LazyDFA dfa2(nfa2, SIZE_MAX);
+
+    // Symbols of the combined alphabet in each structure, -1 if the structure does not use it
+    vector<string> alphabet = mergeAlphabets(dfa1.Nfa.Symbols, dfa2.Nfa.Symbols);
+    vector<int> symbols1;
+    vector<int> symbols2;
+    for (string token : alphabet) {
+      symbols1.push_back(dfa1.Nfa.Symbols.symbolId(token));
+      symbols2.push_back(dfa2.Nfa.Symbols.symbolId(token));
+    }
+
+    // State -1 is the dead state, reached on symbols a structure does not use
+    auto next1 = [&](int state, int symbol) { return state == -1 || symbols1[symbol] == -1 ? -1 : dfa1.nextState(state, symbols1[symbol]); };
+    auto next2 = [&](int state, int symbol) { return state == -1 || symbols2[symbol] == -1 ? -1 : dfa2.nextState(state, symbols2[symbol]); };
+    auto final1 = [&](int state) { return state != -1 && dfa1.isFinalState(state); };
+    auto final2 = [&](int state) { return state != -1 && dfa2.isFinalState(state); };
+
+    // Hopcroft and Karp: assume the start states are equivalent, merging the classes of every pair of successors,
+    // until either a pair disagrees on being final or there is nothing left to merge
+    unordered_map<long long, long long> parents; // Union find over states of both structures, roots have no entry
+    auto find = [&parents](long long key) {
+      long long root = key;
+      while (parents.count(root) > 0) {
+        root = parents[root];
+      }
+      while (key != root) { // Path compression
+        long long parent = parents[key];
+        parents[key] = root;
+        key = parent;
+      }
+      return root;
+    };
+    auto key1 = [](int state) { return (long long)(state + 1) * 2; };
+    auto key2 = [](int state) { return (long long)(state + 1) * 2 + 1; };
+
+    int start1 = dfa1.startState();
+    int start2 = dfa2.startState();
+    parents[key1(start1)] = key2(start2);
+    vector<pair<int, int>> queue = { make_pair(start1, start2) };
+    bool equivalent = true;
+    for (size_t head = 0; head < queue.size(); head++) {
+      int state1 = queue[head].first;
+      int state2 = queue[head].second;
+      if (final1(state1) != final2(state2)) {
+        equivalent = false;
+        break;
+      }
+      for (int symbol = 0; symbol < alphabet.size(); symbol++) {
+        int nextState1 = next1(state1, symbol);
+        int nextState2 = next2(state2, symbol);
+        long long root1 = find(key1(nextState1));
+        long long root2 = find(key2(nextState2));
+        if (root1 != root2) {
+          parents[root1] = root2;
+          queue.push_back(make_pair(nextState1, nextState2));
+        }
+      }
+    }
+    if (equivalent) {
+      return EquivalenceResult(true, {});
+    }
+
+    // Merging classes can skip over the shortest counterexample, so find it with a plain breadth first search of the product
+    unordered_map<long long, pair<long long, int>> previous; // Previous pair and symbol used to reach each pair
+    auto pairKey = [](int state1, int state2) { return ((long long)(state1 + 1) << 32) | (long long)(state2 + 1); };
+    queue = { make_pair(start1, start2) };
+    previous[pairKey(start1, start2)] = make_pair(-1LL, -1);
+    for (size_t head = 0; head < queue.size(); head++) {
+      int state1 = queue[head].first;
+      int state2 = queue[head].second;
+      if (final1(state1) != final2(state2)) {
+        vector<string> counterexample;
+        for (long long key = pairKey(state1, state2); previous[key].second != -1; key = previous[key].first) {
+          counterexample.push_back(alphabet[previous[key].second]);
+        }
+        reverse(counterexample.begin(), counterexample.end());
+        return EquivalenceResult(false, counterexample);
+      }
+      for (int symbol = 0; symbol < alphabet.size(); symbol++) {
+        int nextState1 = next1(state1, symbol);
+        int nextState2 = next2(state2, symbol);
+        long long key = pairKey(nextState1, nextState2);
+        if (previous.count(key) == 0) {
+          previous[key] = make_pair(pairKey(state1, state2), symbol);
+          queue.push_back(make_pair(nextState1, nextState2));
+        }
+      }
+    }
+    throw logic_error("No counterexample found for structures that are not equivalent"); // Should not happen
+  }
+
+  InclusionResult isIncluded(NFA nfa1, NFA nfa2) {
+    TRACE_SPAN("isIncluded");
+    CompiledNFA big(nfa2);
+    // Symbols of nfa1 are split wherever classes in nfa2 split them, so each lies within at most one symbol of big
+    CompiledNFA small(nfa1, mergeAlphabets(Tokenizer(getSymbols(nfa1.Transitions)), big.Symbols));
+    int numBigStates = big.StateIds.size();
+    int words = (numBigStates + 63) / 64;
+    vector<vector<uint64_t>> simulation = computeSimulation(big);
+
+    // Symbol in big for each symbol of small, -1 if big does not use it
+    vector<int> bigSymbols;
+    for (string token : small.Symbols.Tokens) {
+      bigSymbols.push_back(big.Symbols.symbolId(token));
+    }
+
+    auto contains = [](const vector<uint64_t>& bitset, int state) { return (bitset[state / 64] >> (state % 64) & 1) != 0; };
+    // The language of subset is contained in the language of other if every state is simulated by one in other
+    auto covered = [&](const vector<uint64_t>& subset, const vector<uint64_t>& other) {
+      for (int word = 0; word < words; word++) {
+        for (uint64_t bits = subset[word]; bits != 0; bits &= bits - 1) {
+          int state = word * 64 + __builtin_ctzll(bits);
+          bool found = false;
+          for (int i = 0; i < words && !found; i++) {
+            found = (other[i] & simulation[state][i]) != 0;
+          }
+          if (!found) {
+            return false;
+          }
+        }
+      }
+      return true;
+    };
+    // Remove states simulated by another state in the subset, as they add nothing to its language
+    auto minimise = [&](vector<uint64_t>& subset) {
+      for (int word = 0; word < words; word++) {
+        for (uint64_t bits = subset[word]; bits != 0; bits &= bits - 1) {
+          int state = word * 64 + __builtin_ctzll(bits);
+          for (int i = 0; i < words; i++) {
+            uint64_t simulators = subset[i] & simulation[state][i];
+            if (i == word) {
+              simulators &= ~(1ULL << (state % 64));
+            }
+            for (; simulators != 0; simulators &= simulators - 1) {
+              int other = i * 64 + __builtin_ctzll(simulators);
+              if (!contains(simulation[other], state) || other < state) { // Keep the lowest of states that simulate each other
+                subset[word] &= ~(1ULL << (state % 64));
+                break;
+              }
+            }
+            if (!contains(subset, state)) {
+              break;
+            }
+          }
+        }
+      }
+    };
+    auto hasFinal = [&](const vector<uint64_t>& subset) {
+      for (int word = 0; word < words; word++) {
+        for (uint64_t bits = subset[word]; bits != 0; bits &= bits - 1) {
+          if (big.IsFinal[word * 64 + __builtin_ctzll(bits)]) {
+            return true;
+          }
+        }
+      }
+      return false;
+    };
+
+    // Search pairs of a state of small and the subset of big reached by the same word. Only the pairs with
+    // the smallest languages are kept for each state of small (an antichain), as they are the first to fail
+    struct Node {
+      int State;
+      vector<uint64_t> Subset;
+      int Parent;
+      int Symbol;
+    };
+    vector<Node> nodes;
+    vector<vector<int>> antichains(small.StateIds.size());
+    auto add = [&](int state, vector<uint64_t>& subset, int parent, int symbol) {
+      minimise(subset);
+      for (int node : antichains[state]) {
+        if (covered(nodes[node].Subset, subset)) {
+          return; // Already have a pair that fails at least as soon
+        }
+      }
+      vector<int> kept; // Pairs that now fail no sooner than the new one are dropped from the antichain
+      for (int node : antichains[state]) {
+        if (!covered(subset, nodes[node].Subset)) {
+          kept.push_back(node);
+        }
+      }
+      kept.push_back(nodes.size());
+      antichains[state] = kept;
+      nodes.push_back(Node { state, subset, parent, symbol });
+    };
+
+    vector<uint64_t> startSubset(words, 0);
+    for (int state : big.StartStates) {
+      startSubset[state / 64] |= 1ULL << (state % 64);
+    }
+    for (int state : small.StartStates) {
+      vector<uint64_t> subset = startSubset;
+      add(state, subset, -1, -1);
+    }
 
-    int newId = 0;
-    for (set<int> subset : stateSubsets) {
-      // Detemine if corresponding state is start or final
-      bool isStart = nfa.TransitionTable[nfa.StartState]["ε"] == subset;
-      bool isFinal = !setIntersection(nfa.FinalStates, subset).empty();
-      newStates.push_back(State(newId, "q" + to_string(newId), isStart, isFinal));
-
-      string result0;
-      string result1;
-      // Make subsets corresponding transitions
-      for (string token : nfa.Alphabet) {
-        // Ignore all epsilon transitions
-        if (token == "ε") {
+    // Breadth first, so the first counterexample found is a shortest one. Pairs dropped from the antichain are
+    // still searched, as they were found with a shorter word than the pair that replaced them
+    vector<uint64_t> nextSubset(words);
+    for (int head = 0; head < nodes.size(); head++) {
+      if (small.IsFinal[nodes[head].State] && !hasFinal(nodes[head].Subset)) {
+        vector<string> counterexample;
+        for (int node = head; nodes[node].Parent != -1; node = nodes[node].Parent) {
+          counterexample.push_back(small.Symbols.Tokens[nodes[node].Symbol]);
+        }
+        reverse(counterexample.begin(), counterexample.end());
+        return InclusionResult(false, counterexample);
+      }
+      for (int symbol = 0; symbol < small.numSymbols(); symbol++) {
+        int smallCell = nodes[head].State * small.numSymbols() + symbol;
+        if (small.Offsets[smallCell] == small.Offsets[smallCell + 1]) {
           continue;
         }
+        fill(nextSubset.begin(), nextSubset.end(), 0);
+        if (bigSymbols[symbol] != -1) {
+          for (int word = 0; word < words; word++) {
+            for (uint64_t bits = nodes[head].Subset[word]; bits != 0; bits &= bits - 1) {
+              int bigCell = (word * 64 + __builtin_ctzll(bits)) * big.numSymbols() + bigSymbols[symbol];
+              for (int i = big.Offsets[bigCell]; i < big.Offsets[bigCell + 1]; i++) {
+                nextSubset[big.Targets[i] / 64] |= 1ULL << (big.Targets[i] % 64);
+              }
+            }
+          }
+        }
+        for (int i = small.Offsets[smallCell]; i < small.Offsets[smallCell + 1]; i++) {
+          vector<uint64_t> subset = nextSubset;
+          add(small.Targets[i], subset, head, symbol);
+        }
+      }
+    }
+    return InclusionResult(true, {});
+  }
+
+  InclusionResult isUniversal(NFA nfa) {
+    // A structure is universal if it contains the language of a single accepting state looping on every symbol
+    return isIncluded(universalNFA(getSymbols(nfa.Transitions)), nfa);
+  }
+
+  NFA productOf(NFA nfa1, NFA nfa2, ProductOperation operation) {
+    TRACE_SPAN("productOf");
+    LazyDFA dfa1(nfa1, SIZE_MAX);
+    LazyDFA dfa2(nfa2, SIZE_MAX);
+    vector<string> alphabet = mergeAlphabets(dfa1.Nfa.Symbols, dfa2.Nfa.Symbols);
+    vector<int> symbols1;
+    vector<int> symbols2;
+    for (string token : alphabet) {
+      symbols1.push_back(dfa1.Nfa.Symbols.symbolId(token));
+      symbols2.push_back(dfa2.Nfa.Symbols.symbolId(token));
+    }
+
+    // State -1 is an implicit sink, reached on undefined transitions, so partial structures behave as if complete
+    auto isFinal = [&](int state1, int state2) {
+      bool final1 = state1 != -1 && dfa1.isFinalState(state1);
+      bool final2 = state2 != -1 && dfa2.isFinalState(state2);
+      switch (operation) {
+        case ProductOperation::Intersection:
+          return final1 && final2;
+        case ProductOperation::Union:
+          return final1 || final2;
+        default:
+          return final1 && !final2;
+      }
+    };
+
+    // Explore only the pairs reachable from the start id
+    unordered_map<long long, int> ids;
+    vector<pair<int, int>> pairs;
+    vector<vector<pair<int, int>>> edges; // Symbol and target of each pair's transitions
+    auto pairKey = [](int state1, int state2) { return ((long long)(state1 + 1) << 32) | (long long)(state2 + 1); };
+    int start1 = dfa1.startState();
+    int start2 = dfa2.startState();
+    ids[pairKey(start1, start2)] = 0;
+    pairs.push_back(make_pair(start1, start2));
+    for (int current = 0; current < pairs.size(); current++) {
+      edges.push_back({});
+      for (int symbol = 0; symbol < alphabet.size(); symbol++) {
+        int state1 = pairs[current].first;
+        int state2 = pairs[current].second;
+        int next1 = state1 == -1 || symbols1[symbol] == -1 ? -1 : dfa1.nextState(state1, symbols1[symbol]);
+        int next2 = state2 == -1 || symbols2[symbol] == -1 ? -1 : dfa2.nextState(state2, symbols2[symbol]);
+        if (next1 == -1 && next2 == -1) {
+          continue; // Both in the sink, which is never final
+        }
+        auto inserted = ids.insert(make_pair(pairKey(next1, next2), (int)pairs.size()));
+        if (inserted.second) {
+          pairs.push_back(make_pair(next1, next2));
+        }
+        edges[current].push_back(make_pair(symbol, inserted.first->second));
+      }
+    }
 
-        // Get the set of states that the NFA can be in after consuming token
-        set<int> allResultingStates;
-        for (int i : subset) {
-          allResultingStates = setUnion(allResultingStates, nfa.TransitionTable[i][token]);
-        }        
-        int resultingId = distance(stateSubsets.begin(), stateSubsets.find(allResultingStates));
-        newTransitions.push_back(Transition(newTransitions.size(), newId, resultingId, token));
+    // Trim pairs that cannot reach a final pair, searching backwards from the final pairs
+    int numPairs = pairs.size();
+    vector<vector<int>> reverseEdges(numPairs);
+    for (int id = 0; id < numPairs; id++) {
+      for (const pair<int, int>& edge : edges[id]) {
+        reverseEdges[edge.second].push_back(id);
+      }
+    }
+    vector<char> useful(numPairs, 0);
+    vector<int> remaining;
+    for (int id = 0; id < numPairs; id++) {
+      if (isFinal(pairs[id].first, pairs[id].second)) {
+        useful[id] = 1;
+        remaining.push_back(id);
+      }
+    }
+    while (!remaining.empty()) {
+      int current = remaining.back();
+      remaining.pop_back();
+      for (int previous : reverseEdges[current]) {
+        if (!useful[previous]) {
+          useful[previous] = 1;
+          remaining.push_back(previous);
+        }
+      }
+    }
+    // Number the kept pairs in the order they were found
+    vector<int> newIds(numPairs, -1);
+    vector<State> states;
+    for (int id = 0; id < numPairs; id++) {
+      if (useful[id] || id == 0) { // Start is always kept, even when the language is empty
+        newIds[id] = states.size();
+        states.push_back(State(states.size(), "q" + to_string(states.size()), id == 0, isFinal(pairs[id].first, pairs[id].second)));
+      }
+    }
+    vector<Transition> transitions;
+    for (int id = 0; id < numPairs; id++) {
+      for (const pair<int, int>& edge : edges[id]) {
+        if (useful[id] && useful[edge.second]) {
+          transitions.push_back(Transition(transitions.size(), newIds[id], newIds[edge.second], alphabet[edge.first]));
+        }
       }
-      newId++;
     }
+    NFA result(false, states, transitions);
+    result.IsDfa = checkIfDFA(result); // Trimming can leave it partial
+    return result;
+  }
+
+  NFA intersectionOf(NFA nfa1, NFA nfa2) {
+    return productOf(nfa1, nfa2, ProductOperation::Intersection);
+  }
 
-    return simplifyDFA(NFA(true, newStates, newTransitions));
+  NFA unionOf(NFA nfa1, NFA nfa2) {
+    return productOf(nfa1, nfa2, ProductOperation::Union);
   }
 
-  set<int> runDFA(NFA oldDfa, string word) {
-    MathmaticalDFA dfa(oldDfa); // Convert to Mathmatical model
+  NFA differenceOf(NFA nfa1, NFA nfa2) {
+    return productOf(nfa1, nfa2, ProductOperation::Difference);
+  }
 
-    int currentState = dfa.StartState;
-    for (char character : word) {
-      string characterString(1, character);
-      if (dfa.TransitionTable[currentState].count(characterString) > 0) { // Must check, as an undefined transition will default in 0
-        currentState = dfa.TransitionTable[currentState][characterString];
-      } else {
-        return set<int> {};
+  NFA complementOf(NFA nfa) {
+    // Complement within the structure's own alphabet
+    return productOf(universalNFA(getSymbols(nfa.Transitions)), nfa, ProductOperation::Difference);
+  }
+
+  set<int> runDFA(const NFA& oldDfa, const string& word) {
+    TRACE_SPAN("runDFA");
+    // The compact model splits the word into alphabet tokens. It is cached, so running more words on the same
+    // structure skips building the tokenizer, table and kernel again
+    return compiledAutomata().dfa(oldDfa)->run(word);
+  }
+
+  set<int> runNFA(const NFA& oldNfa, const string& word, bool lazy) {
+    TRACE_SPAN("runNFA");
+    if (lazy) {
+      return compiledAutomata().runLazily(oldNfa, word);
+    }
+    return compiledAutomata().nfa(oldNfa)->run(word); // Cached like runDFA
+  }
+
+  // Appends the step from the previous to the current state indices. Marks must be all zero, and are left that way
+  void addTraceStep(RunTrace& trace, const vector<int>& stateIds, const vector<char>& isFinal,
+                    const vector<int>& previous, const vector<int>& current, int end, vector<char>& marks) {
+    for (int state : previous) {
+      marks[state] |= 1;
+    }
+    for (int state : current) {
+      marks[state] |= 2;
+    }
+    vector<int> entered, left;
+    bool accepted = false;
+    for (int state : current) {
+      if (marks[state] == 2) {
+        entered.push_back(stateIds[state]);
       }
+      accepted = accepted || isFinal[state];
     }
-    return set<int> { currentState };
+    for (int state : previous) {
+      if (marks[state] == 1) {
+        left.push_back(stateIds[state]);
+      }
+      marks[state] = 0;
+    }
+    for (int state : current) {
+      marks[state] = 0;
+    }
+    sort(entered.begin(), entered.end());
+    sort(left.begin(), left.end());
+    trace.Ends.push_back(end);
+    trace.Entered.push_back(entered);
+    trace.Left.push_back(left);
+    trace.Accepted.push_back(accepted);
   }
 
-  set<int> runNFA(NFA oldNfa, string word) {
-    MathmaticalNFA nfa(oldNfa);
+  RunTrace traceRun(const NFA& nfa, const string& word) {
+    TRACE_SPAN("traceRun");
+    // Each step only looks at the states active before and after it, so the whole trace costs one run of the word
+    RunTrace trace;
+    vector<int> symbols;
+    vector<int> previous;
+    vector<int> current;
+    if (nfa.IsDfa) {
+      shared_ptr<const CompiledDFA> model = compiledAutomata().dfa(nfa); // Shares the model runDFA caches
+      const CompiledDFA& dfa = *model;
+      bool tokenized = dfa.Symbols.tokenize(word, symbols); // Keeps the tokens before any unknown part
+      vector<char> marks(dfa.StateIds.size(), 0);
+      current = { dfa.Start };
+      addTraceStep(trace, dfa.StateIds, dfa.IsFinal, previous, current, 0, marks);
+      int end = 0;
+      for (int symbol : symbols) {
+        previous.swap(current);
+        current.clear();
+        int next = previous.empty() ? -1 : dfa.Table[previous[0] * dfa.numSymbols() + symbol];
+        if (next != -1) {
+          current.push_back(next);
+        }
+        end += dfa.Symbols.example(symbol).size();
+        addTraceStep(trace, dfa.StateIds, dfa.IsFinal, previous, current, end, marks);
+      }
+      if (!tokenized) {
+        addTraceStep(trace, dfa.StateIds, dfa.IsFinal, current, {}, word.size(), marks);
+      }
+      return trace;
+    }
 
-    set<int> currentStates = { nfa.StartState };
-    for (char character : word) {
-      string characterString(1, character); // Must have character as a string not a char
-      set<int> newStates = {};
-      for (int currentState : currentStates) {
-        set<int> epsilonClosure = nfa.TransitionTable[currentState]["ε"];
-        for (int epsilonState : epsilonClosure) {
-          newStates = setUnion(newStates, nfa.TransitionTable[epsilonState][characterString]); // No need to check if transition exists, default value would be {} which is the desired outcome
+    shared_ptr<const CompiledNFA> model = compiledAutomata().nfa(nfa);
+    const CompiledNFA& compiled = *model;
+    bool tokenized = compiled.Symbols.tokenize(word, symbols);
+    vector<char> marks(compiled.StateIds.size(), 0);
+    vector<char> added(compiled.StateIds.size(), 0);
+    current = compiled.StartStates;
+    addTraceStep(trace, compiled.StateIds, compiled.IsFinal, previous, current, 0, marks);
+    int end = 0;
+    for (int symbol : symbols) {
+      previous.swap(current);
+      current.clear();
+      for (int state : previous) {
+        int cell = state * compiled.numSymbols() + symbol;
+        for (int i = compiled.Offsets[cell]; i < compiled.Offsets[cell + 1]; i++) {
+          if (!added[compiled.Targets[i]]) {
+            added[compiled.Targets[i]] = 1;
+            current.push_back(compiled.Targets[i]);
+          }
         }
       }
-      currentStates = newStates;
+      for (int state : current) {
+        added[state] = 0;
+      }
+      end += compiled.Symbols.example(symbol).size();
+      addTraceStep(trace, compiled.StateIds, compiled.IsFinal, previous, current, end, marks);
     }
-    // Perform one final epsilon closure
-    set<int> resultingStates;
-    for (int currentState : currentStates) {
-      resultingStates = setUnion(resultingStates, nfa.TransitionTable[currentState]["ε"]);
+    if (!tokenized) {
+      addTraceStep(trace, compiled.StateIds, compiled.IsFinal, current, {}, word.size(), marks);
     }
-    return resultingStates;
+    return trace;
   }
 
   int validateNFA(NFA nfa) {
-    int numStartStates = 0;
-    vector<string> names; // Stores all names from states when checking for duplicate
+    return analyzeNFA(nfa).ValidationCode;
+  }
+
+  bool checkIfDFA(NFA oldNfa) {
+    return analyzeNFA(oldNfa).IsDfa;
+  }
+
+  NFAAnalysis analyzeNFA(NFA nfa) {
+    TRACE_SPAN("analyzeNFA");
+    NFAAnalysis analysis;
+
+    // States, checking for duplicate names
+    unordered_map<int, int> indices;
+    vector<int> ids;
+    vector<char> isStart;
+    vector<char> isFinal;
+    unordered_set<string> names;
     for (State state : nfa.States) {
-      if (find(names.begin(), names.end(), state.Name) != names.end()) {
-        return 1; // Duplicate state name
+      if (!names.insert(state.Name).second) {
+        analysis.DuplicateNames.push_back(state.Name);
+      }
+      if (indices.insert(make_pair(state.Id, (int)ids.size())).second) {
+        ids.push_back(state.Id);
+        isStart.push_back(state.IsStart);
+        isFinal.push_back(state.IsFinal);
       }
-      names.push_back(state.Name);
       if (state.IsStart) {
-        numStartStates++;
+        analysis.NumStartStates++;
       }
     }
-    if (numStartStates != 1) {
-      return 2; // Wrong number of start states
-    }
-    vector<Transition> checkedTransitions;
+    int numStates = ids.size(); // Only states that exist, transitions may still refer to others
+
+    // Transitions, checking for duplicates and counting the symbols leaving each state
+    unordered_map<string, int> symbols;
+    unordered_set<uint64_t> seenTransitions;
+    unordered_map<uint64_t, int> stateSymbolTargets; // Number of different targets for each state and symbol
+    vector<int> distinctSymbols(numStates, 0); // Number of different symbols leaving each state
+    vector<pair<int, int>> edges; // Start and end index of each non duplicate transition
+    bool hasMultipleTargets = false;
+    bool hasClasses = false;
     for (Transition transition : nfa.Transitions) {
-      for (Transition checkedTransition : checkedTransitions) {
-        if (checkedTransition.Start == transition.Start && checkedTransition.End == transition.End && checkedTransition.Token == transition.Token) {
-          return 3; // Duplicate transition
+      int endpoints[2] = { transition.Start, transition.End };
+      for (int endpoint : endpoints) {
+        if (indices.insert(make_pair(endpoint, (int)ids.size())).second) {
+          ids.push_back(endpoint);
+          isStart.push_back(false);
+          isFinal.push_back(false);
         }
       }
-      checkedTransitions.push_back(transition);
-    }
-    return 0; // NFA is valid
-  }
+      int start = indices[transition.Start];
+      int end = indices[transition.End];
 
-  bool checkIfDFA(NFA oldNfa) {
-    // Start with checking for any epsilon transitions. If an epsilon transition to itself exists it will go undetected once converted to MathmaticalNFA
-    for (Transition transition : oldNfa.Transitions) {
+      int symbol = -1; // Epsilon
       if (transition.Token == "ε") {
-        return false;
+        analysis.HasEpsilonTransitions = true;
+      } else {
+        auto inserted = symbols.insert(make_pair(transition.Token, (int)symbols.size()));
+        if (inserted.second) {
+          analysis.Alphabet.push_back(transition.Token);
+          CharacterClass characterClass;
+          hasClasses = hasClasses || parseCharacterClass(transition.Token, characterClass);
+        }
+        symbol = inserted.first->second;
+      }
+
+      // Pack start, end and symbol into one key. Symbols are bounded by the number of transitions
+      uint64_t numKeys = nfa.Transitions.size() + 1;
+      uint64_t stateSymbolKey = (uint64_t)start * numKeys + (symbol + 1);
+      uint64_t transitionKey = stateSymbolKey * (2 * numKeys + nfa.States.size()) + end;
+      if (!seenTransitions.insert(transitionKey).second) {
+        analysis.DuplicateTransitions.push_back(transition.Id);
+        continue;
+      }
+      edges.push_back(make_pair(start, end));
+      if (symbol != -1 && start < numStates) {
+        int targets = ++stateSymbolTargets[stateSymbolKey];
+        if (targets == 1) {
+          distinctSymbols[start]++;
+        } else {
+          hasMultipleTargets = true;
+        }
       }
     }
 
-    MathmaticalNFA nfa(oldNfa);
-    for (int state : nfa.States) {
-      for (string token : nfa.Alphabet) {
-        if (nfa.TransitionTable[state][token].size() != 1) { // There should be exactly 1 transition for each token from each state for a DFA
-          return false;
+    if (!analysis.DuplicateNames.empty()) {
+      analysis.ValidationCode = 1; // Duplicate state name
+    } else if (analysis.NumStartStates != 1) {
+      analysis.ValidationCode = 2; // Wrong number of start states
+    } else if (!analysis.DuplicateTransitions.empty()) {
+      analysis.ValidationCode = 3; // Duplicate transition
+    }
+
+    analysis.IsComplete = true;
+    for (int state = 0; state < numStates; state++) {
+      if (distinctSymbols[state] != symbols.size()) {
+        analysis.IsComplete = false;
+      }
+    }
+    if (hasClasses) {
+      // Classes can overlap each other and single byte tokens, so targets are compared on the symbols they split into
+      Tokenizer alphabet(getSymbols(nfa.Transitions));
+      int numSymbols = alphabet.Tokens.size();
+      vector<int> targets((size_t)numStates * numSymbols, -1);
+      vector<int> coveredSymbols(numStates, 0);
+      vector<int> transitionSymbols;
+      hasMultipleTargets = false;
+      for (Transition transition : nfa.Transitions) {
+        int start = indices[transition.Start];
+        int end = indices[transition.End];
+        if (transition.Token == "ε" || start >= numStates) {
+          continue;
+        }
+        alphabet.symbolIds(transition.Token, transitionSymbols);
+        for (int symbol : transitionSymbols) {
+          int& target = targets[(size_t)start * numSymbols + symbol];
+          if (target == -1) {
+            target = end;
+            coveredSymbols[start]++;
+          } else if (target != end) {
+            hasMultipleTargets = true;
+          }
         }
       }
+      analysis.IsComplete = true;
+      for (int state = 0; state < numStates; state++) {
+        analysis.IsComplete = analysis.IsComplete && coveredSymbols[state] == numSymbols;
+      }
     }
-    return true;
+    // There should be exactly 1 transition for each token from each state for a DFA
+    analysis.IsDfa = analysis.IsComplete && !hasMultipleTargets && !analysis.HasEpsilonTransitions;
+
+    // Compact forward and backward adjacency, grouped by state with a counting sort
+    int numNodes = ids.size();
+    vector<int> forwardOffsets(numNodes + 1, 0);
+    vector<int> backwardOffsets(numNodes + 1, 0);
+    for (pair<int, int> edge : edges) {
+      forwardOffsets[edge.first + 1]++;
+      backwardOffsets[edge.second + 1]++;
+    }
+    for (int node = 0; node < numNodes; node++) {
+      forwardOffsets[node + 1] += forwardOffsets[node];
+      backwardOffsets[node + 1] += backwardOffsets[node];
+    }
+    vector<int> forwardTargets(edges.size());
+    vector<int> backwardTargets(edges.size());
+    vector<int> forwardFill(forwardOffsets.begin(), forwardOffsets.end() - 1);
+    vector<int> backwardFill(backwardOffsets.begin(), backwardOffsets.end() - 1);
+    for (pair<int, int> edge : edges) {
+      forwardTargets[forwardFill[edge.first]++] = edge.second;
+      backwardTargets[backwardFill[edge.second]++] = edge.first;
+    }
+
+    // Search forwards from the start states and backwards from the final states
+    for (int direction = 0; direction < 2; direction++) {
+      vector<int>& offsets = direction == 0 ? forwardOffsets : backwardOffsets;
+      vector<int>& targets = direction == 0 ? forwardTargets : backwardTargets;
+      vector<char>& sources = direction == 0 ? isStart : isFinal;
+      set<int>& result = direction == 0 ? analysis.ReachableStates : analysis.CoReachableStates;
+
+      vector<char> visited(numNodes, 0);
+      vector<int> remaining;
+      for (int node = 0; node < numNodes; node++) {
+        if (sources[node]) {
+          visited[node] = 1;
+          remaining.push_back(node);
+        }
+      }
+      while (!remaining.empty()) {
+        int current = remaining.back();
+        remaining.pop_back();
+        result.insert(ids[current]);
+        for (int i = offsets[current]; i < offsets[current + 1]; i++) {
+          if (!visited[targets[i]]) {
+            visited[targets[i]] = 1;
+            remaining.push_back(targets[i]);
+          }
+        }
+      }
+    }
+
+    return analysis;
   }
 }
\ No newline at end of file
@@ -5,12 +5,42 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <tuple>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <array>
+#include <sstream>
+#include <fstream>
+#include <limits>
+#include <cstdint>
+#include <random>
 
 #include <opencv2/opencv.hpp>
 
 using namespace std;
 using namespace cv;
 
+// Tracing is compiled in only when MAINCODE_TRACING is defined (e.g. -DMAINCODE_TRACING). Otherwise these do nothing and
+// their arguments are never evaluated. Names must be string literals
+#ifdef MAINCODE_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) mainCode::TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name) // Times the rest of the enclosing scope
+#define TRACE_COUNTER(name, value) mainCode::traceCounter(name, value)
+#else
+#define TRACE_SPAN(name) do {} while (0)
+#define TRACE_COUNTER(name, value) do {} while (0)
+#endif
+
 namespace mainCode {
 
   // ==================================
@@ -73,6 +103,445 @@ namespace mainCode {
       MathmaticalNFA(NFA nfa);
   };
 
+  enum class JSONType {
+    Null,
+    Boolean,
+    Number,
+    String,
+    Array,
+    Object
+  };
+
+  // Value read from JSON text
+  class JSONValue {
+    public:
+      JSONType Type;
+      bool BooleanValue;
+      double NumberValue;
+      string StringValue;
+      vector<JSONValue> Elements; // Arrays only
+      map<string, JSONValue> Members; // Objects only
+
+      JSONValue();
+      bool has(const string& key) const;
+      const JSONValue& operator[](const string& key) const; // Throws if there is no such member
+  };
+
+  // Every structural property of an NFA, found in a single pass over its states and transitions
+  class NFAAnalysis {
+    public:
+      int ValidationCode; // Same codes as validateNFA
+      vector<string> DuplicateNames;
+      vector<int> DuplicateTransitions; // Ids of transitions that repeat an earlier one
+      int NumStartStates;
+      bool HasEpsilonTransitions;
+      bool IsDfa;
+      bool IsComplete; // Every state has a transition for every symbol
+      set<int> ReachableStates; // States that can be reached from a start state
+      set<int> CoReachableStates; // States that can reach a final state
+      vector<string> Alphabet; // Symbols that can be read, not including epsilon
+
+      NFAAnalysis();
+      string convertToJSON(bool testing);
+  };
+
+  // Active states after every prefix of a word, stored as the changes between steps. Step 0 is the empty prefix,
+  // and each later step reads one more token. If part of the word is not in the alphabet, the last step reads the rest and has no states
+  class RunTrace {
+    public:
+      vector<int> Ends; // Number of characters read after each step
+      vector<vector<int>> Entered; // Ids of states that became active at each step
+      vector<vector<int>> Left; // Ids of states that stopped being active at each step
+      vector<char> Accepted; // Whether each prefix is accepted
+
+      int numSteps() const;
+      set<int> activeStates(int step) const; // Replays the changes up to the step
+      string convertToJSON(bool testing);
+  };
+
+  // NFA that keeps its validity and determinism up to date as single edits are applied,
+  // so each edit only costs as much as the number of transitions on the states it touches
+  class EditableNFA {
+    public:
+      EditableNFA(NFA nfa);
+      void addState(State state);
+      void updateState(State state); // Rename, or change whether it is start or final
+      void removeState(int id); // Also removes every transition to or from it
+      void addTransition(Transition transition);
+      void updateTransition(Transition transition);
+      void removeTransition(int id);
+
+      int validationCode() const; // Same codes as validateNFA
+      bool isDfa() const;
+      bool isComplete() const;
+      int numStartStates() const;
+      int outDegree(int id) const;
+      NFA toNFA() const;
+      string summaryToJSON() const;
+
+    private:
+      map<int, State> States;
+      map<int, Transition> Transitions;
+      unordered_map<int, unordered_set<int>> Incident; // Ids of transitions to or from each state
+      unordered_map<int, int> OutDegrees;
+      unordered_map<int, int> DistinctSymbols; // Number of different symbols leaving each state
+      unordered_map<int, int> SymbolHistogram; // Number of states with each count of different symbols
+      unordered_map<string, int> NameCounts;
+      unordered_map<string, int> TransitionCounts; // Copies of each start, end and token combination
+      unordered_map<string, int> TargetCounts; // Different targets for each start and token combination
+      unordered_map<string, int> SymbolCounts; // Different transitions using each token
+      int DuplicateNames;
+      int DuplicateTransitions;
+      int StartStates;
+      int EpsilonTransitions;
+      int MultipleTargets; // Start and token combinations with more than one target
+      int AlphabetSize;
+      int ClassTokens; // Character classes in the alphabet. Classes can overlap, so with any of them isDfa and isComplete re-analyse the structure
+
+      void changeDistinctSymbols(int id, int change);
+      NFA structure() const; // Current states and transitions, without working out IsDfa
+  };
+
+  // Set of bytes written as a token such as [a-z0-9_] or [^,], which reads any one of them.
+  // Ranges and single bytes may be escaped with a backslash, and \xHH gives a byte by its hex code
+  class CharacterClass {
+    public:
+      array<uint64_t, 4> Bytes;
+
+      CharacterClass();
+      bool contains(unsigned char byte) const;
+      void add(unsigned char byte);
+      int size() const;
+      string toToken() const; // Parses back to the same class, or is just the byte when there is only one
+  };
+
+  // Splits words into the tokens of an alphabet, always taking the longest matching token.
+  // Character classes read a single byte, so they should not overlap each other or single byte tokens
+  class Tokenizer {
+    public:
+      vector<string> Tokens; // The position of a token is its symbol id
+
+      Tokenizer(vector<string> tokens);
+      Tokenizer();
+      int symbolId(const string& token) const; // For a class, the symbol containing all of its bytes
+      void symbolIds(const string& token, vector<int>& ids) const; // Every symbol a transition token reads, as symbols may split a class
+      const string& example(int symbol) const; // Text read as the symbol, the first byte for a class
+      void letters(int symbol, vector<string>& texts) const; // Every text read as the symbol, one byte each for a class
+      bool tokenize(const string& word, vector<int>& symbols) const;
+
+    private:
+      vector<string> Examples;
+      vector<int> ByteSymbols; // Symbol of the single byte token or class containing each byte, or -1
+      vector<int> RootChildren; // Lookup table for the first byte of each token
+      vector<int> NodeSymbols; // Symbol id of the token ending at each trie node, or -1
+      vector<vector<pair<unsigned char, int>>> NodeChildren;
+
+      int child(int node, unsigned char byte) const;
+  };
+
+  // Run loop over a DFA transition table. CompiledDFA picks the narrowest state type that fits and fixes
+  // the number of columns at compile time for small alphabets. Undefined transitions lead to an extra dead state
+  class DFAKernelBase {
+    public:
+      virtual ~DFAKernelBase() {}
+      virtual int run(const vector<int>& symbols, int start) const = 0; // Index of the last state, or -1 if a transition was undefined
+      virtual size_t tableBytes() const = 0;
+      virtual string name() const = 0;
+  };
+
+  template <typename StateType, int NumSymbols> // NumSymbols is 0 when the column count is only known at run time
+  class DFAKernel : public DFAKernelBase {
+    public:
+      DFAKernel(const vector<int>& table, int numStates, int numSymbols); // Table as in CompiledDFA
+      int run(const vector<int>& symbols, int start) const override;
+      size_t tableBytes() const override;
+      string name() const override;
+
+    private:
+      vector<StateType> Table;
+      int Columns;
+      StateType Dead;
+  };
+
+  // Layouts for CompiledDFA::reorder
+  enum class StateOrder {
+    BreadthFirst, // From the start state, taking symbols in order
+    DepthFirst,
+    Profile // Most visited states of sample runs first, then the rest breadth first
+  };
+
+  // Compact DFA using state indices and symbol ids rather than names
+  class CompiledDFA {
+    public:
+      vector<int> StateIds; // Original id of each state index
+      vector<char> IsFinal;
+      Tokenizer Symbols;
+      vector<int> Table; // Row per state, column per symbol, -1 if the transition is undefined
+      int Start;
+      shared_ptr<const DFAKernelBase> Kernel; // Narrow copy of Table used by run
+
+      CompiledDFA(NFA dfa);
+      int numSymbols() const;
+      set<int> run(const string& word) const;
+      void reorder(StateOrder order, const vector<string>& sampleWords = {}); // Renumbers state indices so states used together are close in Table
+  };
+
+  // Unsigned integer of any size, so counts of words stay exact
+  class BigCount {
+    public:
+      vector<uint32_t> Limbs; // Least significant first, without leading zero limbs
+
+      BigCount(uint64_t value = 0);
+      BigCount& operator+=(const BigCount& other);
+      BigCount& operator-=(const BigCount& other); // Other must not be larger
+      BigCount operator*(uint32_t factor) const;
+      bool operator<(const BigCount& other) const;
+      bool operator==(const BigCount& other) const;
+      bool isZero() const;
+      string toString() const;
+  };
+
+  class AcceptedWordIterator;
+
+  // Questions about the words a DFA accepts, answered on its compact table. Words are over the DFA's own alphabet,
+  // returned as their letters joined together, and an undefined transition rejects. A letter is a token, or a
+  // single byte of a character class, so a class symbol counts once for each byte it reads
+  class DFALanguage {
+    public:
+      CompiledDFA Dfa;
+      vector<string> Letters; // In byte order
+      vector<int> LetterSymbols; // Symbol read by each letter
+
+      DFALanguage(NFA dfa);
+      vector<BigCount> countWords(int maxLength) const; // Accepted words of each length from 0 to maxLength
+      vector<uint64_t> countWords(int maxLength, uint64_t modulus) const;
+      uint64_t countWordsOfLength(uint64_t length, uint64_t modulus) const; // Squares the transition matrix, for lengths too long to step through
+      bool isFinite() const;
+      AcceptedWordIterator acceptedWords() const; // In shortlex order, with letters in byte order
+      vector<string> sampleAccepted(int length, int count, uint64_t seed) const; // Uniformly random, empty if no word of the length is accepted
+      bool shortestAccepted(string& word) const; // Shortlex first, false if no word is accepted
+      bool shortestRejected(string& word) const; // Shortlex first, false if every word is accepted
+
+    private:
+      friend class AcceptedWordIterator;
+
+      vector<uint32_t> SymbolWeights; // Number of letters reading each symbol
+
+      string joinLetters(const vector<int>& letters) const;
+      bool shortestWord(bool accepted, string& word) const;
+  };
+
+  // Streams the accepted words of a DFALanguage, which must outlive the iterator
+  class AcceptedWordIterator {
+    public:
+      AcceptedWordIterator(const DFALanguage& language);
+      bool next(string& word); // False once every word has been returned, which never happens for infinite languages
+
+    private:
+      const DFALanguage& Language;
+      int MaxLength; // Longest accepted word when the language is finite, otherwise -1
+      int Length; // Length of the words being returned
+      bool InLength; // Whether Path holds the last word returned of this length
+      vector<vector<char>> CanAccept; // Whether some word of each length is accepted from each state
+      vector<int> Path; // States after each letter of the current word, starting with the start state
+      vector<int> Letters;
+
+      bool extend(int firstLetter); // Adds the smallest useful letter from firstLetter onwards
+      bool completeWord(); // Extends the current word with the smallest letters until it has Length letters
+  };
+
+  // Compact epsilon-free NFA, where each successor list already includes epsilon closures
+  class CompiledNFA {
+    public:
+      vector<int> StateIds; // Original id of each state index
+      vector<char> IsFinal;
+      Tokenizer Symbols;
+      int Start; // Index of the start state
+      vector<int> StartStates; // Epsilon closure of the start state
+      vector<char> ClosureIsFinal; // Whether the epsilon closure of each state contains a final state
+      vector<int> Offsets; // Successors of state s on symbol a are Targets[Offsets[s * numSymbols + a]] up to the next offset
+      vector<int> Targets;
+
+      CompiledNFA(NFA nfa);
+      CompiledNFA(NFA nfa, vector<string> symbols); // Symbols must split every token of the NFA, as getSymbols does
+      int numSymbols() const;
+      set<int> run(const string& word) const;
+  };
+
+  // Hash of a subset of states stored as a bitset
+  struct BitsetHash {
+    size_t operator()(const vector<uint64_t>& bitset) const;
+  };
+
+  // Determinizes a CompiledNFA on the fly while running words, caching each discovered subset as a DFA state
+  class LazyDFA {
+    public:
+      CompiledNFA Nfa;
+      size_t MaxBytes; // Cache is flushed once its estimated size goes over this
+      long Hits; // Transitions taken from the cache
+      long Misses; // Transitions that had to be computed from the NFA
+      long Flushes;
+
+      LazyDFA(NFA nfa, size_t maxBytes = 16 << 20);
+      set<int> run(const string& word);
+      bool accepts(const string& word);
+      int numCachedStates() const;
+      size_t cacheBytes() const;
+      void clearCache();
+
+      // Step through states one symbol at a time. State numbers are only valid until the cache is flushed
+      int startState();
+      int nextState(int state, int symbol);
+      bool isFinalState(int state) const;
+
+    private:
+      int BitsetWords; // Number of 64 bit words needed for a subset of NFA states
+      int Start; // Cached index of the start subset, -1 if not cached
+      vector<uint64_t> Sets; // Subset of every cached state, BitsetWords per state
+      vector<char> SetIsFinal;
+      vector<int> Transitions; // Row per cached state, column per symbol, -1 if not yet discovered
+      unordered_map<vector<uint64_t>, int, BitsetHash> Ids;
+
+      int addState(const vector<uint64_t>& subset);
+      int runFromStart(const vector<int>& symbols);
+  };
+
+  // Least recently used cache of operation results, keyed by the canonical form of the input NFA
+  class ResultCache {
+    public:
+      size_t MaxBytes; // Least recently used results are evicted once the cache is bigger than this. Change with setMaxBytes
+      long Hits;
+      long Misses;
+      long Evictions;
+
+      ResultCache(size_t maxBytes = 8 << 20);
+      NFA getOrCompute(NFA nfa, string operation, NFA (*compute)(NFA));
+      string keyFor(NFA nfa, string operation);
+      bool lookup(const string& key, NFA& result); // Counts as a hit or a miss
+      void store(const string& key, NFA result);
+      void setMaxBytes(size_t maxBytes); // Evicts straight away if the cache is now too big
+      size_t bytes() const;
+      void clear();
+      string statisticsToJSON();
+
+    private:
+      struct Entry {
+        string Key;
+        NFA Result;
+        size_t Bytes;
+      };
+
+      list<Entry> Entries; // Most recently used at the front
+      unordered_map<string, list<Entry>::iterator> Index;
+      size_t TotalBytes;
+      mutable mutex Lock;
+
+      void evict(); // Must hold the lock
+  };
+
+  // Least recently used cache of compiled models, so running many words on one structure only compiles it once.
+  // Keyed by the exact structure, ids included, since runs return state ids
+  class CompiledAutomatonCache {
+    public:
+      size_t MaxEntries;
+      long Hits;
+      long Misses;
+      size_t LazyMaxBytes; // Limit on each LazyDFA's own cache
+      long LazyHits; // Totals of every lazy run, including those on evicted models
+      long LazyMisses;
+      long LazyFlushes;
+
+      CompiledAutomatonCache(size_t maxEntries = 8, size_t lazyMaxBytes = 4 << 20);
+      shared_ptr<const CompiledDFA> dfa(const NFA& nfa); // Compiles on a miss, outside the lock
+      shared_ptr<const CompiledNFA> nfa(const NFA& nfa);
+      set<int> runLazily(const NFA& nfa, const string& word); // On a LazyDFA kept with the structure, one run at a time
+      size_t size();
+      void clear();
+      string statisticsToJSON();
+
+    private:
+      struct LockedLazyDFA {
+        mutex Lock; // Running changes the LazyDFA's cache
+        LazyDFA Dfa;
+
+        LockedLazyDFA(const NFA& nfa, size_t maxBytes): Dfa(nfa, maxBytes) {}
+      };
+
+      struct Entry {
+        uint64_t Hash;
+        NFA Structure;
+        shared_ptr<const CompiledDFA> Dfa; // Each model is only compiled once it is asked for
+        shared_ptr<const CompiledNFA> Nfa;
+        shared_ptr<LockedLazyDFA> Lazy;
+      };
+
+      list<Entry> Entries; // Most recently used at the front
+      mutex Lock;
+
+      list<Entry>::iterator find(const NFA& nfa, uint64_t hash); // Moves a found entry to the front, must hold the lock
+      list<Entry>::iterator insert(const NFA& nfa, uint64_t hash); // Must hold the lock
+  };
+
+  // Result of comparing the languages of two structures
+  class EquivalenceResult {
+    public:
+      bool Equivalent;
+      vector<string> Counterexample; // Shortest word, as tokens, accepted by exactly one of the structures
+
+      EquivalenceResult(bool equivalent, vector<string> counterexample);
+      string convertToJSON(bool testing);
+  };
+
+  // Result of checking whether one language contains another
+  class InclusionResult {
+    public:
+      bool Included;
+      vector<string> Counterexample; // Shortest word, as tokens, in the first language but not the second
+
+      InclusionResult(bool included, vector<string> counterexample);
+      string convertToJSON(bool testing);
+  };
+
+  // Lets another thread stop a long running operation
+  class CancellationToken {
+    public:
+      CancellationToken();
+      void cancel();
+      bool isCancelled() const;
+
+    private:
+      atomic<bool> Cancelled;
+  };
+
+  // Limits on the work done by a conversion, where 0 means no limit
+  class ConversionBudget {
+    public:
+      size_t MaxStates; // Subsets discovered by the subset construction
+      size_t MaxBytes; // Estimated memory used by the conversion, from reduction through to minimisation
+      long MaxMilliseconds;
+
+      ConversionBudget(size_t maxStates = 0, size_t maxBytes = 0, long maxMilliseconds = 0);
+      string exceededLimit(size_t states, size_t bytes, long milliseconds, const CancellationToken* cancellation) const; // Empty if within budget
+  };
+
+  // Called between rounds of a bounded stage with the bytes the stage holds. Returns the exceeded limit, or empty to carry on
+  typedef function<string(size_t bytes)> BudgetCheck;
+
+  // Result of a conversion that may have been stopped early, with statistics about the work done
+  class ConversionResult {
+    public:
+      bool Completed;
+      string ExceededLimit; // "states", "bytes", "time" or "cancelled", empty if completed
+      NFA Dfa; // Only has states if completed
+      int StatesDiscovered;
+      int FrontierSize; // Subsets discovered but not yet expanded
+      size_t Bytes;
+      long Milliseconds;
+
+      ConversionResult(bool completed, string exceededLimit, NFA dfa, int statesDiscovered, int frontierSize, size_t bytes, long milliseconds);
+      string convertToJSON(bool testing);
+  };
+
   class Circle {
     public:
       cv::Point Center;
@@ -100,12 +569,173 @@ namespace mainCode {
       Arrow(cv::Point tip, cv::Point tail);
   };
 
+  enum class ContourType {
+    Other,
+    Circle,
+    Arrow
+  };
+
+  // What a single contour of a photo was classified as
+  class ContourShape {
+    public:
+      ContourType Type;
+      cv::Point2f Center; // Circles only
+      float Radius;
+      cv::Point Tip; // Arrows only
+      cv::Point Tail;
+
+      ContourShape();
+  };
+
+  // Images reused by one thread while classifying contours, so each contour does not allocate its own
+  class ContourBuffers {
+    public:
+      Mat Drawing;
+      Mat EndPoints;
+      vector<Point> Hull;
+      vector<Point> EndPointList;
+  };
+
+  // Images reused by every iteration of thinning
+  class ThinningBuffers {
+    public:
+      Mat Marker;
+      Mat Previous;
+      Mat Difference;
+  };
+
+  // Receives the name of the current stage of photoToNFA and how far through the whole run it is, from 0 to 100
+  typedef function<void(string stage, int percentage)> ProgressCallback;
+
+  // Everything one photo needs while it is turned into an NFA. Images and vectors are kept for the next photo and only
+  // reallocated when it is bigger, so back to back photos barely allocate. A pipeline runs one photo at a time, but
+  // separate pipelines can run on separate threads
+  class PhotoPipeline {
+    public:
+      PhotoPipeline();
+      string run(string path, bool testing, const CancellationToken* cancellation = nullptr, ProgressCallback progress = nullptr); // Returns "Cancelled" if cancelled
+      string lastLog() const; // Debug output from the last run, only written when testing
+
+    private:
+      vector<uchar> FileBytes;
+      Mat Decoded;
+      Mat Resized;
+      Mat Gray;
+      Mat Blurred;
+      Mat Binary;
+      ThinningBuffers Thinning;
+      vector<vector<Point>> Contours;
+      vector<ContourShape> Shapes;
+      mutex ContourBuffersMutex;
+      vector<ContourBuffers> SpareContourBuffers; // Left by threads that have finished classifying
+      vector<Circle> DetectedCircles;
+      vector<Arrow> DetectedArrows;
+      vector<StateCircle> StateCircles;
+      vector<Circle> CirclesToSkip;
+      vector<State> States;
+      vector<Transition> Transitions;
+      Mat Res; // Images showing what was detected, only drawn when testing
+      Mat CircleRes;
+      Mat ArrowRes;
+      Mat ContourRes;
+      RNG Rng;
+      ostringstream Log;
+
+      ContourBuffers borrowContourBuffers();
+      void returnContourBuffers(ContourBuffers& buffers);
+  };
+
+  // Pipelines kept between photos, so back to back photos reuse their buffers without every thread holding one.
+  // Photos processed at the same time each borrow their own pipeline, and at most MaxIdle are kept once returned
+  class PhotoPipelinePool {
+    public:
+      PhotoPipelinePool(size_t maxIdle = 1);
+      unique_ptr<PhotoPipeline> acquire();
+      void release(unique_ptr<PhotoPipeline> pipeline);
+      size_t numIdle();
+
+    private:
+      mutex Mutex;
+      size_t MaxIdle;
+      vector<unique_ptr<PhotoPipeline>> Idle;
+  };
+
+  // Boolean operations on languages, built from the product of two structures
+  enum class ProductOperation {
+    Intersection,
+    Union,
+    Difference // In the first language but not the second
+  };
+
+  // One span or counter sample recorded by the tracing macros
+  class TraceEvent {
+    public:
+      const char* Name; // Always a string literal, so it outlives the event
+      char Phase; // 'X' for a span, 'C' for a counter, as in Chrome's trace_event format
+      int64_t Timestamp; // Microseconds since the first event
+      int64_t Duration; // Spans only
+      double Value; // Counters only
+  };
+
+  // Ring of the events recorded by one thread. Only that thread writes to it, so recording never takes a lock.
+  // Once full, the oldest events are overwritten. Once its thread exits, the buffer is reused by the next new thread
+  class TraceBuffer {
+    public:
+      static const int Capacity = 1 << 14;
+      int ThreadId; // Trace track of the buffer, shared by the threads that reuse it
+
+      TraceBuffer(int threadId);
+      void record(const TraceEvent& event);
+      vector<TraceEvent> snapshot() const; // Leaves out any event overwritten while it was being read
+
+    private:
+      // Fields are atomic so reading while the owner writes is safe. The sequence says which event the slot holds
+      struct Slot {
+        atomic<uint64_t> Sequence; // 2 * (index + 1) once event index is written, odd while it is being written
+        atomic<const char*> Name;
+        atomic<char> Phase;
+        atomic<int64_t> Timestamp;
+        atomic<int64_t> Duration;
+        atomic<double> Value;
+      };
+
+      unique_ptr<Slot[]> Slots;
+      atomic<uint64_t> Head; // Number of events ever recorded
+  };
+
+  // Records how long it lived as a span
+  class TraceSpan {
+    public:
+      TraceSpan(const char* name);
+      ~TraceSpan();
+
+    private:
+      const char* Name;
+      int64_t Start;
+  };
+
   // ==================================
   // ===== ** Helper Functions ** =====
   // ==================================
   void printVector(string name, vector<int> list);
   void printSet(string name, set<int> set);
   string boolToString(bool x);
+  string intsToJSON(vector<int> list);
+  string intsToJSON(set<int> list);
+  string stringsToJSON(vector<string> list);
+  string escapeJSON(string text);
+  JSONValue parseJSON(const string& text);
+  JSONValue parseJSONValue(const string& text, size_t& position);
+  const JSONValue& jsonMember(const JSONValue& object, const string& key, JSONType type); // Throws invalid_argument if missing or another type
+  int jsonInt(const JSONValue& object, const string& key); // Also throws if the number is not a whole int
+  uint64_t mixHash(uint64_t hash, uint64_t value);
+  void parallelFor(int count, int threads, const function<void(int, int)>& body);
+  int64_t traceMicroseconds();
+  TraceBuffer& traceBuffer(); // This thread's buffer
+  int numTraceBuffers(); // At most the number of threads that have been tracing at the same time
+  void traceCounter(const char* name, double value);
+  void clearTrace(); // Later exports only include events after this
+  string exportChromeTrace(); // Every thread's events as Chrome trace_event JSON, for chrome://tracing or Perfetto
   template <typename T>
   set<T> setIntersection(set<T> set1, set<T> set2);
   template <typename T>
@@ -120,17 +750,58 @@ namespace mainCode {
   set<string> getAlphabet(vector<Transition> transitions);
   int getStartState(vector<State> states);
   set<int> getFinalStates(vector<State> states);
+  vector<string> getSymbols(vector<Transition> transitions);
+  bool parseCharacterClass(const string& token, CharacterClass& result); // False if the token is not a class
+  vector<string> splitIntoSymbols(set<string> tokens);
+  unordered_map<int, int> getStateIndices(vector<State> states);
+  string canonicalForm(NFA nfa);
+  uint64_t canonicalHash(NFA nfa);
+  ResultCache& resultCache();
+  CompiledAutomatonCache& compiledAutomata();
+  uint64_t structureHash(const NFA& nfa); // Changes with any id, unlike canonicalHash
+  bool sameStructure(const NFA& nfa1, const NFA& nfa2); // Ignores names and transition ids
+  PhotoPipelinePool& photoPipelines();
+  vector<string> mergeAlphabets(const Tokenizer& symbols1, const Tokenizer& symbols2);
+  vector<vector<uint64_t>> computeSimulation(const CompiledNFA& nfa);
+  vector<int> coarsestBisimulation(int numStates, const vector<int>& sources, const vector<int>& symbols, const vector<int>& targets, const vector<int>& initialBlocks);
+  string boundedCoarsestBisimulation(int numStates, const vector<int>& sources, const vector<int>& symbols, const vector<int>& targets, const vector<int>& initialBlocks,
+                                     const BudgetCheck& check, vector<int>& blockOf);
+  string boundedReduceNFA(NFA nfa, bool backward, const BudgetCheck& check, NFA& result); // Returns the exceeded limit, leaving result unchanged
+  string boundedSimplifyDFA(NFA oldDfa, int threads, const BudgetCheck& check, NFA& result);
+  size_t bytesPerSubset(const CompiledNFA& nfa);
+  double preprocessPhoto(const Mat& src, Mat& gray, Mat& blurred, Mat& binary);
+  NFA universalNFA(vector<string> alphabet);
+  NFA nfaFromJSON(const string& json);
+  string exploreSubsets(const CompiledNFA& nfa, ConversionBudget budget, const CancellationToken* cancellation, chrono::steady_clock::time_point begin, int threads, vector<vector<uint64_t>>& subsets, vector<int>& table, size_t& frontierSize);
 
   // ==================================
   // = ** Main Exported Functions ** ==
   // ==================================
   NFA simplifyDFA(NFA oldDfa);
+  NFA simplifyDFA(NFA oldDfa, int threads); // 0 threads uses every core
+  NFA reduceNFA(NFA nfa, bool backward = false);
   NFA convertNFAtoDFA(NFA oldNfa);
-  set<int> runDFA(NFA oldDfa, string word);
-  set<int> runNFA(NFA oldNfa, string word);
+  NFA convertNFAtoDFA(NFA oldNfa, int threads); // 0 threads uses every core
+  set<int> runDFA(const NFA& oldDfa, const string& word);
+  set<int> runNFA(const NFA& oldNfa, const string& word, bool lazy = false); // Lazy builds DFA states as the words need them, and keeps them for later runs
+  RunTrace traceRun(const NFA& nfa, const string& word); // Uses the DFA model when IsDfa is set, like runDFA, and the NFA model otherwise
   int validateNFA(NFA nfa);
   bool checkIfDFA(NFA oldNfa);
-  string photoToNFA(string path, bool testing);
+  NFAAnalysis analyzeNFA(NFA nfa);
+  NFA cachedSimplifyDFA(NFA oldDfa);
+  NFA cachedConvertNFAtoDFA(NFA oldNfa);
+  ConversionResult boundedConvertNFAtoDFA(NFA oldNfa, ConversionBudget budget, const CancellationToken* cancellation = nullptr, int threads = 1);
+  ConversionResult cachedBoundedConvertNFAtoDFA(NFA oldNfa, ConversionBudget budget, const CancellationToken* cancellation = nullptr, int threads = 1);
+  EquivalenceResult areEquivalent(NFA nfa1, NFA nfa2);
+  InclusionResult isIncluded(NFA nfa1, NFA nfa2);
+  InclusionResult isUniversal(NFA nfa);
+  NFA productOf(NFA nfa1, NFA nfa2, ProductOperation operation);
+  NFA intersectionOf(NFA nfa1, NFA nfa2);
+  NFA unionOf(NFA nfa1, NFA nfa2);
+  NFA differenceOf(NFA nfa1, NFA nfa2);
+  NFA complementOf(NFA nfa);
+  string photoToNFA(string path, bool testing, const CancellationToken* cancellation = nullptr, ProgressCallback progress = nullptr); // Returns "Cancelled" if cancelled
+  future<string> photoToNFAAsync(string path, shared_ptr<CancellationToken> cancellation, ProgressCallback progress = nullptr);
 }
 
 #endif
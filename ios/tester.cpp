@@ -304,7 +304,7 @@ bool simplifyDFATest() {
   NFA predictedDfa(true, predictedStates, predictedTransitions);
   string predictedResult = predictedDfa.convertToJSON(true);
   string result = simplifyDFA(dfa).convertToJSON(true);
-  bool passed = result == predictedResult;
+  bool passed = result == predictedResult && simplifyDFA(dfa, 4).convertToJSON(true) == predictedResult;
   overralResult = overralResult && passed;
   printOutcome(passed);
 
@@ -330,7 +330,7 @@ bool simplifyDFATest() {
   predictedDfa.Transitions = predictedTransitions;
   predictedResult = predictedDfa.convertToJSON(true);
   result = simplifyDFA(dfa).convertToJSON(true);
-  passed = result == predictedResult;
+  passed = result == predictedResult && simplifyDFA(dfa, 4).convertToJSON(true) == predictedResult;
   overralResult = overralResult && passed;
   printOutcome(passed);
 
@@ -346,7 +346,7 @@ bool simplifyDFATest() {
   predictedDfa.Transitions = predictedTransitions;
   predictedResult = predictedDfa.convertToJSON(true);
   result = simplifyDFA(dfa).convertToJSON(true);
-  passed = result == predictedResult;
+  passed = result == predictedResult && simplifyDFA(dfa, 4).convertToJSON(true) == predictedResult;
   overralResult = overralResult && passed;
   printOutcome(passed);
 
@@ -366,7 +366,7 @@ bool simplifyDFATest() {
   predictedDfa.States = predictedStates;
   predictedResult = predictedDfa.convertToJSON(true);
   result = simplifyDFA(dfa).convertToJSON(true);
-  passed = result == predictedResult;
+  passed = result == predictedResult && simplifyDFA(dfa, 4).convertToJSON(true) == predictedResult;
   overralResult = overralResult && passed;
   printOutcome(passed);
 
@@ -377,7 +377,7 @@ bool simplifyDFATest() {
   predictedDfa = dfa;
   predictedResult = predictedDfa.convertToJSON(true);
   result = simplifyDFA(dfa).convertToJSON(true);
-  passed = result == predictedResult;
+  passed = result == predictedResult && simplifyDFA(dfa, 4).convertToJSON(true) == predictedResult;
   overralResult = overralResult && passed;
   printOutcome(passed);
 
@@ -423,6 +423,12 @@ bool convertNFAtoDFATest() {
   overallResult = overallResult && passed;
   printOutcome(passed);
 
+  cout << "- Normal NFA on several threads: ";
+  result = convertNFAtoDFA(nfa, 4).convertToJSON(true);
+  passed = result == predictedResult;
+  overallResult = overallResult && passed;
+  printOutcome(passed);
+
   cout << "- NFA with unreachable state: ";
   State s4(4, "q4", false, false);
   states = { s0, s1, s2, s3, s4 };
@@ -451,6 +457,91 @@ bool convertNFAtoDFATest() {
   return overallResult;
 }
 
+bool boundedConvertNFAtoDFATest() {
+  bool overallPass = true;
+
+  // Tenth symbol from the end is a 1, which needs 1024 DFA states
+  vector<State> states;
+  vector<Transition> transitions = { Transition(0, 0, 0, "0"), Transition(1, 0, 0, "1"), Transition(2, 0, 1, "1") };
+  for (int i = 0; i <= 10; i++) {
+    states.push_back(State(i, "q" + to_string(i), i == 0, i == 10));
+    if (i > 0 && i < 10) {
+      transitions.push_back(Transition(transitions.size(), i, i + 1, "0"));
+      transitions.push_back(Transition(transitions.size(), i, i + 1, "1"));
+    }
+  }
+  NFA nfa(false, states, transitions);
+
+  cout << "- Completes within budget: ";
+  ConversionResult result = boundedConvertNFAtoDFA(nfa, ConversionBudget(2000));
+  bool passed = result.Completed && result.ExceededLimit == "" && result.StatesDiscovered == 1024 && result.FrontierSize == 0 &&
+                result.Dfa.States.size() == 1024 && areEquivalent(nfa, result.Dfa).Equivalent;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- State limit: ";
+  result = boundedConvertNFAtoDFA(nfa, ConversionBudget(100));
+  passed = !result.Completed && result.ExceededLimit == "states" && result.StatesDiscovered > 100 && result.FrontierSize > 0 && result.Dfa.States.empty();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Byte limit: ";
+  result = boundedConvertNFAtoDFA(nfa, ConversionBudget(0, 4096));
+  passed = !result.Completed && result.ExceededLimit == "bytes" && result.Bytes > 4096 && result.StatesDiscovered < 1024;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Same result on several threads: ";
+  result = boundedConvertNFAtoDFA(nfa, ConversionBudget(), nullptr, 4);
+  passed = result.Completed && result.Dfa.convertToJSON(false) == convertNFAtoDFA(nfa).convertToJSON(false);
+  result = boundedConvertNFAtoDFA(nfa, ConversionBudget(100), nullptr, 4);
+  passed = passed && !result.Completed && result.ExceededLimit == "states";
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Cancelled: ";
+  CancellationToken cancellation;
+  cancellation.cancel();
+  result = boundedConvertNFAtoDFA(nfa, ConversionBudget(), &cancellation);
+  passed = !result.Completed && result.ExceededLimit == "cancelled" && result.StatesDiscovered == 0 && result.FrontierSize == 0;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Limits apply after the subset construction: ";
+  size_t subsetBytes = bytesPerSubset(CompiledNFA(reduceNFA(nfa)));
+  result = boundedConvertNFAtoDFA(nfa, ConversionBudget(0, 1024 * subsetBytes));
+  passed = !result.Completed && result.ExceededLimit == "bytes" && result.StatesDiscovered == 1024 && result.FrontierSize == 0 && result.Bytes > 1024 * subsetBytes;
+  int calls = 0;
+  BudgetCheck stopOnSecondCall = [&](size_t bytes) {
+    return ++calls == 2 ? string("time") : string("");
+  };
+  NFA unchanged(true, {}, {});
+  passed = passed && boundedSimplifyDFA(convertNFAtoDFA(nfa), 1, stopOnSecondCall, unchanged) == "time" && unchanged.States.empty();
+  calls = 0;
+  passed = passed && boundedReduceNFA(nfa, true, stopOnSecondCall, unchanged) == "time" && unchanged.States.empty();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  // Ids come from the subsets of the reduced NFA, so they differ from converting the NFA without reducing it first,
+  // which gives the start state id 1
+  cout << "- State ids: ";
+  states = { State(0, "a", true, false), State(1, "b", false, true), State(2, "c", false, false), State(3, "d", false, false) };
+  transitions = { Transition(0, 0, 2, "0"), Transition(1, 0, 3, "ε"), Transition(2, 1, 3, "1"), Transition(3, 2, 3, "0"), Transition(4, 2, 2, "0"),
+                  Transition(5, 2, 0, "1"), Transition(6, 3, 2, "0"), Transition(7, 3, 1, "0"), Transition(8, 3, 2, "1") };
+  nfa = NFA(false, states, transitions);
+  vector<State> predictedStates = { State(0, "q0", true, false), State(1, "q1", false, true), State(2, "q2", false, false), State(3, "q3", false, true), State(4, "q4", false, false) };
+  vector<Transition> predictedTransitions = { Transition(0, 0, 3, "0"), Transition(1, 0, 4, "1"), Transition(2, 1, 1, "0"), Transition(3, 1, 2, "1"), Transition(4, 2, 1, "0"),
+                                              Transition(5, 2, 2, "1"), Transition(6, 3, 2, "0"), Transition(7, 3, 0, "1"), Transition(8, 4, 2, "0"), Transition(9, 4, 0, "1") };
+  string predictedResult = NFA(true, predictedStates, predictedTransitions).convertToJSON(true);
+  passed = boundedConvertNFAtoDFA(nfa, ConversionBudget()).Dfa.convertToJSON(true) == predictedResult;
+  passed = passed && boundedConvertNFAtoDFA(nfa, ConversionBudget(), nullptr, 4).Dfa.convertToJSON(true) == predictedResult;
+  passed = passed && convertNFAtoDFA(nfa).convertToJSON(true) == predictedResult;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
 bool runDFATest() {
   bool overralResult = true;
 
@@ -494,7 +585,18 @@ bool runDFATest() {
   overralResult = overralResult && passed;
   printOutcome(passed);
 
-  return result == predictedResult;
+  cout << "- Multi-character and UTF-8 tokens: ";
+  states = { State(0, "q0", true, false), State(1, "q1", false, true) };
+  transitions = { Transition(0, 0, 1, "ab"), Transition(1, 1, 0, "a"), Transition(2, 1, 1, "λ") };
+  dfa = NFA(true, states, transitions);
+  word = "abλλaab";
+  predictedResult = { 1 };
+  result = runDFA(dfa, word);
+  passed = result == predictedResult;
+  overralResult = overralResult && passed;
+  printOutcome(passed);
+
+  return overralResult;
 }
 
 bool runNFATest() {
@@ -560,9 +662,339 @@ bool runNFATest() {
   overralResult = overralResult && passed;
   printOutcome(passed);
 
+  cout << "- Multi-character tokens: ";
+  transitions = { Transition(0, 0, 1, "10"), Transition(1, 1, 3, "1"), Transition(2, 0, 2, "ε"), Transition(3, 2, 3, "100") };
+  nfa.Transitions = transitions;
+  word = "100";
+  predictedResult = { 3 };
+  result = runNFA(nfa, word);
+  passed = result == predictedResult;
+  overralResult = overralResult && passed;
+  printOutcome(passed);
+
   return overralResult;
 }
 
+bool tokenizerTest() {
+  bool overallPass = true;
+
+  cout << "- Longest match: ";
+  Tokenizer tokenizer({ "a", "ab", "abc", "ε", "b" });
+  vector<int> symbols;
+  bool result = tokenizer.tokenize("abcaabbε", symbols);
+  vector<int> predictedSymbols = { 2, 0, 1, 4, 3 };
+  bool passed = result && symbols == predictedSymbols;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Word that cannot be split: ";
+  result = tokenizer.tokenize("abz", symbols);
+  passed = !result;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Symbol lookup: ";
+  passed = tokenizer.symbolId("ab") == 1 && tokenizer.symbolId("ε") == 3 && tokenizer.symbolId("abca") == -1 && tokenizer.symbolId("") == -1;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool characterClassTest() {
+  bool overallPass = true;
+
+  cout << "- Parsing: ";
+  CharacterClass characterClass;
+  bool passed = parseCharacterClass("[a-c_]", characterClass) && characterClass.size() == 4 && characterClass.contains('b') && characterClass.contains('_') &&
+                parseCharacterClass("[^,]", characterClass) && characterClass.size() == 255 && !characterClass.contains(',') &&
+                parseCharacterClass("[\\x00-\\xff]", characterClass) && characterClass.size() == 256 &&
+                parseCharacterClass("[\\]\\-]", characterClass) && characterClass.size() == 2 && characterClass.contains(']') && characterClass.contains('-') &&
+                parseCharacterClass("[a-]", characterClass) && characterClass.size() == 2 &&
+                !parseCharacterClass("[c-a]", characterClass) && !parseCharacterClass("[]", characterClass) && !parseCharacterClass("ab", characterClass);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Writing: ";
+  CharacterClass reparsed;
+  passed = parseCharacterClass("[dabc]", characterClass) && characterClass.toToken() == "[a-d]" &&
+           parseCharacterClass("[^,]", characterClass) && characterClass.toToken() == "[^,]" &&
+           parseCharacterClass("[x]", characterClass) && characterClass.toToken() == "x";
+  for (string token : { "[\\x00-\\x1f\\]^]", "[ -\\-\\\\]", "[^\\x80-\\xff\\^]", "[ace]" }) {
+    passed = passed && parseCharacterClass(token, characterClass) && parseCharacterClass(characterClass.toToken(), reparsed) &&
+             reparsed.Bytes == characterClass.Bytes;
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Splitting into symbols: ";
+  passed = splitIntoSymbols({ "[a-c]", "[c-e]", "c", "ab", "ε" }) == vector<string> { "[ab]", "[de]", "ab", "c" } &&
+           splitIntoSymbols({ "1", "0", "ε" }) == vector<string> { "0", "1" };
+  Tokenizer tokenizer(splitIntoSymbols({ "[a-c]", "[c-e]", "ab" }));
+  vector<int> symbols;
+  passed = passed && tokenizer.tokenize("abcde", symbols) && symbols == vector<int> { 2, 3, 1, 1 } && !tokenizer.tokenize("abf", symbols) &&
+           tokenizer.symbolId("[a-c]") == -1 && tokenizer.symbolId("[ab]") == 0 && tokenizer.symbolId("a") == 0 && tokenizer.example(1) == "d";
+  tokenizer.symbolIds("[a-c]", symbols);
+  passed = passed && symbols == vector<int> { 0, 3 };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Determinizing over every byte: ";
+  // Words whose eighth to last byte is an a, which needs 256 DFA states but only two columns
+  vector<State> states;
+  vector<Transition> transitions = { Transition(0, 0, 0, "[\\x00-\\xff]"), Transition(1, 0, 1, "a") };
+  for (int i = 0; i <= 8; i++) {
+    states.push_back(State(i, "q" + to_string(i), i == 0, i == 8));
+    if (i >= 1 && i < 8) {
+      transitions.push_back(Transition(transitions.size(), i, i + 1, "[\\x00-\\xff]"));
+    }
+  }
+  NFA nfa(false, states, transitions);
+  NFA dfa = simplifyDFA(convertNFAtoDFA(nfa));
+  set<string> alphabet = getAlphabet(dfa.Transitions);
+  set<int> finalStates = getFinalStates(dfa.States);
+  auto accepts = [&](string word) {
+    set<int> result = runDFA(dfa, word);
+    return !result.empty() && finalStates.count(*result.begin()) > 0;
+  };
+  passed = dfa.States.size() == 256 && alphabet == set<string> { "[^a]", "a" } && checkIfDFA(dfa) && !checkIfDFA(nfa) &&
+           accepts(string("\xff" "a\x01zzzzzz", 9)) && !accepts("azzzzzzzz") && runNFA(nfa, string("\xff" "a\x01zzzzzz", 9)).count(8) > 0;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Overlapping classes are not deterministic: ";
+  states = { State(0, "q0", true, false), State(1, "q1", false, true) };
+  transitions = { Transition(0, 0, 1, "[a-c]"), Transition(1, 0, 0, "[c-e]"), Transition(2, 1, 1, "[a-e]") };
+  NFA overlapping(false, states, transitions);
+  EditableNFA editable(overlapping);
+  passed = !analyzeNFA(overlapping).IsDfa && !editable.isDfa();
+  transitions[1] = Transition(1, 0, 0, "[de]");
+  editable.updateTransition(transitions[1]);
+  passed = passed && analyzeNFA(NFA(false, states, transitions)).IsDfa && editable.isDfa() && editable.isComplete();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Comparing classes with single tokens: ";
+  NFA classLoop(false, { State(0, "q0", true, true) }, { Transition(0, 0, 0, "[a-c]") });
+  NFA tokenLoop(false, { State(0, "q0", true, true) }, { Transition(0, 0, 0, "a"), Transition(1, 0, 0, "b"), Transition(2, 0, 0, "c") });
+  NFA smallerLoop(false, { State(0, "q0", true, true) }, { Transition(0, 0, 0, "[ab]") });
+  passed = areEquivalent(classLoop, tokenLoop).Equivalent && isIncluded(smallerLoop, classLoop).Included &&
+           !isIncluded(classLoop, smallerLoop).Included && isIncluded(classLoop, smallerLoop).Counterexample == vector<string> { "c" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool lazyDFATest() {
+  bool overallPass = true;
+
+  cout << "- Same result as runNFA: ";
+  State s0(0, "a", true, false);
+  State s1(1, "b", false, false);
+  State s2(2, "c", false, false);
+  State s3(3, "d", false, true);
+  vector<State> states = { s0, s1, s2, s3 };
+  Transition t0(0, 0, 1, "1");
+  Transition t1(1, 0, 2, "ε");
+  Transition t2(2, 0, 3, "1");
+  Transition t3(3, 1, 3, "0");
+  Transition t4(4, 1, 3, "1");
+  Transition t5(5, 2, 3, "ε");
+  Transition t6(6, 3, 3, "0");
+  Transition t7(7, 3, 1, "1");
+  vector<Transition> transitions = { t0, t1, t2, t3, t4, t5, t6, t7 };
+  NFA nfa(false, states, transitions);
+  LazyDFA lazyDfa(nfa);
+  vector<string> words = { "", "1100", "01", "011", "1", "azb", "10101", "111000" };
+  bool passed = true;
+  for (string word : words) {
+    passed = passed && lazyDfa.run(word) == runNFA(nfa, word);
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Repeated runs hit the cache: ";
+  long misses = lazyDfa.Misses;
+  long hits = lazyDfa.Hits;
+  lazyDfa.accepts("1100");
+  passed = lazyDfa.Misses == misses && lazyDfa.Hits == hits + 4;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Cache flushed when over budget: ";
+  LazyDFA smallLazyDfa(nfa, 1);
+  passed = true;
+  for (string word : words) {
+    passed = passed && smallLazyDfa.run(word) == runNFA(nfa, word);
+  }
+  passed = passed && smallLazyDfa.Flushes > 0 && smallLazyDfa.numCachedStates() <= 2;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool traceRunTest() {
+  bool overallPass = true;
+
+  cout << "- NFA with epsilon transitions: ";
+  vector<State> states = { State(0, "a", true, false), State(1, "b", false, false), State(2, "c", false, false), State(3, "d", false, true) };
+  vector<Transition> transitions = {
+    Transition(0, 0, 1, "1"), Transition(1, 0, 2, "ε"), Transition(2, 0, 3, "1"), Transition(3, 1, 3, "0"),
+    Transition(4, 1, 3, "1"), Transition(5, 2, 3, "ε"), Transition(6, 3, 3, "0"), Transition(7, 3, 1, "1")
+  };
+  NFA nfa(false, states, transitions);
+  string word = "1100";
+  RunTrace trace = traceRun(nfa, word);
+  bool passed = trace.Ends == vector<int> { 0, 1, 2, 3, 4 } && trace.Accepted == vector<char> { 1, 1, 1, 1, 1 } &&
+                trace.Entered[0] == vector<int> { 0, 2, 3 } && trace.Left[0].empty();
+  for (int step = 0; step < trace.numSteps(); step++) {
+    passed = passed && trace.activeStates(step) == runNFA(nfa, word.substr(0, trace.Ends[step]));
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- DFA with multi character tokens: ";
+  states = { State(0, "q0", true, false), State(1, "q1", false, true) };
+  transitions = { Transition(0, 0, 1, "ab"), Transition(1, 1, 0, "c") };
+  NFA dfa(true, states, transitions);
+  trace = traceRun(dfa, "abcab");
+  passed = trace.Ends == vector<int> { 0, 2, 3, 5 } && trace.Accepted == vector<char> { 0, 1, 0, 1 } &&
+           trace.Entered == vector<vector<int>> { { 0 }, { 1 }, { 0 }, { 1 } } && trace.Left == vector<vector<int>> { {}, { 0 }, { 1 }, { 0 } };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Word leaving the alphabet: ";
+  trace = traceRun(dfa, "abx");
+  passed = trace.Ends == vector<int> { 0, 2, 3 } && trace.activeStates(1) == set<int> { 1 } && trace.activeStates(2).empty() &&
+           trace.Accepted.back() == 0;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- JSON: ";
+  passed = traceRun(dfa, "ab").convertToJSON(false) == "{\"ends\":[0,2],\"entered\":[[0],[1]],\"left\":[[],[0]],\"accepted\":[false,true]}";
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool dfaLanguageTest() {
+  bool overallPass = true;
+
+  // Binary words with an even number of 1s
+  vector<State> states = { State(0, "even", true, true), State(1, "odd", false, false) };
+  vector<Transition> transitions = { Transition(0, 0, 0, "0"), Transition(1, 0, 1, "1"), Transition(2, 1, 1, "0"), Transition(3, 1, 0, "1") };
+  NFA evenDfa(true, states, transitions);
+  DFALanguage even(evenDfa);
+
+  cout << "- Exact counts: ";
+  vector<BigCount> counts = even.countWords(70);
+  bool passed = counts.size() == 71 && counts[0] == BigCount(1) && counts[1] == BigCount(1) && counts[10] == BigCount(512) &&
+                counts[70].toString() == "590295810358705651712";
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Modular counts: ";
+  uint64_t modulus = 1000000007;
+  vector<uint64_t> modularCounts = even.countWords(70, modulus);
+  passed = modularCounts.size() == 71;
+  for (int length = 0; length <= 70 && passed; length++) {
+    passed = modularCounts[length] == even.countWordsOfLength(length, modulus);
+  }
+  uint64_t power = 1; // 2^(10^18 - 1) modulo the modulus
+  uint64_t base = 2;
+  for (uint64_t exponent = 1000000000000000000ULL - 1; exponent > 0; exponent >>= 1) {
+    if (exponent & 1) {
+      power = power * base % modulus;
+    }
+    base = base * base % modulus;
+  }
+  passed = passed && even.countWordsOfLength(1000000000000000000ULL, modulus) == power;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Shortlex enumeration: ";
+  AcceptedWordIterator iterator = even.acceptedWords();
+  vector<string> words;
+  string word;
+  while (words.size() < 8 && iterator.next(word)) {
+    words.push_back(word);
+  }
+  passed = words == vector<string> { "", "0", "00", "11", "000", "011", "101", "110" } && !even.isFinite();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Finite language: ";
+  states = { State(0, "q0", true, false), State(1, "q1", false, true), State(2, "q2", false, true), State(3, "q3", false, true) };
+  transitions = { Transition(0, 0, 1, "0"), Transition(1, 0, 2, "1"), Transition(2, 1, 3, "1") };
+  DFALanguage finite(NFA(true, states, transitions));
+  AcceptedWordIterator finiteIterator = finite.acceptedWords();
+  words.clear();
+  while (words.size() < 10 && finiteIterator.next(word)) {
+    words.push_back(word);
+  }
+  passed = words == vector<string> { "0", "1", "01" } && finite.isFinite();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Shortest words: ";
+  string accepted, rejected;
+  passed = even.shortestAccepted(accepted) && accepted == "" && even.shortestRejected(rejected) && rejected == "1" &&
+           finite.shortestAccepted(accepted) && accepted == "0" && finite.shortestRejected(rejected) && rejected == "";
+  states = { State(0, "q0", true, true) };
+  transitions = { Transition(0, 0, 0, "0"), Transition(1, 0, 0, "1") };
+  passed = passed && !DFALanguage(NFA(true, states, transitions)).shortestRejected(rejected);
+  states.push_back(State(1, "q1", false, true));
+  transitions = { Transition(0, 0, 0, "0"), Transition(1, 1, 1, "1") }; // Reading 1 from the start state is undefined
+  passed = passed && DFALanguage(NFA(true, states, transitions)).shortestRejected(rejected) && rejected == "1";
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Uniform samples: ";
+  vector<string> samples = even.sampleAccepted(4, 4000, 1);
+  map<string, int> frequencies;
+  passed = samples.size() == 4000;
+  for (const string& sample : samples) {
+    passed = passed && sample.size() == 4 && runDFA(evenDfa, sample) == set<int> { 0 };
+    frequencies[sample]++;
+  }
+  passed = passed && frequencies.size() == 8 && finite.sampleAccepted(3, 10, 1).empty();
+  for (auto& frequency : frequencies) {
+    passed = passed && frequency.second > 350 && frequency.second < 650;
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Classes count every byte: ";
+  states = { State(0, "q0", true, false), State(1, "q1", false, true) };
+  transitions = { Transition(0, 0, 1, "[a-z]"), Transition(1, 1, 1, "[a-z]") };
+  DFALanguage lowercase(NFA(true, states, transitions));
+  counts = lowercase.countWords(2);
+  samples = lowercase.sampleAccepted(1, 2600, 1);
+  frequencies.clear();
+  for (const string& sample : samples) {
+    frequencies[sample]++;
+  }
+  AcceptedWordIterator lowercaseIterator = lowercase.acceptedWords();
+  words.clear();
+  while (words.size() < 28 && lowercaseIterator.next(word)) {
+    words.push_back(word);
+  }
+  passed = counts[1] == BigCount(26) && counts[2] == BigCount(676) && lowercase.countWords(2, 1000)[2] == 676 &&
+           lowercase.countWordsOfLength(3, 1000000) == 17576 && frequencies.size() == 26 && words.size() == 28 &&
+           words[0] == "a" && words[25] == "z" && words[26] == "aa" && words[27] == "ab" &&
+           lowercase.shortestAccepted(accepted) && accepted == "a" && lowercase.shortestRejected(rejected) && rejected == "";
+  for (auto& frequency : frequencies) {
+    passed = passed && frequency.second > 50 && frequency.second < 150;
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
 bool validateNFATest() {
   bool overallPass = true;
 
@@ -704,6 +1136,933 @@ bool checkIfDFATest() {
   return overallPass;
 }
 
+bool analyzeNFATest() {
+  bool overallPass = true;
+
+  cout << "- Duplicates reported: ";
+  State s0(0, "a", true, false);
+  State s1(1, "a", false, true);
+  State s2(2, "c", false, false);
+  State s3(3, "d", false, false);
+  vector<State> states = { s0, s1, s2, s3 };
+  Transition t0(0, 0, 1, "0");
+  Transition t1(1, 0, 1, "0");
+  Transition t2(2, 1, 1, "1");
+  Transition t3(3, 2, 1, "ε");
+  vector<Transition> transitions = { t0, t1, t2, t3 };
+  NFA nfa(false, states, transitions);
+  NFAAnalysis result = analyzeNFA(nfa);
+  bool passed = result.ValidationCode == 1 &&
+                result.DuplicateNames == vector<string> { "a" } &&
+                result.DuplicateTransitions == vector<int> { 1 } &&
+                result.NumStartStates == 1 &&
+                result.HasEpsilonTransitions &&
+                !result.IsDfa &&
+                !result.IsComplete;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Reachable and co-reachable states: ";
+  set<int> predictedReachable = { 0, 1 };
+  set<int> predictedCoReachable = { 0, 1, 2 };
+  vector<string> predictedAlphabet = { "0", "1" };
+  passed = result.ReachableStates == predictedReachable &&
+           result.CoReachableStates == predictedCoReachable &&
+           result.Alphabet == predictedAlphabet;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Complete DFA: ";
+  states = { State(0, "a", true, false), State(1, "b", false, true) };
+  transitions = { Transition(0, 0, 1, "0"), Transition(1, 0, 0, "1"), Transition(2, 1, 1, "0"), Transition(3, 1, 1, "1") };
+  nfa = NFA(false, states, transitions);
+  result = analyzeNFA(nfa);
+  passed = result.ValidationCode == 0 && result.IsDfa && result.IsComplete && result.CoReachableStates == predictedReachable;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool editableNFATest() {
+  bool overallPass = true;
+
+  cout << "- Edits match full analysis: ";
+  vector<State> states = { State(0, "a", true, false), State(1, "b", false, true) };
+  vector<Transition> transitions = { Transition(0, 0, 1, "0"), Transition(1, 0, 0, "1"), Transition(2, 1, 1, "0") };
+  EditableNFA editable(NFA(false, states, transitions));
+  bool passed = true;
+  auto matches = [&editable]() {
+    NFAAnalysis analysis = analyzeNFA(editable.toNFA());
+    return editable.validationCode() == analysis.ValidationCode &&
+           editable.isDfa() == analysis.IsDfa &&
+           editable.isComplete() == analysis.IsComplete;
+  };
+  passed = passed && matches() && !editable.isDfa();
+  editable.addTransition(Transition(3, 1, 1, "1")); // Completes the DFA
+  passed = passed && matches() && editable.isDfa();
+  editable.addTransition(Transition(4, 1, 0, "1")); // Second target for b on 1
+  passed = passed && matches() && !editable.isDfa();
+  editable.addTransition(Transition(5, 1, 0, "1")); // Duplicate transition
+  passed = passed && matches() && editable.validationCode() == 3;
+  editable.removeTransition(5);
+  editable.removeTransition(4);
+  passed = passed && matches() && editable.isDfa();
+  editable.addState(State(2, "a", false, false)); // Duplicate name and incomplete
+  passed = passed && matches() && editable.validationCode() == 1 && !editable.isComplete();
+  editable.updateState(State(2, "c", true, false)); // Second start state
+  passed = passed && matches() && editable.validationCode() == 2;
+  editable.updateTransition(Transition(2, 1, 2, "0"));
+  editable.addTransition(Transition(6, 2, 2, "ε"));
+  passed = passed && matches() && editable.outDegree(1) == 2;
+  editable.removeState(2);
+  passed = passed && matches() && editable.validationCode() == 0 && !editable.isComplete() && editable.outDegree(2) == 0;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool resultCacheTest() {
+  bool overallPass = true;
+
+  cout << "- Canonical hash ignores ids, names and order: ";
+  vector<State> states = { State(0, "a", true, false), State(1, "b", false, false), State(2, "c", false, true) };
+  vector<Transition> transitions = { Transition(0, 0, 1, "0"), Transition(1, 1, 2, "1"), Transition(2, 2, 2, "0"), Transition(3, 0, 2, "1") };
+  NFA nfa(false, states, transitions);
+  vector<State> renamedStates = { State(7, "z", false, true), State(3, "x", true, false), State(5, "y", false, false) };
+  vector<Transition> renamedTransitions = { Transition(9, 7, 7, "0"), Transition(4, 3, 7, "1"), Transition(1, 5, 7, "1"), Transition(2, 3, 5, "0") };
+  NFA renamedNfa(false, renamedStates, renamedTransitions);
+  bool passed = canonicalHash(nfa) == canonicalHash(renamedNfa);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Different structures have different hashes: ";
+  renamedNfa.Transitions[0].Token = "1";
+  passed = canonicalHash(nfa) != canonicalHash(renamedNfa);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Symmetric states only differing by ids: ";
+  vector<State> cycleStates = { State(0, "a", false, false), State(1, "b", false, false), State(2, "c", false, false), State(3, "d", false, false) };
+  NFA cycle(false, cycleStates, { Transition(0, 0, 1, "0"), Transition(1, 1, 2, "0"), Transition(2, 2, 3, "0"), Transition(3, 3, 0, "0") });
+  NFA relabelledCycle(false, cycleStates, { Transition(0, 0, 2, "0"), Transition(1, 2, 1, "0"), Transition(2, 1, 3, "0"), Transition(3, 3, 0, "0") });
+  passed = canonicalForm(cycle) == canonicalForm(relabelledCycle) && canonicalForm(cycle).find("canonical:") == 0;
+  vector<State> twinStates = { State(0, "a", true, false), State(1, "b", false, false), State(2, "c", false, false), State(3, "d", false, true), State(4, "e", false, true) };
+  NFA twins(false, twinStates, { Transition(0, 0, 1, "0"), Transition(1, 0, 2, "0"), Transition(2, 1, 3, "1"), Transition(3, 2, 4, "1") });
+  NFA relabelledTwins(false, twinStates, { Transition(0, 0, 2, "0"), Transition(1, 0, 1, "0"), Transition(2, 2, 4, "1"), Transition(3, 1, 3, "1") });
+  NFA crossedTwins(false, twinStates, { Transition(0, 0, 1, "0"), Transition(1, 0, 2, "0"), Transition(2, 1, 4, "1"), Transition(3, 2, 3, "1") });
+  passed = passed && canonicalForm(twins) == canonicalForm(relabelledTwins) && canonicalForm(twins) == canonicalForm(crossedTwins);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Symmetric but different structures: ";
+  vector<State> sixStates;
+  for (int i = 0; i < 6; i++) {
+    sixStates.push_back(State(i, "q" + to_string(i), false, false));
+  }
+  NFA hexagon(false, sixStates, {});
+  NFA triangles(false, sixStates, {});
+  for (int i = 0; i < 6; i++) {
+    hexagon.Transitions.push_back(Transition(i, i, (i + 1) % 6, "0"));
+    triangles.Transitions.push_back(Transition(i, i, i / 3 * 3 + (i + 1) % 3, "0"));
+  }
+  passed = canonicalForm(hexagon) != canonicalForm(triangles);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Repeated conversions hit the cache: ";
+  ResultCache cache;
+  renamedNfa.Transitions[0].Token = "0";
+  NFA firstResult = cache.getOrCompute(nfa, "convertNFAtoDFA", convertNFAtoDFA);
+  NFA secondResult = cache.getOrCompute(renamedNfa, "convertNFAtoDFA", convertNFAtoDFA);
+  NFA thirdResult = cache.getOrCompute(renamedNfa, "simplifyDFA", simplifyDFA);
+  passed = cache.Hits == 1 && cache.Misses == 2 && firstResult.convertToJSON(false) == secondResult.convertToJSON(false);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Least recently used result evicted: ";
+  cache.setMaxBytes(cache.bytes());
+  renamedNfa.Transitions[0].Token = "1";
+  cache.getOrCompute(renamedNfa, "convertNFAtoDFA", convertNFAtoDFA);
+  passed = cache.Evictions >= 1 && cache.bytes() <= cache.MaxBytes && cache.Misses == 3;
+  cache.getOrCompute(nfa, "convertNFAtoDFA", convertNFAtoDFA); // Oldest entry so it was evicted
+  passed = passed && cache.Misses == 4 && cache.Hits == 1;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Lowering the limit evicts straight away: ";
+  long evictions = cache.Evictions;
+  cache.setMaxBytes(cache.bytes() - 1);
+  passed = cache.Evictions > evictions && cache.bytes() <= cache.MaxBytes;
+  cache.setMaxBytes(0);
+  passed = passed && cache.bytes() == 0 && cache.statisticsToJSON().find("\"entries\":0") != string::npos;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool compiledAutomatonCacheTest() {
+  bool overallPass = true;
+
+  cout << "- Structure hash changes with ids but not names: ";
+  vector<State> states = { State(0, "a", true, false), State(1, "b", false, true) };
+  vector<Transition> transitions = { Transition(0, 0, 1, "0"), Transition(1, 1, 1, "1") };
+  NFA dfa(true, states, transitions);
+  NFA renamed = dfa;
+  renamed.States[0].Name = "z";
+  renamed.Transitions[0].Id = 5;
+  NFA relabelled = dfa;
+  relabelled.States[1].Id = 2;
+  relabelled.Transitions[0].End = 2;
+  relabelled.Transitions[1].Start = 2;
+  relabelled.Transitions[1].End = 2;
+  bool passed = structureHash(dfa) == structureHash(renamed) && sameStructure(dfa, renamed) &&
+                structureHash(dfa) != structureHash(relabelled) && !sameStructure(dfa, relabelled);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Repeated runs compile once: ";
+  CompiledAutomatonCache cache;
+  shared_ptr<const CompiledDFA> first = cache.dfa(dfa);
+  shared_ptr<const CompiledDFA> second = cache.dfa(renamed);
+  shared_ptr<const CompiledNFA> asNfa = cache.nfa(dfa);
+  passed = first == second && cache.Hits == 1 && cache.Misses == 2 && cache.size() == 1 &&
+           first->run("011") == set<int> { 1 } && asNfa->run("011") == set<int> { 1 };
+  shared_ptr<const CompiledDFA> third = cache.dfa(relabelled);
+  passed = passed && third != first && third->run("011") == set<int> { 2 } && cache.size() == 2;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Least recently used model evicted: ";
+  cache.MaxEntries = 2;
+  cache.dfa(dfa); // Leaves relabelled as the oldest entry
+  NFA other = dfa;
+  other.Transitions[1].Token = "0";
+  cache.dfa(other);
+  cache.dfa(dfa);
+  passed = cache.size() == 2 && cache.Misses == 4 && cache.Hits == 3;
+  cache.dfa(relabelled);
+  passed = passed && cache.Misses == 5;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Shared cache gives the same runs: ";
+  compiledAutomata().clear();
+  long hits = compiledAutomata().Hits;
+  passed = runDFA(dfa, "01") == set<int> { 1 } && runDFA(renamed, "0") == set<int> { 1 } && runDFA(relabelled, "01") == set<int> { 2 } &&
+           traceRun(dfa, "01").Accepted.back() && compiledAutomata().Hits == hits + 2;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Lazy runs match and reuse their states: ";
+  NFA nfa(false, { State(0, "a", true, false), State(1, "b", false, false), State(2, "c", false, true) },
+          { Transition(0, 0, 0, "0"), Transition(1, 0, 0, "1"), Transition(2, 0, 1, "1"), Transition(3, 1, 2, "0"), Transition(4, 1, 2, "1") });
+  CompiledAutomatonCache lazyCache;
+  vector<string> words = { "", "1", "10", "0110", "111", "10a" };
+  passed = true;
+  for (const string& word : words) {
+    passed = passed && lazyCache.runLazily(nfa, word) == runNFA(nfa, word);
+  }
+  long misses = lazyCache.LazyMisses;
+  passed = passed && lazyCache.runLazily(nfa, "0110") == set<int> { 0, 2 } && lazyCache.LazyMisses == misses &&
+           lazyCache.LazyHits >= 4 && lazyCache.LazyFlushes == 0 && lazyCache.Misses == 1 && runNFA(nfa, "11", true) == set<int> { 0, 1, 2 };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Lazy runs still match when flushing: ";
+  CompiledAutomatonCache flushingCache(8, 0); // Every new DFA state flushes the others
+  passed = true;
+  for (const string& word : words) {
+    passed = passed && flushingCache.runLazily(nfa, word) == runNFA(nfa, word);
+  }
+  passed = passed && flushingCache.LazyFlushes > 0 && flushingCache.statisticsToJSON().find("\"flushes\":" + to_string(flushingCache.LazyFlushes)) != string::npos;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool areEquivalentTest() {
+  bool overallPass = true;
+
+  cout << "- NFA and its DFA: ";
+  State s0(0, "a", true, false);
+  State s1(1, "b", false, false);
+  State s2(2, "c", false, false);
+  State s3(3, "d", false, true);
+  vector<State> states = { s0, s1, s2, s3 };
+  Transition t0(0, 0, 1, "1");
+  Transition t1(1, 0, 2, "ε");
+  Transition t2(2, 0, 3, "1");
+  Transition t3(3, 1, 3, "0");
+  Transition t4(4, 1, 3, "1");
+  Transition t5(5, 2, 3, "ε");
+  Transition t6(6, 3, 3, "0");
+  vector<Transition> transitions = { t0, t1, t2, t3, t4, t5, t6 };
+  NFA nfa(false, states, transitions);
+  NFA dfa = convertNFAtoDFA(nfa);
+  EquivalenceResult result = areEquivalent(nfa, dfa);
+  bool passed = result.Equivalent && result.Counterexample.empty();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Shortest counterexample: ";
+  nfa.Transitions = { t0, t1, t2, t3, t4, t6 }; // Empty word no longer accepted
+  result = areEquivalent(nfa, dfa);
+  passed = !result.Equivalent && result.Counterexample == vector<string> {};
+  nfa.Transitions = { t0, t1, t2, t3, t4, t5, t6, Transition(7, 3, 3, "1") }; // Now accepts 01
+  result = areEquivalent(dfa, nfa);
+  passed = passed && !result.Equivalent && result.Counterexample == vector<string> { "0", "1" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Different alphabets: ";
+  states = { State(0, "a", true, true) };
+  NFA onlyZeros(true, states, { Transition(0, 0, 0, "0") });
+  NFA zerosAndOnes(true, states, { Transition(0, 0, 0, "0"), Transition(1, 0, 0, "1") });
+  result = areEquivalent(onlyZeros, zerosAndOnes);
+  passed = !result.Equivalent && result.Counterexample == vector<string> { "1" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool isIncludedTest() {
+  bool overallPass = true;
+
+  cout << "- Included language: ";
+  vector<State> states = { State(0, "a", true, false), State(1, "b", false, true) };
+  NFA endsWithOne(false, states, { Transition(0, 0, 0, "0"), Transition(1, 0, 0, "1"), Transition(2, 0, 1, "1") });
+  NFA onlyOnes(false, states, { Transition(0, 0, 1, "1"), Transition(1, 1, 1, "1") });
+  InclusionResult result = isIncluded(onlyOnes, endsWithOne);
+  bool passed = result.Included && result.Counterexample.empty();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Shortest counterexample: ";
+  result = isIncluded(endsWithOne, onlyOnes);
+  passed = !result.Included && result.Counterexample == vector<string> { "0", "1" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Symbols missing from the larger language: ";
+  NFA withTwo(false, states, { Transition(0, 0, 1, "1"), Transition(1, 1, 1, "2") });
+  result = isIncluded(withTwo, endsWithOne);
+  passed = !result.Included && result.Counterexample == vector<string> { "1", "2" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Universality: ";
+  states = { State(0, "a", true, true), State(1, "b", false, false), State(2, "c", false, true) };
+  NFA universal(false, states, { Transition(0, 0, 0, "0"), Transition(1, 0, 1, "1"), Transition(2, 1, 2, "ε"), Transition(3, 2, 0, "ε"), Transition(4, 0, 2, "0") });
+  passed = isUniversal(universal).Included;
+  universal.Transitions.pop_back();
+  universal.Transitions.pop_back();
+  result = isUniversal(universal);
+  passed = passed && !result.Included && result.Counterexample == vector<string> { "1", "0" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool productOfTest() {
+  bool overallPass = true;
+
+  vector<State> states = { State(0, "a", true, false), State(1, "b", false, true) };
+  NFA endsWithOne(false, states, { Transition(0, 0, 0, "0"), Transition(1, 0, 0, "1"), Transition(2, 0, 1, "1") });
+  NFA startsWithZero(false, states, { Transition(0, 0, 1, "0"), Transition(1, 1, 1, "0"), Transition(2, 1, 1, "1") });
+  vector<string> words = { "", "0", "1", "01", "10", "11", "001", "0110", "1101" };
+  auto accepts = [](NFA nfa, string word) {
+    set<int> result = nfa.IsDfa ? runDFA(nfa, word) : runNFA(nfa, word);
+    for (State state : nfa.States) {
+      if (state.IsFinal && result.count(state.Id) > 0) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  cout << "- Intersection, union and difference: ";
+  NFA intersection = intersectionOf(endsWithOne, startsWithZero);
+  NFA unionResult = unionOf(endsWithOne, startsWithZero);
+  NFA difference = differenceOf(endsWithOne, startsWithZero);
+  bool passed = true;
+  for (string word : words) {
+    bool accepted1 = accepts(endsWithOne, word);
+    bool accepted2 = accepts(startsWithZero, word);
+    passed = passed && accepts(intersection, word) == (accepted1 && accepted2) &&
+             accepts(unionResult, word) == (accepted1 || accepted2) &&
+             accepts(difference, word) == (accepted1 && !accepted2);
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Complement of a partial DFA: ";
+  NFA complement = complementOf(startsWithZero);
+  passed = true;
+  for (string word : words) {
+    passed = passed && accepts(complement, word) == !accepts(startsWithZero, word);
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Result trimmed: ";
+  NFA empty = intersectionOf(endsWithOne, complementOf(endsWithOne));
+  passed = empty.States.size() == 1 && empty.Transitions.empty() && !empty.States[0].IsFinal;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool reduceNFATest() {
+  bool overallPass = true;
+
+  cout << "- Forward bisimilar states merged: ";
+  vector<State> states = { State(0, "a", true, false), State(1, "b", false, false), State(2, "c", false, false), State(3, "d", false, true), State(4, "e", false, true) };
+  NFA nfa(false, states, { Transition(0, 0, 1, "0"), Transition(1, 0, 2, "0"), Transition(2, 1, 3, "1"), Transition(3, 2, 4, "1") });
+  NFA reduced = reduceNFA(nfa);
+  bool passed = reduced.States.size() == 3 && reduced.Transitions.size() == 2 && areEquivalent(nfa, reduced).Equivalent;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Backward bisimilar states merged: ";
+  states = { State(0, "a", true, false), State(1, "b", false, true), State(2, "c", false, false), State(3, "d", false, true) };
+  nfa = NFA(false, states, { Transition(0, 0, 1, "0"), Transition(1, 0, 2, "0"), Transition(2, 2, 3, "1"), Transition(3, 3, 3, "1") });
+  passed = reduceNFA(nfa).States.size() == 4;
+  reduced = reduceNFA(nfa, true);
+  passed = passed && reduced.States.size() == 3 && areEquivalent(nfa, reduced).Equivalent;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Epsilon transitions removed: ";
+  states = { State(0, "a", true, false), State(1, "b", false, false), State(2, "c", false, true) };
+  nfa = NFA(false, states, { Transition(0, 0, 1, "ε"), Transition(1, 1, 2, "1"), Transition(2, 2, 0, "ε"), Transition(3, 0, 2, "0") });
+  reduced = reduceNFA(nfa, true);
+  passed = areEquivalent(nfa, reduced).Equivalent;
+  for (Transition transition : reduced.Transitions) {
+    passed = passed && transition.Token != "ε";
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool nfaFromJSONTest() {
+  bool overallPass = true;
+
+  cout << "- Round trip through convertToJSON: ";
+  vector<State> states = { State(0, "q0", true, false), State(1, "q1", false, true) };
+  NFA nfa(false, states, { Transition(0, 0, 1, "ε"), Transition(1, 1, 1, "1") });
+  NFA parsed = nfaFromJSON(nfa.convertToJSON(true));
+  bool passed = parsed.convertToJSON(true) == nfa.convertToJSON(true);
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Bare structure with escapes: ";
+  parsed = nfaFromJSON("{ \"isDfa\": true, \"states\": [{ \"id\": 3, \"name\": \"a\\u00e9\\n\", \"isStart\": true, \"isFinal\": true }], \"transitions\": [] }");
+  passed = parsed.IsDfa && parsed.States.size() == 1 && parsed.States[0].Id == 3 && parsed.States[0].Name == "a\u00e9\n" && parsed.Transitions.empty();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Malformed JSON: ";
+  passed = false;
+  try {
+    nfaFromJSON("{ \"states\": [ }");
+  } catch (const invalid_argument& e) {
+    passed = true;
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Members of the wrong type: ";
+  vector<string> wrongTypes = {
+    "[]",
+    "{ \"states\": {}, \"transitions\": [] }",
+    "{ \"states\": [1], \"transitions\": [] }",
+    "{ \"states\": [{ \"id\": \"0\", \"name\": \"a\", \"isStart\": true, \"isFinal\": false }], \"transitions\": [] }",
+    "{ \"states\": [{ \"id\": 0.5, \"name\": \"a\", \"isStart\": true, \"isFinal\": false }], \"transitions\": [] }",
+    "{ \"states\": [{ \"id\": 0, \"name\": 7, \"isStart\": true, \"isFinal\": false }], \"transitions\": [] }",
+    "{ \"states\": [{ \"id\": 0, \"name\": \"a\", \"isStart\": 1, \"isFinal\": false }], \"transitions\": [] }",
+    "{ \"states\": [], \"transitions\": [{ \"id\": 0, \"start\": 0, \"end\": null, \"token\": \"0\" }] }",
+    "{ \"states\": [], \"transitions\": [{ \"id\": 0, \"start\": 0, \"end\": 0, \"token\": 0 }] }",
+    "{ \"isDfa\": \"yes\", \"states\": [], \"transitions\": [] }",
+    "{ \"structure\": [], \"type\": \"nfa\" }",
+  };
+  passed = true;
+  for (const string& json : wrongTypes) {
+    bool threw = false;
+    try {
+      nfaFromJSON(json);
+    } catch (const invalid_argument& e) {
+      threw = true;
+    }
+    passed = passed && threw;
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+// Grayscale, blur and threshold as photoToNFA did them before preprocessPhoto
+double referencePreprocess(const Mat& src, Mat& gray, Mat& blurred, Mat& binary) {
+  cvtColor(src, gray, COLOR_BGR2GRAY);
+  GaussianBlur(gray, blurred, Size(7, 7), 1);
+  Mat otsu;
+  double thresholdValue = threshold(blurred, otsu, 0, 255, THRESH_BINARY + THRESH_OTSU) - 20;
+  threshold(blurred, binary, thresholdValue, 255, THRESH_BINARY_INV);
+  binary /= 255;
+  return thresholdValue;
+}
+
+bool sameImage(const Mat& image1, const Mat& image2) {
+  if (image1.size() != image2.size() || image1.type() != image2.type()) {
+    return false;
+  }
+  for (int y = 0; y < image1.rows; y++) {
+    if (memcmp(image1.ptr<uchar>(y), image2.ptr<uchar>(y), image1.cols * image1.elemSize()) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool samePreprocessing(const Mat& src) {
+  Mat gray, blurred, binary, expectedGray, expectedBlurred, expectedBinary;
+  double thresholdValue = preprocessPhoto(src, gray, blurred, binary);
+  double expectedThreshold = referencePreprocess(src, expectedGray, expectedBlurred, expectedBinary);
+  return thresholdValue == expectedThreshold && sameImage(gray, expectedGray) && sameImage(blurred, expectedBlurred) && sameImage(binary, expectedBinary);
+}
+
+bool preprocessPhotoTest() {
+  bool overallPass = true;
+
+  cout << "- Same as OpenCV on the sample photos: ";
+  int numPhotos = 0;
+  bool passed = true;
+  for (int i = 1; i < 34; i++) {
+    Mat photo = imread("test_photos/test_photo_" + to_string(i) + ".jpg");
+    if (!photo.empty()) {
+      numPhotos++;
+      passed = passed && samePreprocessing(photo);
+    }
+  }
+  passed = passed && numPhotos > 0;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Same as OpenCV on small and odd sizes: ";
+  // Fewer rows than the blur kernel, odd widths, and heights that end part way through a strip
+  vector<Size> sizes = { Size(1, 1), Size(3, 2), Size(9, 3), Size(11, 6), Size(7, 7), Size(13, 8), Size(31, 63), Size(33, 65), Size(77, 129), Size(3, 200), Size(200, 3) };
+  RNG rng(42);
+  passed = true;
+  for (Size size : sizes) {
+    Mat noise(size, CV_8UC3);
+    for (int y = 0; y < noise.rows; y++) {
+      uchar* pixels = noise.ptr<uchar>(y);
+      for (int x = 0; x < 3 * noise.cols; x++) {
+        pixels[x] = rng.uniform(0, 256);
+      }
+    }
+    passed = passed && samePreprocessing(noise);
+  }
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool photoPipelineTest() {
+  bool overallPass = true;
+
+  cout << "- Reused for several photos: ";
+  PhotoPipeline pipeline;
+  bool passed = pipeline.run("test_photos/missing.jpg", false) == "Could not open file" && pipeline.run("test_photos/missing.jpg", false) == "Could not open file";
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Empty or unreadable file: ";
+  passed = pipeline.run("test_photos/empty.jpg", false) == "Could not open file" && pipeline.run("tester.cpp", false) == "Could not open file";
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Separate pipelines on separate threads: ";
+  CancellationToken cancellation;
+  cancellation.cancel();
+  vector<string> results(4);
+  vector<thread> threads;
+  for (int i = 0; i < results.size(); i++) {
+    threads.push_back(thread([&, i]() {
+      PhotoPipeline threadPipeline;
+      results[i] = threadPipeline.run("test_photos/missing.jpg", false, i % 2 == 0 ? &cancellation : nullptr);
+    }));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  passed = results == vector<string> { "Cancelled", "Could not open file", "Cancelled", "Could not open file" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Same result when a photo is run again: ";
+  string first = pipeline.run("test_photos/test_photo_16.jpg", false);
+  string second = pipeline.run("test_photos/test_photo_16.jpg", false);
+  PhotoPipeline freshPipeline;
+  passed = first != "Could not open file" && second == first && freshPipeline.run("test_photos/test_photo_16.jpg", false) == first;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Pool keeps a limited number of pipelines: ";
+  PhotoPipelinePool pool(1);
+  unique_ptr<PhotoPipeline> pipeline1 = pool.acquire();
+  unique_ptr<PhotoPipeline> pipeline2 = pool.acquire();
+  PhotoPipeline* kept = pipeline1.get();
+  pool.release(move(pipeline1));
+  pool.release(move(pipeline2));
+  passed = pool.numIdle() == 1 && pool.acquire().get() == kept && pool.numIdle() == 0;
+  photoToNFA("test_photos/missing.jpg", false);
+  photoToNFAAsync("test_photos/missing.jpg", make_shared<CancellationToken>()).get();
+  passed = passed && photoPipelines().numIdle() == 1;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+bool reorderDFATest() {
+  bool overallPass = true;
+
+  vector<State> states;
+  for (int i = 0; i < 7; i++) {
+    states.push_back(State(i, "q" + to_string(i), i == 0, i == 1 || i == 2 || i == 4));
+  }
+  vector<Transition> transitions = {
+    Transition(0, 0, 3, "0"), Transition(1, 0, 1, "1"), Transition(2, 1, 2, "0"), Transition(3, 1, 5, "1"),
+    Transition(4, 2, 2, "0"), Transition(5, 2, 5, "1"), Transition(6, 3, 0, "0"), Transition(7, 3, 4, "1"),
+    Transition(8, 4, 2, "0"), Transition(9, 4, 5, "1"), Transition(10, 5, 5, "0"), Transition(11, 5, 5, "1"),
+    Transition(12, 6, 6, "0"), Transition(13, 6, 6, "1")
+  };
+  NFA dfa(true, states, transitions);
+  vector<string> words = { "", "0", "1", "01", "000010011", "0110", "10", "2" };
+
+  struct OrderCase {
+    string Description;
+    StateOrder Order;
+    vector<string> SampleWords;
+    vector<int> StateIds;
+  };
+  vector<OrderCase> cases = {
+    { "Breadth first", StateOrder::BreadthFirst, {}, { 0, 3, 1, 4, 2, 5, 6 } },
+    { "Depth first", StateOrder::DepthFirst, {}, { 0, 3, 4, 2, 5, 1, 6 } },
+    { "Profile guided", StateOrder::Profile, { "1111", "10" }, { 5, 0, 1, 2, 3, 4, 6 } },
+  };
+  for (const OrderCase& orderCase : cases) {
+    cout << "- " << orderCase.Description << ": ";
+    CompiledDFA compiled(dfa);
+    compiled.reorder(orderCase.Order, orderCase.SampleWords);
+    bool passed = compiled.StateIds == orderCase.StateIds && compiled.StateIds[compiled.Start] == 0;
+    for (const string& word : words) {
+      passed = passed && compiled.run(word) == runDFA(dfa, word);
+    }
+    overallPass = overallPass && passed;
+    printOutcome(passed);
+  }
+
+  return overallPass;
+}
+
+bool tracingTest() {
+  bool overallPass = true;
+
+  cout << "- Ring keeps the newest events: ";
+  TraceBuffer buffer(1);
+  for (int i = 0; i < TraceBuffer::Capacity + 10; i++) {
+    TraceEvent event;
+    event.Name = "count";
+    event.Phase = 'C';
+    event.Timestamp = i;
+    event.Duration = 0;
+    event.Value = i;
+    buffer.record(event);
+  }
+  vector<TraceEvent> events = buffer.snapshot();
+  bool passed = events.size() == TraceBuffer::Capacity && events.back().Value == TraceBuffer::Capacity + 9 && events.front().Value == 10;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Snapshots while recording only see whole events: ";
+  atomic<bool> recording(true);
+  thread writer([&buffer, &recording]() {
+    for (int64_t i = TraceBuffer::Capacity + 10; recording; i++) {
+      TraceEvent event;
+      event.Name = i % 2 == 0 ? "even" : "odd";
+      event.Phase = 'C';
+      event.Timestamp = i;
+      event.Duration = 0;
+      event.Value = i;
+      buffer.record(event);
+    }
+  });
+  passed = true;
+  for (int round = 0; round < 20; round++) {
+    events = buffer.snapshot();
+    for (size_t i = 0; i < events.size(); i++) {
+      const TraceEvent& event = events[i];
+      passed = passed && event.Value == event.Timestamp && string(event.Name) == (event.Timestamp < TraceBuffer::Capacity + 10 ? "count" : event.Timestamp % 2 == 0 ? "even" : "odd") &&
+               (i == 0 || event.Timestamp > events[i - 1].Timestamp);
+    }
+    passed = passed && events.size() <= TraceBuffer::Capacity;
+  }
+  recording = false;
+  writer.join();
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Threads that ended give back their buffers: ";
+  thread([]() { traceCounter("warm", 0); }).join();
+  int buffers = numTraceBuffers();
+  for (int i = 0; i < 20; i++) {
+    thread([]() { traceCounter("short", 1); }).join();
+  }
+  passed = numTraceBuffers() == buffers;
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Chrome trace export: ";
+  clearTrace();
+  vector<State> states = { State(0, "q0", true, false), State(1, "q1", false, true) };
+  convertNFAtoDFA(NFA(false, states, { Transition(0, 0, 0, "0"), Transition(1, 0, 0, "1"), Transition(2, 0, 1, "1") }));
+  JSONValue trace = parseJSON(exportChromeTrace());
+  passed = trace["traceEvents"].Type == JSONType::Array;
+#ifdef MAINCODE_TRACING
+  bool foundSpan = false;
+  for (const JSONValue& event : trace["traceEvents"].Elements) {
+    foundSpan = foundSpan || (event["name"].StringValue == "convertNFAtoDFA" && event["ph"].StringValue == "X");
+  }
+  passed = passed && foundSpan;
+#else
+  passed = passed && trace["traceEvents"].Elements.empty();
+#endif
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
+// Random DFA with every state id equal to its index, missing roughly one transition in missingOneIn
+NFA randomDFA(int numStates, vector<string> tokens, int missingOneIn) {
+  vector<State> states;
+  vector<Transition> transitions;
+  for (int i = 0; i < numStates; i++) {
+    states.push_back(State(i, "q" + to_string(i), i == 0, rand() % 2 == 0));
+    for (const string& token : tokens) {
+      if (missingOneIn == 0 || rand() % missingOneIn != 0) {
+        transitions.push_back(Transition(transitions.size(), i, rand() % numStates, token));
+      }
+    }
+  }
+  return NFA(true, states, transitions);
+}
+
+// Walks the plain int table, as runs did before the kernels
+int runGenericTable(const CompiledDFA& dfa, const vector<int>& symbols) {
+  int state = dfa.Start;
+  for (int symbol : symbols) {
+    state = dfa.Table[state * dfa.numSymbols() + symbol];
+    if (state == -1) {
+      return -1;
+    }
+  }
+  return state;
+}
+
+bool dfaKernelTest() {
+  bool overallPass = true;
+  srand(0);
+
+  struct KernelCase {
+    string Description;
+    int NumStates;
+    vector<string> Tokens;
+    string Name;
+    size_t TableBytes;
+  };
+  vector<KernelCase> cases = {
+    { "Binary alphabet, few states", 10, { "0", "1" }, "8-bit states, 2 symbols", 11 * 2 },
+    { "Three symbols, 255 states", 255, { "0", "1", "a" }, "8-bit states, 3 symbols", 256 * 3 },
+    { "Binary alphabet, 256 states", 256, { "0", "1" }, "16-bit states, 2 symbols", 257 * 2 * 2 },
+    { "Large alphabet", 40, { "a", "b", "c", "d", "e", "f" }, "8-bit states, any number of symbols", 41 * 6 },
+    { "More than 65535 states", 70000, { "0", "1" }, "32-bit states, 2 symbols", 70001 * 2 * 4 },
+  };
+  for (const KernelCase& kernelCase : cases) {
+    cout << "- " << kernelCase.Description << ": ";
+    CompiledDFA dfa(randomDFA(kernelCase.NumStates, kernelCase.Tokens, 4));
+    bool passed = dfa.Kernel->name() == kernelCase.Name && dfa.Kernel->tableBytes() == kernelCase.TableBytes;
+    for (int i = 0; i < 200 && passed; i++) {
+      vector<int> symbols;
+      int length = rand() % 12;
+      for (int j = 0; j < length; j++) {
+        symbols.push_back(rand() % kernelCase.Tokens.size());
+      }
+      passed = dfa.Kernel->run(symbols, dfa.Start) == runGenericTable(dfa, symbols);
+    }
+    overallPass = overallPass && passed;
+    printOutcome(passed);
+  }
+
+  return overallPass;
+}
+
+bool simplifyDFABenchmark() {
+  // Throughput of the multi threaded simplifyDFA on random complete DFAs
+  cout << "\n";
+  srand(0);
+  for (int numStates : { 10000, 100000, 1000000 }) {
+    vector<State> states;
+    vector<Transition> transitions;
+    for (int i = 0; i < numStates; i++) {
+      states.push_back(State(i, "q" + to_string(i), i == 0, rand() % 2 == 0));
+      transitions.push_back(Transition(transitions.size(), i, rand() % numStates, "0"));
+      transitions.push_back(Transition(transitions.size(), i, rand() % numStates, "1"));
+    }
+    NFA dfa(true, states, transitions);
+    long singleThreadTime = 0;
+    for (int threads : { 1, 2, 4, 8 }) {
+      auto start = chrono::high_resolution_clock::now();
+      NFA result = simplifyDFA(dfa, threads);
+      auto end = chrono::high_resolution_clock::now();
+      long time = max(1L, (long)chrono::duration_cast<chrono::milliseconds>(end - start).count());
+      if (threads == 1) {
+        singleThreadTime = time;
+      }
+      cout << "\t" << numStates << " states, " << threads << " threads: " << time << "ms, " << (long)numStates * 1000 / time << " states/s, "
+           << (double)singleThreadTime / time << "x speedup, " << result.States.size() << " states after\n";
+    }
+  }
+  return true;
+}
+
+bool dfaKernelBenchmark() {
+  // Per character latency of the specialized run kernels against the plain int table, then whole runDFA calls on
+  // short words, where compiling the structure used to cost more than running it
+  cout << "\n";
+  srand(0);
+  for (int numStates : { 100, 1000, 100000 }) {
+    NFA structure = randomDFA(numStates, { "0", "1" }, 0);
+    CompiledDFA dfa(structure);
+    vector<int> symbols(10000000);
+    for (int& symbol : symbols) {
+      symbol = rand() % 2;
+    }
+    auto start = chrono::high_resolution_clock::now();
+    int genericResult = runGenericTable(dfa, symbols);
+    auto middle = chrono::high_resolution_clock::now();
+    int kernelResult = dfa.Kernel->run(symbols, dfa.Start);
+    auto end = chrono::high_resolution_clock::now();
+    double genericTime = chrono::duration<double, nano>(middle - start).count() / symbols.size();
+    double kernelTime = chrono::duration<double, nano>(end - middle).count() / symbols.size();
+    cout << "\t" << numStates << " states: int table " << genericTime << "ns/char, " << dfa.Table.size() * sizeof(int) << " bytes; "
+         << dfa.Kernel->name() << " " << kernelTime << "ns/char, " << dfa.Kernel->tableBytes() << " bytes; "
+         << genericTime / kernelTime << "x speedup" << (genericResult == kernelResult ? "" : " (MISMATCH)") << "\n";
+
+    vector<string> words(200);
+    for (string& word : words) {
+      for (int i = 0; i < 1000; i++) {
+        word += rand() % 2 == 0 ? '0' : '1';
+      }
+    }
+    compiledAutomata().clear();
+    start = chrono::high_resolution_clock::now();
+    size_t uncachedEnds = 0;
+    for (const string& word : words) {
+      uncachedEnds += CompiledDFA(structure).run(word).size(); // What every runDFA call did before the cache
+    }
+    middle = chrono::high_resolution_clock::now();
+    size_t cachedEnds = 0;
+    for (const string& word : words) {
+      cachedEnds += runDFA(structure, word).size(); // Includes the one compile on the first miss
+    }
+    end = chrono::high_resolution_clock::now();
+    double uncachedTime = chrono::duration<double, micro>(middle - start).count() / words.size();
+    double cachedTime = chrono::duration<double, micro>(end - middle).count() / words.size();
+    cout << "\t\t" << words.size() << " runDFA calls of " << words[0].size() << " chars: compiled each call " << uncachedTime << "us/call; cached "
+         << cachedTime << "us/call; " << uncachedTime / cachedTime << "x speedup" << (uncachedEnds == cachedEnds ? "" : " (MISMATCH)") << "\n";
+  }
+  return true;
+}
+
+bool reorderDFABenchmark() {
+  // Random walks over a DFA larger than cache whose states were numbered in random order
+  cout << "\n";
+  srand(0);
+  int numStates = 4000000;
+  vector<int> ids(numStates);
+  for (int i = 0; i < numStates; i++) {
+    ids[i] = i;
+  }
+  random_shuffle(ids.begin() + 1, ids.end());
+  vector<State> states;
+  vector<Transition> transitions;
+  for (int i = 0; i < numStates; i++) {
+    states.push_back(State(ids[i], "q" + to_string(i), i == 0, i % 3 == 0));
+    transitions.push_back(Transition(transitions.size(), ids[i], ids[(i + 1) % numStates], "0"));
+    transitions.push_back(Transition(transitions.size(), ids[i], ids[(i + 2) % numStates], "1"));
+  }
+  NFA dfa(true, states, transitions);
+  string word;
+  for (int i = 0; i < 10000000; i++) {
+    word += rand() % 2 == 0 ? '0' : '1';
+  }
+  vector<string> samples = { word.substr(0, 1000000) };
+
+  double originalTime = 0;
+  for (int order = -1; order < 3; order++) {
+    CompiledDFA compiled(dfa);
+    if (order >= 0) {
+      compiled.reorder((StateOrder)order, samples);
+    }
+    auto start = chrono::high_resolution_clock::now();
+    set<int> result = compiled.run(word);
+    auto end = chrono::high_resolution_clock::now();
+    double time = chrono::duration<double, nano>(end - start).count() / word.size();
+    if (order == -1) {
+      originalTime = time;
+    }
+    string names[] = { "original", "breadth first", "depth first", "profile" };
+    cout << "\t" << names[order + 1] << ": " << time << "ns/char, " << originalTime / time << "x speedup, ends in " << *result.begin() << "\n";
+  }
+  return true;
+}
+
+bool photoToNFAAsyncTest() {
+  bool overallPass = true;
+
+  cout << "- Missing photo: ";
+  vector<string> stages;
+  shared_ptr<CancellationToken> cancellation = make_shared<CancellationToken>();
+  future<string> result = photoToNFAAsync("test_photos/missing.jpg", cancellation, [&](string stage, int percentage) {
+    stages.push_back(stage + " " + to_string(percentage));
+  });
+  bool passed = result.get() == "Could not open file" && stages == vector<string> { "loading 0" };
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  cout << "- Cancelled before loading: ";
+  cancellation->cancel();
+  result = photoToNFAAsync("test_photos/test_photo_16.jpg", cancellation);
+  passed = result.get() == "Cancelled";
+  overallPass = overallPass && passed;
+  printOutcome(passed);
+
+  return overallPass;
+}
+
 bool photoToNFATest() {
   cout << "\n";
   vector<long> times;
@@ -755,10 +2114,34 @@ int main() {
   tests.push_back(TestObject("getFinalStates", getFinalStatesTest, false));
   tests.push_back(TestObject("simplifyDFA", simplifyDFATest, true));
   tests.push_back(TestObject("convertNFAtoDFA", convertNFAtoDFATest, true));
+  tests.push_back(TestObject("boundedConvertNFAtoDFA", boundedConvertNFAtoDFATest, true));
   tests.push_back(TestObject("runDFA", runDFATest, true));
   tests.push_back(TestObject("runNFA", runNFATest, true));
+  tests.push_back(TestObject("traceRun", traceRunTest, true));
+  tests.push_back(TestObject("dfaLanguage", dfaLanguageTest, true));
+  tests.push_back(TestObject("tokenizer", tokenizerTest, true));
+  tests.push_back(TestObject("characterClass", characterClassTest, true));
+  tests.push_back(TestObject("lazyDFA", lazyDFATest, true));
+  tests.push_back(TestObject("dfaKernel", dfaKernelTest, true));
+  tests.push_back(TestObject("reorderDFA", reorderDFATest, true));
   tests.push_back(TestObject("validateNFA", validateNFATest, true));
   tests.push_back(TestObject("checkIfDFA", checkIfDFATest, true));
+  tests.push_back(TestObject("analyzeNFA", analyzeNFATest, true));
+  tests.push_back(TestObject("editableNFA", editableNFATest, true));
+  tests.push_back(TestObject("resultCache", resultCacheTest, true));
+  tests.push_back(TestObject("compiledAutomatonCache", compiledAutomatonCacheTest, true));
+  tests.push_back(TestObject("areEquivalent", areEquivalentTest, true));
+  tests.push_back(TestObject("isIncluded", isIncludedTest, true));
+  tests.push_back(TestObject("productOf", productOfTest, true));
+  tests.push_back(TestObject("reduceNFA", reduceNFATest, true));
+  tests.push_back(TestObject("nfaFromJSON", nfaFromJSONTest, true));
+  tests.push_back(TestObject("preprocessPhoto", preprocessPhotoTest, true));
+  tests.push_back(TestObject("photoPipeline", photoPipelineTest, true));
+  tests.push_back(TestObject("tracing", tracingTest, true));
+  tests.push_back(TestObject("photoToNFAAsync", photoToNFAAsyncTest, true));
+  // tests.push_back(TestObject("simplifyDFABenchmark", simplifyDFABenchmark, false));
+  // tests.push_back(TestObject("dfaKernelBenchmark", dfaKernelBenchmark, false));
+  // tests.push_back(TestObject("reorderDFABenchmark", reorderDFABenchmark, false));
   tests.push_back(TestObject("photoToDFA", photoToNFATest, false));
 
 
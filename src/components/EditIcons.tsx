@@ -18,7 +18,7 @@ import { Text, View } from 'react-native';
 import { stateRadius } from './NFADrawing';
 import { editIconStyles } from '../styles';
 import BasicButton from './BasicButton';
-import NFA from '../types/NFA';
+import NFA, { NFAEdit } from '../types/NFA';
 
 const symbolWidth = 130;
 const symbolHeight = 80;
@@ -127,7 +127,7 @@ const EditIcon = (props: EditIconProps) => {
 // Generates array of different EditIcons depending on the structure type.
 const EditIcons = (
   structure: Structure,
-  setCurrentStructure: (newStructure: Structure) => void
+  setCurrentStructure: (newStructure: Structure, edits: NFAEdit[]) => void
 ) => {
   const newStructure = copyStructure(structure);
 
@@ -138,13 +138,14 @@ const EditIcons = (
     while (newNfa.states.find(state => state.id === newId)) { // Get smallest new id
       newId++;
     }
-    newNfa.states.push({
+    const state = {
       id: newId,
       name: 'q' + newId,
       isStart: isStart,
       isFinal: isFinal,
-    });
-    setCurrentStructure(newStructure);
+    };
+    newNfa.states.push(state);
+    setCurrentStructure(newStructure, [{ type: 'addState', state: state }]);
   };
 
   switch (structure.type) {
@@ -2,16 +2,43 @@
 //  The loading screen used when long processes are occuring
 //
 
-import React from 'react';
+import React, { useEffect, useState } from 'react';
 import { Text, View } from 'react-native';
 
+import BasicButton from './BasicButton';
 import { loadingStyles } from '../styles';
+import CPPCode, { CPPCodeEvents } from '../nativeModules';
+
+type Progress = {
+  stage: string;
+  percentage: number;
+};
 
 const Loading = () => {
+  const [progress, setProgress] = useState<Progress>(); // Only set while a photo is being processed
+
+  // Show progress of the photo to NFA algorithm
+  useEffect(() => {
+    const subscription = CPPCodeEvents.addListener('photoToNFAProgress', setProgress);
+    return () => subscription.remove();
+  }, []);
+
   return (
     <View style={loadingStyles.container}>
       <View style={loadingStyles.box}>
         <Text style={loadingStyles.largeText}>Loading...</Text>
+        {progress ? (
+          <>
+            <Text style={loadingStyles.smallText}>
+              {progress.stage} ({progress.percentage}%)
+            </Text>
+            <BasicButton onPress={() => CPPCode.cancelPhotoToNFA()} small>
+              Cancel
+            </BasicButton>
+          </>
+        ) : (
+          <></>
+        )}
       </View>
     </View>
   );
@@ -6,7 +6,7 @@ import React from 'react';
 import { ActionSheetIOS, Alert } from 'react-native';
 import { Circle, Line, Path, Text } from 'react-native-svg';
 
-import NFA, { Transition } from '../types/NFA';
+import NFA, { NFAEdit, Transition } from '../types/NFA';
 import Structure, { copyStructure } from '../types/Structure';
 
 export const stateRadius = 30;
@@ -277,7 +277,7 @@ const getNewId = (transitions: Transition[]) => {
 const NFADrawing = (
   nfa: NFA,
   editable: boolean,
-  setCurrentStructure: (newStructure: Structure) => void,
+  setCurrentStructure: (newStructure: Structure, edits: NFAEdit[]) => void, // Edits describe the change, so it can be applied without comparing structures
   activeIds: number[] | undefined,
   selectedState: number | undefined,
   setSelectedState: (newValue: number | undefined) => void,
@@ -341,6 +341,7 @@ const NFADrawing = (
 
                 if (validInput) {
                   let duplicateTransition = false;
+                  const edits: NFAEdit[] = [];
                   tokens.forEach(token => {
                     const newId = getNewId(newNfa.transitions);
                     const start = selectedState!; // statePress is only called in edit mode, so this will not be undefined
@@ -356,15 +357,19 @@ const NFADrawing = (
                         duplicateTransition = true;
                       }
                     } else {
-                      newNfa.transitions.push({
+                      const transition = {
                         id: newId,
                         start: start,
                         end: id,
                         token: token,
-                      });
-                      setCurrentStructure({ structure: newNfa, type: 'nfa' });
+                      };
+                      newNfa.transitions.push(transition);
+                      edits.push({ type: 'addTransition', transition: transition });
                     }
                   });
+                  if (edits.length > 0) { // Set once, so every new transition is kept
+                    setCurrentStructure({ structure: newNfa, type: 'nfa' }, edits);
+                  }
                 } else {
                   Alert.alert('Error', 'The inputted text was not in the correct format. Tokens should be single characters seperated by commas.', [{ text: 'OK' }]);
                 }
@@ -388,13 +393,14 @@ const NFADrawing = (
               {
                 Alert.alert('Info', 'Transition already exists', [{ text: 'OK' }]);
               } else {
-                newNfa.transitions.push({
+                const transition = {
                   id: newId,
                   start: start,
                   end: id,
                   token: 'ε',
-                });
-                setCurrentStructure({ structure: newNfa, type: 'nfa' });
+                };
+                newNfa.transitions.push(transition);
+                setCurrentStructure({ structure: newNfa, type: 'nfa' }, [{ type: 'addTransition', transition: transition }]);
               }
               // Reset regardless
               setSelectedState(undefined);
@@ -414,6 +420,7 @@ const NFADrawing = (
       const transitions = newNfa.transitions.filter(
         transition => selectedTransitionArrow?.find(tId => tId === transition.id) !== undefined
       );
+      const edits: NFAEdit[] = [];
       transitions.forEach(transition => {
         // If transition with updated end state already exists, just delete it, else update the transition
         if (newNfa.transitions.find(
@@ -423,11 +430,13 @@ const NFADrawing = (
             existingTransition.token === transition.token))
         {
           newNfa.transitions = newNfa.transitions.filter(existingTransition => existingTransition.id !== transition.id);
+          edits.push({ type: 'removeTransition', id: transition.id });
         } else {
           transition.end = id;
+          edits.push({ type: 'updateTransition', transition: transition });
         }
       });
-      setCurrentStructure(newStructure);
+      setCurrentStructure(newStructure, edits);
       // Reset
       setSelectedTransitionArrow(undefined);
       setSelectingTransitionNewEndState(false);
@@ -441,6 +450,7 @@ const NFADrawing = (
       const transitions = newNfa.transitions.filter(
         transition => selectedTransitionArrow?.find(tId => tId === transition.id) !== undefined
       );
+      const edits: NFAEdit[] = [];
       transitions.forEach(transition => {
         // If transition with updated start state already exists, just delete it, else update the transition
         if (newNfa.transitions.find(
@@ -450,14 +460,16 @@ const NFADrawing = (
             existingTransition.token === transition.token))
         {
           newNfa.transitions = newNfa.transitions.filter(existingTransition => existingTransition.id !== transition.id);
+          edits.push({ type: 'removeTransition', id: transition.id });
         } else {
           transition.start = id;
+          edits.push({ type: 'updateTransition', transition: transition });
         }
       });
       setSelectedTransitionArrow(undefined);
       // Reset
       setSelectingTransitionNewStartState(false);
-      setCurrentStructure(newStructure);
+      setCurrentStructure(newStructure, edits);
 
     // Nothing special is happening, just display options
     } else {
@@ -514,7 +526,7 @@ const NFADrawing = (
                     onPress: text => {
                       if (text) {
                         state.name = text;
-                        setCurrentStructure(newStructure);
+                        setCurrentStructure(newStructure, [{ type: 'updateState', state: state }]);
                       }
                       setSelectedState(undefined);
                     },
@@ -531,13 +543,13 @@ const NFADrawing = (
             case 3:
               // Make start
               state.isStart = !state.isStart;
-              setCurrentStructure(newStructure);
+              setCurrentStructure(newStructure, [{ type: 'updateState', state: state }]);
               setSelectedState(undefined);
               break;
             case 4:
               // Make final
               state.isFinal = !state.isFinal;
-              setCurrentStructure(newStructure);
+              setCurrentStructure(newStructure, [{ type: 'updateState', state: state }]);
               setSelectedState(undefined);
               break;
             case 5:
@@ -551,7 +563,7 @@ const NFADrawing = (
                     onPress: () => {
                       newNfa.states = newNfa.states.filter(s => s.id !== id); // Remove state
                       newNfa.transitions = newNfa.transitions.filter(t => t.start !== id && t.end !== id); // Remove all transitions connected to state
-                      setCurrentStructure(newStructure);
+                      setCurrentStructure(newStructure, [{ type: 'removeState', id: id }]); // Native side also removes the connected transitions
                       setSelectedState(undefined);
                     },
                     style: 'destructive',
@@ -694,7 +706,19 @@ const NFADrawing = (
                       newTransitions.forEach(transition =>
                         newNfa.transitions.push(transition)
                       );
-                      setCurrentStructure(newStructure);
+                      // Kept transitions have the same id, ends and token, so only the others change
+                      const edits: NFAEdit[] = [];
+                      transitions.forEach(transition => {
+                        if (!newTransitions.find(newTransition => newTransition.id === transition.id)) {
+                          edits.push({ type: 'removeTransition', id: transition.id });
+                        }
+                      });
+                      newTransitions.forEach(newTransition => {
+                        if (!transitions.find(transition => transition.id === newTransition.id)) {
+                          edits.push({ type: 'addTransition', transition: newTransition });
+                        }
+                      });
+                      setCurrentStructure(newStructure, edits);
                     } else {
                       Alert.alert('Error', 'The inputted text was not in the correct format. Tokens should be single characters seperated by commas.', [{ text: 'OK' }]);
                     }
@@ -709,23 +733,28 @@ const NFADrawing = (
             break;
           case 4:
             // Add or remove epsilon transition
+            const epsilonEdits: NFAEdit[] = [];
             if (containsEpsilon) {
               // Filter out all epsilon transitions from the selected transitions
+              const epsilonTransitions = transitions.filter(transition => transition.token === 'ε');
               newNfa.transitions = newNfa.transitions.filter(
                 newNfaTransition =>
-                  newNfaTransition.token === 'ε' && transitions.find(transition => transition.id === newNfaTransition.id) !== undefined
+                  epsilonTransitions.find(transition => transition.id === newNfaTransition.id) === undefined
               );
+              epsilonTransitions.forEach(transition => epsilonEdits.push({ type: 'removeTransition', id: transition.id }));
             } else {
               // Create a new epsilon transition
               const newId = getNewId(newNfa.transitions);
-              newNfa.transitions.push({
+              const transition = {
                 id: newId,
                 start: start,
                 end: end,
                 token: 'ε',
-              });
+              };
+              newNfa.transitions.push(transition);
+              epsilonEdits.push({ type: 'addTransition', transition: transition });
             }
-            setCurrentStructure(newStructure);
+            setCurrentStructure(newStructure, epsilonEdits);
             setSelectedTransitionArrow(undefined); // Reset
             break;
           case 5:
@@ -741,7 +770,7 @@ const NFADrawing = (
                     newNfa.transitions = newNfa.transitions.filter(
                       t => transitions.find(selectedTransition => selectedTransition.id === t.id) === undefined
                     );
-                    setCurrentStructure(newStructure);
+                    setCurrentStructure(newStructure, transitions.map((transition): NFAEdit => ({ type: 'removeTransition', id: transition.id })));
                     setSelectedState(undefined); // Reset
                   },
                   style: 'destructive',
@@ -9,7 +9,7 @@ import RNFS from 'react-native-fs';
 
 import Structure from '../types/Structure';
 import NFADrawing, { exportNFA } from './NFADrawing';
-import NFA from '../types/NFA';
+import NFA, { NFAEdit } from '../types/NFA';
 
 type StructureDrawingProps = {
   structure: Structure;
@@ -19,7 +19,7 @@ type StructureDrawingProps = {
   translateX: number;
   translateY: number;
   editable?: boolean;
-  setCurrentStructure?: (newStructure: Structure) => void;
+  setCurrentStructure?: (newStructure: Structure, edits: NFAEdit[]) => void;
   activeIds?: number[];
   selectedState?: number | undefined;
   setSelectedState?: (newValue: number | undefined) => void;
@@ -1,4 +1,4 @@
-import { NativeModules } from 'react-native';
+import { NativeEventEmitter, NativeModules } from 'react-native';
 
 // Get native module
 const { CPPCode } = NativeModules;
@@ -6,4 +6,7 @@ if (!CPPCode) {
   throw new Error('CPPCode is null');
 }
 
+// Emits photoToNFAProgress events, with stage and percentage, while a photo is processed
+export const CPPCodeEvents = new NativeEventEmitter(CPPCode);
+
 export default CPPCode;
@@ -89,6 +89,8 @@ const CameraPage = (props: CameraPageProps) => {
           case 'More than 1 start state':
             Alert.alert('Problem with structure', result, [{ text: 'OK' }]);
             break;
+          case 'Cancelled': // Cancelled by the user, or replaced by a newer photo
+            break;
           default:
             throw error; // Different error occured, throw it
         }
@@ -63,6 +63,8 @@ const CameraRollPage = (props: CameraRollPageProps) => {
           case 'More than 1 start state':
             Alert.alert('Problem with structure', result, [{ text: 'OK' }]);
             break;
+          case 'Cancelled': // Cancelled by the user, or replaced by a newer photo
+            break;
           default:
             throw error; // Different error occured, throw it
         }
@@ -15,7 +15,7 @@ import StructureDrawing from '../components/StructureDrawing';
 import EditIcons from '../components/EditIcons';
 import BasicButton from '../components/BasicButton';
 import CPPCode from '../nativeModules';
-import NFA from '../types/NFA';
+import NFA, { NFAEdit } from '../types/NFA';
 import { addToPreviousStructures } from '../helperFunctions';
 
 const initialPosition = {
@@ -57,6 +57,32 @@ const EditPage = (props: EditPageProps) => {
   const previousTranslateYRef = useRef(initialPosition.x);
   const initialPinchSize = useRef<number | undefined>(undefined);
 
+  // Native copy of the structure being edited, which keeps its validity and determinism up to date after each edit
+  const analysis = useRef<Promise<string> | undefined>(undefined);
+
+  useEffect(() => {
+    if (currentStructure.type === 'nfa') {
+      analysis.current = CPPCode.startEditing(currentStructure.structure as NFA);
+    }
+  }, []); // eslint-disable-line react-hooks/exhaustive-deps
+
+  // Sets the new structure, and sends the edits that made it, as given by the action that changed it, to the native copy
+  const updateStructure = (newStructure: Structure, edits: NFAEdit[]) => {
+    if (currentStructure.type === 'nfa' && newStructure.type === 'nfa' && edits.length > 0) {
+      const previousAnalysis = analysis.current;
+      analysis.current = (async () => {
+        try {
+          await previousAnalysis; // Edits must be applied in order
+          return await CPPCode.applyNFAEdits(edits);
+        } catch (error) {
+          // The native copy missed an edit, so start again from the whole structure
+          return await CPPCode.startEditing(newStructure.structure as NFA);
+        }
+      })();
+    }
+    setCurrentStructure(newStructure);
+  };
+
   // Reset if editing is turned off
   useEffect(() => {
     if (editing === false) {
@@ -151,16 +177,16 @@ const EditPage = (props: EditPageProps) => {
   const save = async () => {
     try {
       let validationCode = 0;
+      let isDfa = false;
       switch (currentStructure.type) {
         case 'nfa':
-          const nfa = currentStructure.structure as NFA;
-          validationCode = await CPPCode.validateNFA(nfa); // Check if nfa is valid
+          const summary = JSON.parse(await analysis.current); // Already kept up to date while editing
+          validationCode = summary.validationCode;
+          isDfa = summary.isDfa;
       }
       if (validationCode === 0) {
         switch (currentStructure.type) {
           case 'nfa':
-            const nfa = currentStructure.structure as NFA;
-            const isDfa = await CPPCode.checkIfDFA(nfa); // Calculate if it is a DFA
             const newStructure = copyStructure(currentStructure);
             const newNfa = newStructure.structure as NFA;
             newNfa.isDfa = isDfa; // Update new NFA
@@ -225,7 +251,7 @@ const EditPage = (props: EditPageProps) => {
                 translateX={translateX}
                 translateY={translateY}
                 editable={editing}
-                setCurrentStructure={setCurrentStructure}
+                setCurrentStructure={updateStructure}
                 selectedState={selectedState}
                 setSelectedState={setSelectedState}
                 selectedTransitionArrow={selectedTransitionArrow}
@@ -251,7 +277,7 @@ const EditPage = (props: EditPageProps) => {
                 translateX={translateX}
                 translateY={translateY}
                 editable={editing}
-                setCurrentStructure={setCurrentStructure}
+                setCurrentStructure={updateStructure}
                 selectedState={selectedState}
                 setSelectedState={setSelectedState}
                 selectedTransitionArrow={selectedTransitionArrow}
@@ -313,7 +339,7 @@ const EditPage = (props: EditPageProps) => {
       )}
       <View style={editPageStyles.line} />
       <ScrollView style={editPageStyles.scrollView}>
-        {EditIcons(currentStructure, setCurrentStructure)}
+        {EditIcons(currentStructure, updateStructure)}
       </ScrollView>
     </>
   );
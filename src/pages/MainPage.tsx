@@ -16,6 +16,7 @@ import CameraIcon from '../../res/camera_icon.png';
 import ShareIcon from '../../res/share_icon.png';
 import EditIcon from '../../res/edit_icon.png';
 import NFA from '../types/NFA';
+import RunTrace, { stepActiveIds } from '../types/RunTrace';
 import CPPCode from '../nativeModules';
 import { addToPreviousStructures } from '../helperFunctions';
 
@@ -25,6 +26,13 @@ const initialPosition = {
   y: 0,
 };
 
+// Largest conversion attempted before giving up, so a pathological NFA cannot hang the app
+const conversionBudget = {
+  maxStates: 20000,
+  maxBytes: 64 * 1024 * 1024,
+  maxMilliseconds: 5000,
+};
+
 type MainPageProps = {
   setPageNumber: (newPage: number) => void;
   structure: Structure;
@@ -38,8 +46,9 @@ const MainPage = (props: MainPageProps) => {
   const [svgHeight, setSvgHeight] = useState(0);
   const [textToRun, setTextToRun] = useState(''); // Contains full text that will be ran on the structure (text in text box)
   const [runResult, setRunResult] = useState<boolean | undefined>(undefined);
-  const [runCharacterText, setRunCharacterText] = useState(''); // Contains the text that needs to be ran for the next character input
-  const [activeIds, setActiveIds] = useState([]);
+  const [runTrace, setRunTrace] = useState<RunTrace | undefined>(undefined); // Active states after every prefix of textToRun, fetched on the first step
+  const [runStep, setRunStep] = useState(0); // Step of runTrace being shown
+  const [activeIds, setActiveIds] = useState<number[]>([]);
 
   // Used for the PanResponder
   const [scale, setScale] = useState(initialPosition.zoom);
@@ -61,6 +70,13 @@ const MainPage = (props: MainPageProps) => {
     translateYRef.current = translateY;
   }, [scale, translateX, translateY]);
 
+  // Stop any conversion still running when leaving the page
+  useEffect(() => {
+    return () => {
+      CPPCode.cancelConversion();
+    };
+  }, []);
+
   const panResponder = useRef(
     PanResponder.create({
       onStartShouldSetPanResponder: () => true,
@@ -113,7 +129,8 @@ const MainPage = (props: MainPageProps) => {
   // Resets all run varaiables, except textToRun as the text box's value can remain
   const resetRunResult = () => {
     setRunResult(undefined);
-    setRunCharacterText('');
+    setRunTrace(undefined);
+    setRunStep(0);
     setActiveIds([]);
   };
 
@@ -164,23 +181,43 @@ const MainPage = (props: MainPageProps) => {
     }
   };
 
-  // Runs the next character on the structure
-  const runCharacter = async () => {
-    if (runCharacterText === textToRun) { // Ran each character, so just run the full thing to get the result
-      await runStructure();
-    } else {
-      try {
-        const newText = runCharacterText + textToRun[runCharacterText.length]; // Get text up to new character
-        switch (props.structure.type) {
-          case 'nfa':
-            const nfa = props.structure.structure as NFA;
-            const result = await CPPCode.runCharacter(nfa, newText); // Get resulting active ids
-            setActiveIds(result);
-        }
-        setRunCharacterText(newText); // Update variable for next press
-      } catch (error) {
-        console.error(error);
+  // Gets the trace of textToRun, running it natively only the first time
+  const getRunTrace = async () => {
+    if (runTrace !== undefined) {
+      return runTrace;
+    }
+    switch (props.structure.type) {
+      case 'nfa':
+        const nfa = props.structure.structure as NFA;
+        const trace: RunTrace = JSON.parse(await CPPCode.traceRun(nfa, textToRun));
+        setRunTrace(trace);
+        return trace;
+      default:
+        return undefined;
+    }
+  };
+
+  // Shows the active states after the next or previous token of the text
+  const runCharacter = async (direction: 1 | -1) => {
+    try {
+      const trace = await getRunTrace();
+      if (trace === undefined) {
+        return;
+      }
+      const step = runStep + direction;
+      if (step >= trace.ends.length) { // Ran each character, so show the result of the full text
+        setRunResult(trace.accepted[trace.accepted.length - 1]);
+        setRunTrace(undefined);
+        setRunStep(0);
+        setActiveIds([]);
+      } else if (step >= 0) {
+        // Nothing is shown until the first step, even after stepping back from step 0, so start from the states step 0 enters
+        const active = runStep === 0 && activeIds.length === 0 ? trace.entered[0] : activeIds;
+        setActiveIds(stepActiveIds(trace, active, runStep, direction));
+        setRunStep(step);
       }
+    } catch (error) {
+      console.error(error);
     }
   };
 
@@ -190,11 +227,12 @@ const MainPage = (props: MainPageProps) => {
       case 'nfa':
         const nfa = props.structure.structure as NFA;
         try {
-          const result = await CPPCode.runNFAorDFA(nfa, textToRun); // Run algorithm
+          const result = await CPPCode.runNFAorDFA(nfa, textToRun, true); // Run algorithm, lazily so repeated runs reuse DFA states
           setRunResult(result);
 
           // Reset variables
-          setRunCharacterText('');
+          setRunTrace(undefined);
+          setRunStep(0);
           setActiveIds([]);
         } catch (error) {
           console.error('Error occured while simplifying structure: ' + error);
@@ -206,8 +244,18 @@ const MainPage = (props: MainPageProps) => {
   // Converts an NFA to a DFA
   const convertNFAtoDFA = async () => {
     try {
-      const result = JSON.parse(await CPPCode.convertNFAtoDFA(props.structure.structure as NFA)); // Run algorithm
-      props.setStructure(result);
+      const result = JSON.parse(
+        await CPPCode.convertNFAtoDFAWithBudget(props.structure.structure as NFA, conversionBudget)
+      ); // Run algorithm
+      if (!result.completed) {
+        Alert.alert(
+          'DFA too large',
+          'Stopped after finding ' + result.statesDiscovered + ' states (limit: ' + result.exceededLimit + ')',
+          [{ text: 'OK' }]
+        );
+        return;
+      }
+      props.setStructure(result.dfa);
       resetRunResult(); // Structure changed so reset run variables
     } catch (error) {
       console.error('Error occured while converting NFA to DFA: ' + error);
@@ -310,7 +358,10 @@ const MainPage = (props: MainPageProps) => {
           }}
           value={textToRun}
         />
-        <BasicButton small style={mainPageStyles.runStep} onPress={runCharacter}>
+        <BasicButton small style={mainPageStyles.runStep} onPress={() => runCharacter(-1)}>
+          Back
+        </BasicButton>
+        <BasicButton small style={mainPageStyles.runStep} onPress={() => runCharacter(1)}>
           Run Character
         </BasicButton>
         <BasicButton small onPress={runStructure}>
@@ -265,8 +265,9 @@ export const loadingStyles = StyleSheet.create({
     justifyContent: 'center',
   },
   box: {
-    height: 100,
+    minHeight: 100,
     width: 200,
+    padding: 10,
     backgroundColor: gray,
     borderRadius: 15,
     justifyContent: 'center',
@@ -275,6 +276,10 @@ export const loadingStyles = StyleSheet.create({
   largeText: {
     fontSize: 20,
   },
+  smallText: {
+    fontSize: 14,
+    marginVertical: 5,
+  },
 });
 
 export const editIconStyles = StyleSheet.create({
@@ -1,4 +1,4 @@
-type State = {
+export type State = {
   id: number;
   name: string;
   isStart: boolean;
@@ -18,4 +18,10 @@ type NFA = {
   transitions: Transition[];
 };
 
+// A single change to an NFA, applied to the native editable model so it does not have to re-analyse the whole structure
+export type NFAEdit =
+  | { type: 'addState' | 'updateState'; state: State }
+  | { type: 'removeState' | 'removeTransition'; id: number }
+  | { type: 'addTransition' | 'updateTransition'; transition: Transition };
+
 export default NFA;
@@ -0,0 +1,24 @@
+// Active states after every prefix of a word, as returned by the native traceRun.
+// Step 0 is the empty prefix, and each step stores only the states that changed
+type RunTrace = {
+  ends: number[]; // Number of characters read after each step
+  entered: number[][];
+  left: number[][];
+  accepted: boolean[];
+};
+
+// Moves the ids active after a step to the next or previous step, applying only the changes of the step between them.
+// Going back undoes the step, as the states it entered were not active before it and the states it left were
+export const stepActiveIds = (trace: RunTrace, active: number[], step: number, direction: 1 | -1) => {
+  const ids = new Set(active);
+  if (direction === 1) {
+    trace.left[step + 1].forEach(id => ids.delete(id));
+    trace.entered[step + 1].forEach(id => ids.add(id));
+  } else {
+    trace.entered[step].forEach(id => ids.delete(id));
+    trace.left[step].forEach(id => ids.add(id));
+  }
+  return [...ids];
+};
+
+export default RunTrace;